@@ -5,10 +5,12 @@
 #include <linalg.h>
 
 #include <algorithm>
+#include <array>
 #include <cstddef>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -17,6 +19,13 @@ namespace cg::renderer {
 using namespace linalg::aliases;
 
 static constexpr float kDefaultDepth = std::numeric_limits<float>::max();
+static constexpr std::size_t kPostTransformCacheSize = 64;
+
+// How far the interpolated texture coordinates move per pixel step right and down, for choosing a mip level
+struct texcoord_derivatives {
+    float2 dx;
+    float2 dy;
+};
 
 template <typename VertexBufferElement, typename RenderTargetElement>
 class rasterizer {
@@ -29,17 +38,32 @@ class rasterizer {
     void clear_render_target(const RenderTargetElement& in_clear_value, float in_depth = kDefaultDepth);
 
     void set_vertex_buffer(std::shared_ptr<resource<VertexBufferElement>> in_vertex_buffer);
+    // Vertices are decoded as they are fetched, before the vertex shader
+    void set_vertex_buffer(std::shared_ptr<resource<packed_vertex>> in_vertex_buffer,
+                           const vertex_quantization& in_quantization);
+    // Only the members named by `set_shader_inputs` are fetched from the streams
+    void set_vertex_buffer(const vertex_streams& in_vertex_streams);
+    // Members of the vertex the bound shaders read; the others reach them zeroed from streams
+    void set_shader_inputs(const vertex_attributes& in_shader_inputs);
     void set_index_buffer(std::shared_ptr<resource<std::size_t>> in_index_buffer);
 
     void set_vertex_shader(
         std::function<std::pair<float4, VertexBufferElement>(float4 vertex, VertexBufferElement vertex_data)> shader);
-    void set_pixel_shader(std::function<cg::color(const VertexBufferElement& vertex_data, float z)> shader);
+    // With `cg::vertex` the shader gets perspective-correct texture coordinates for the pixel; other members come
+    // from one vertex of the triangle
+    void set_pixel_shader(std::function<cg::color(
+                              const VertexBufferElement& vertex_data, float z, const texcoord_derivatives& derivatives)>
+                              shader);
 
     void draw(std::size_t num_vertices, std::size_t vertex_offset);
 
   protected:
     // NOLINTBEGIN(*-non-private-*)
     std::shared_ptr<cg::resource<VertexBufferElement>> vertex_buffer;
+    std::shared_ptr<cg::resource<packed_vertex>> packed_vertex_buffer;
+    vertex_quantization quantization{};
+    vertex_streams streams;
+    vertex_attributes shader_inputs;
     std::shared_ptr<cg::resource<std::size_t>> index_buffer;
     std::shared_ptr<cg::resource<RenderTargetElement>> render_target;
     std::shared_ptr<cg::resource<float>> depth_buffer;
@@ -48,9 +72,11 @@ class rasterizer {
     std::size_t height;
 
     std::function<std::pair<float4, VertexBufferElement>(float4 vertex, VertexBufferElement vertex_data)> vertex_shader;
-    std::function<cg::color(const VertexBufferElement& vertex_data, float z)> pixel_shader;
+    std::function<cg::color(const VertexBufferElement& vertex_data, float z, const texcoord_derivatives& derivatives)>
+        pixel_shader;
     // NOLINTEND(*-non-private-*)
 
+    VertexBufferElement fetch_vertex(std::size_t index) const;
     int edge_function(int2 a, int2 b, int2 p);
     bool depth_test(float z, std::size_t x, std::size_t y);
 };
@@ -74,6 +100,31 @@ void rasterizer<VB, RT>::clear_render_target(const RT& in_clear_value, const flo
 template <typename VB, typename RT>
 void rasterizer<VB, RT>::set_vertex_buffer(std::shared_ptr<resource<VB>> in_vertex_buffer) {
     vertex_buffer = std::move(in_vertex_buffer);
+    packed_vertex_buffer = nullptr;
+    streams = {};
+}
+
+template <typename VB, typename RT>
+void rasterizer<VB, RT>::set_vertex_buffer(std::shared_ptr<resource<packed_vertex>> in_vertex_buffer,
+                                           const vertex_quantization& in_quantization) {
+    static_assert(std::is_same_v<VB, cg::vertex>, "Packed vertices decode to cg::vertex only");
+    packed_vertex_buffer = std::move(in_vertex_buffer);
+    quantization = in_quantization;
+    vertex_buffer = nullptr;
+    streams = {};
+}
+
+template <typename VB, typename RT>
+void rasterizer<VB, RT>::set_vertex_buffer(const vertex_streams& in_vertex_streams) {
+    static_assert(std::is_same_v<VB, cg::vertex>, "Vertex streams gather into cg::vertex only");
+    streams = in_vertex_streams;
+    vertex_buffer = nullptr;
+    packed_vertex_buffer = nullptr;
+}
+
+template <typename VB, typename RT>
+void rasterizer<VB, RT>::set_shader_inputs(const vertex_attributes& in_shader_inputs) {
+    shader_inputs = in_shader_inputs;
 }
 
 template <typename VB, typename RT>
@@ -83,23 +134,38 @@ void rasterizer<VB, RT>::set_index_buffer(std::shared_ptr<resource<std::size_t>>
 
 template <typename VB, typename RT>
 void rasterizer<VB, RT>::draw(std::size_t num_vertices, std::size_t vertex_offset) {
+    // Post-transform cache: a vertex shaded recently is reused instead of running the vertex shader again. Slots
+    // are picked by index, which suits buffers numbered in order of first use.
+    std::array<std::size_t, kPostTransformCacheSize> cached_indices;
+    std::array<VB, kPostTransformCacheSize> cached_vertices;
+    std::array<float, kPostTransformCacheSize> cached_inverse_w;
+    cached_indices.fill(std::numeric_limits<std::size_t>::max());
+
     for (std::size_t vertex_i = vertex_offset; vertex_i < num_vertices + vertex_offset;) {
         std::vector<VB> vertices;
         vertices.reserve(3); // take by portions of 3
-        vertices.push_back(vertex_buffer->item(index_buffer->item(vertex_i++)));
-        vertices.push_back(vertex_buffer->item(index_buffer->item(vertex_i++)));
-        vertices.push_back(vertex_buffer->item(index_buffer->item(vertex_i++)));
-
-        for (VB& vertex : vertices) {
-            float4 coords{vertex.v.x, vertex.v.y, vertex.v.z, 1};
-            std::pair<float4, VB> transformed = vertex_shader(coords, vertex);
-
-            vertex.v.x = transformed.first.x / transformed.first.w;
-            vertex.v.y = transformed.first.y / transformed.first.w;
-            vertex.v.z = transformed.first.z / transformed.first.w;
-
-            vertex.v.x = (vertex.v.x + 1) * width / 2;
-            vertex.v.y = (-vertex.v.y + 1) * height / 2;
+        std::array<float, 3> inverse_w{};
+        for (std::size_t corner_i = 0; corner_i < 3; ++corner_i) {
+            std::size_t index = index_buffer->item(vertex_i++);
+            std::size_t slot = index % kPostTransformCacheSize;
+            if (cached_indices[slot] != index) {
+                VB vertex = fetch_vertex(index);
+                float4 coords{vertex.v.x, vertex.v.y, vertex.v.z, 1};
+                std::pair<float4, VB> transformed = vertex_shader(coords, vertex);
+
+                vertex.v.x = transformed.first.x / transformed.first.w;
+                vertex.v.y = transformed.first.y / transformed.first.w;
+                vertex.v.z = transformed.first.z / transformed.first.w;
+
+                vertex.v.x = (vertex.v.x + 1) * width / 2;
+                vertex.v.y = (-vertex.v.y + 1) * height / 2;
+
+                cached_indices[slot] = index;
+                cached_vertices[slot] = vertex;
+                cached_inverse_w[slot] = 1.F / transformed.first.w;
+            }
+            inverse_w[corner_i] = cached_inverse_w[slot];
+            vertices.push_back(cached_vertices[slot]);
         }
 
         int2 vertex_a{static_cast<int>(vertices[0].v.x), static_cast<int>(vertices[0].v.y)};
@@ -116,6 +182,30 @@ void rasterizer<VB, RT>::draw(std::size_t num_vertices, std::size_t vertex_offse
 
         float edge = edge_function(vertex_a, vertex_b, vertex_c);
 
+        // Barycentrics are affine in screen space, so their steps per pixel are constant over the triangle.
+        // Texture coordinates divided by w interpolate linearly too, and dividing by the interpolated 1/w
+        // restores them with perspective.
+        float3 bary_dx = float3{static_cast<float>(vertex_c.y - vertex_b.y),
+                                static_cast<float>(vertex_a.y - vertex_c.y),
+                                static_cast<float>(vertex_b.y - vertex_a.y)} /
+                         edge;
+        float3 bary_dy = float3{static_cast<float>(vertex_b.x - vertex_c.x),
+                                static_cast<float>(vertex_c.x - vertex_a.x),
+                                static_cast<float>(vertex_a.x - vertex_b.x)} /
+                         edge;
+        auto interpolate_texcoord = [&](const float3& bary) {
+            float2 texcoord{0.F, 0.F};
+            if constexpr (std::is_same_v<VB, cg::vertex>) {
+                float weight = 0.F;
+                for (std::size_t corner_i = 0; corner_i < 3; ++corner_i) {
+                    texcoord += vertices[corner_i].tex * (bary[corner_i] * inverse_w[corner_i]);
+                    weight += bary[corner_i] * inverse_w[corner_i];
+                }
+                texcoord /= weight;
+            }
+            return texcoord;
+        };
+
         for (int x = min_vertex.x; x < max_vertex.x; ++x) {
             for (int y = min_vertex.y; y < max_vertex.y; ++y) {
                 int2 point{x, y};
@@ -125,7 +215,15 @@ void rasterizer<VB, RT>::draw(std::size_t num_vertices, std::size_t vertex_offse
                 if (u >= 0 && v >= 0 && w >= 0) {
                     float depth = (u * vertices[0].v.z) + (v * vertices[1].v.z) + (w * vertices[2].v.z);
                     if (depth_test(depth, x, y)) {
-                        color result = pixel_shader(vertices[1], depth);
+                        VB pixel = vertices[1];
+                        texcoord_derivatives derivatives{};
+                        if constexpr (std::is_same_v<VB, cg::vertex>) {
+                            float3 bary{u, v, w};
+                            pixel.tex = interpolate_texcoord(bary);
+                            derivatives.dx = interpolate_texcoord(bary + bary_dx) - pixel.tex;
+                            derivatives.dy = interpolate_texcoord(bary + bary_dy) - pixel.tex;
+                        }
+                        color result = pixel_shader(pixel, depth, derivatives);
                         render_target->item(x, y) = RT::from_color(result);
                         depth_buffer->item(x, y) = depth;
                     }
@@ -135,6 +233,17 @@ void rasterizer<VB, RT>::draw(std::size_t num_vertices, std::size_t vertex_offse
     }
 }
 
+template <typename VB, typename RT>
+VB rasterizer<VB, RT>::fetch_vertex(std::size_t index) const {
+    if constexpr (std::is_same_v<VB, cg::vertex>) {
+        if (packed_vertex_buffer)
+            return quantization.decode(packed_vertex_buffer->item(index));
+        if (streams.positions)
+            return streams.gather(index, shader_inputs);
+    }
+    return vertex_buffer->item(index);
+}
+
 template <typename VB, typename RT>
 int rasterizer<VB, RT>::edge_function(int2 a, int2 b, int2 p) { // point P relative to AB
     int dy = b.y - a.y;
@@ -155,7 +264,8 @@ void rasterizer<VB, RT>::set_vertex_shader(std::function<std::pair<float4, VB>(f
 }
 
 template <typename VB, typename RT>
-void rasterizer<VB, RT>::set_pixel_shader(std::function<cg::color(const VB& vertex_data, float z)> shader) {
+void rasterizer<VB, RT>::set_pixel_shader(
+    std::function<cg::color(const VB& vertex_data, float z, const texcoord_derivatives& derivatives)> shader) {
     pixel_shader = std::move(shader);
 }
 
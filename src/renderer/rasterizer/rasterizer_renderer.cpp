@@ -8,6 +8,7 @@
 #include <cstddef>
 #include <memory>
 #include <utility>
+#include <vector>
 
 namespace cg {
 
@@ -21,18 +22,34 @@ void renderer::rasterization_renderer::init() {
     rasterizer = std::make_shared<cg::renderer::rasterizer<vertex, unsigned_color>>(
         settings->width, settings->height, render_target, depth_buffer);
 
-    renderer::load_model();
     renderer::load_camera();
+    // A streamed model doesn't exist before `render`, which sets the shaders once the first shapes are in
+    if (!settings->stream_geometry) {
+        renderer::load_model();
+        set_shaders();
+    }
+}
 
-    float4x4 matrix =
-        linalg::mul(camera->get_projection_matrix(), camera->get_view_matrix(), model->get_world_matrix());
-    rasterizer->set_vertex_shader([matrix](float4 vertex, cg::vertex vertex_data) {
-        float4 transformed = mul(matrix, vertex);
+void renderer::rasterization_renderer::set_shaders() {
+    view_projection = linalg::mul(camera->get_projection_matrix(), camera->get_view_matrix());
+    rasterizer->set_vertex_shader([this](float4 vertex, cg::vertex vertex_data) {
+        float4 transformed = mul(object_to_clip, vertex);
         return std::make_pair(transformed, vertex_data);
     });
 
+    // Unlit: textured shapes show their texture, the others their ambient color
     rasterizer->set_pixel_shader(
-        [](const vertex& vertex_data, float /*z*/) { return color::from_float3(vertex_data.ambient); });
+        [this](const vertex& vertex_data, float /*z*/, const texcoord_derivatives& derivatives) {
+            if (bound_texture) {
+                float lod = bound_texture->get_lod(derivatives.dx, derivatives.dy);
+                return color::from_float3(bound_texture->sample(vertex_data.tex, lod));
+            }
+            return color::from_float3((*bound_materials)[vertex_data.material].ambient);
+        });
+    // Neither shader reads normals
+    vertex_attributes shader_inputs;
+    shader_inputs.normal = false;
+    rasterizer->set_shader_inputs(shader_inputs);
 }
 
 void cg::renderer::rasterization_renderer::render() {
@@ -42,15 +59,50 @@ void cg::renderer::rasterization_renderer::render() {
         rasterizer->clear_render_target(color);
     }
 
-    for (std::size_t shape_i = 0; shape_i < model->get_index_buffers().size(); ++shape_i) {
-        rasterizer->set_vertex_buffer(model->get_vertex_buffers()[shape_i]);
-        rasterizer->set_index_buffer(model->get_index_buffers()[shape_i]);
-        rasterizer->draw(model->get_index_buffers()[shape_i]->count(), 0);
+    if (settings->stream_geometry) {
+        // Each batch is drawn over the previous ones and saved as a preview; the depth test makes order irrelevant
+        auto first_preview = std::make_unique<utils::timer>("first preview");
+        renderer::stream_model([&](const std::vector<std::size_t>& shape_indices) {
+            if (first_preview)
+                set_shaders();
+            std::vector<bool> in_batch(model->get_index_buffers().size());
+            for (std::size_t shape_i : shape_indices)
+                in_batch[shape_i] = true;
+            for (const world::shape_instance& instance : scene->get_shape_instances(*model)) {
+                if (in_batch[instance.shape_index])
+                    draw_shape(instance, peek_texture(instance.shape_index));
+            }
+            first_preview.reset();
+            utils::save_resource(*render_target, settings->result_path);
+        });
+        // Drawn again in full, as previews skip textures that were still decoding
+        rasterizer->clear_render_target(color);
     }
+
+    for (const world::shape_instance& instance : scene->get_shape_instances(*model))
+        draw_shape(instance, shape_textures[instance.shape_index]);
+}
+
+void cg::renderer::rasterization_renderer::draw_shape(const world::shape_instance& instance,
+                                                      std::shared_ptr<const cg::world::texture> texture) {
+    std::size_t shape_i = instance.shape_index;
+    if (!model->get_packed_vertex_buffers().empty()) {
+        rasterizer->set_vertex_buffer(model->get_packed_vertex_buffers()[shape_i],
+                                      model->get_vertex_quantizations()[shape_i]);
+    } else if (!model->get_vertex_streams().empty())
+        rasterizer->set_vertex_buffer(model->get_vertex_streams()[shape_i]);
+    else
+        rasterizer->set_vertex_buffer(model->get_vertex_buffers()[shape_i]);
+    rasterizer->set_index_buffer(model->get_index_buffers()[shape_i]);
+    bound_texture = std::move(texture);
+    bound_materials = &model->get_materials();
+    object_to_clip = linalg::mul(view_projection, instance.transform);
+    rasterizer->draw(model->get_index_buffers()[shape_i]->count(), 0);
 }
 
 void cg::renderer::rasterization_renderer::destroy() {
     utils::save_resource(*render_target, settings->result_path);
+    print_texture_stats();
 }
 
 void cg::renderer::rasterization_renderer::update() {}
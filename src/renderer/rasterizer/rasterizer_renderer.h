@@ -2,7 +2,9 @@
 #include "renderer/renderer.h"
 #include "resource.h"
 
+#include <cstddef>
 #include <memory>
+#include <vector>
 
 namespace cg::renderer {
 class rasterization_renderer : public renderer {
@@ -20,6 +22,17 @@ class rasterization_renderer : public renderer {
     std::shared_ptr<cg::resource<cg::unsigned_color>> render_target;
     std::shared_ptr<cg::resource<float>> depth_buffer;
     std::shared_ptr<cg::renderer::rasterizer<cg::vertex, cg::unsigned_color>> rasterizer;
+    // Texture of the shape being drawn, read by the pixel shader
+    std::shared_ptr<const cg::world::texture> bound_texture;
+    // The model's material table, read by the pixel shader. It is bound with every draw rather than copied when
+    // the shaders are set, which for a streamed model happens with its first batch.
+    const std::vector<cg::material>* bound_materials = nullptr;
+    // Camera matrices, and their product with the transform of the instance being drawn for the vertex shader
+    float4x4 view_projection;
+    float4x4 object_to_clip;
     // NOLINTEND(*-non-private-*)
+
+    void set_shaders();
+    void draw_shape(const cg::world::shape_instance& instance, std::shared_ptr<const cg::world::texture> texture);
 };
 } // namespace cg::renderer
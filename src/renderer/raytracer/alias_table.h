@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace cg::renderer {
+
+// Walker's alias method (Vose's construction): draws an index proportionally to its weight in O(1)
+class alias_table {
+  public:
+    void build(const std::vector<float>& weights);
+
+    [[nodiscard]] std::size_t sample(float u) const;
+    [[nodiscard]] float get_pdf(std::size_t index) const;
+
+    [[nodiscard]] bool empty() const;
+    [[nodiscard]] std::size_t size() const;
+    [[nodiscard]] float get_total_weight() const;
+
+  protected:
+    // NOLINTBEGIN(*-non-private-*)
+    std::vector<float> probabilities;
+    std::vector<std::size_t> aliases;
+    std::vector<float> pdfs;
+    float total_weight = 0.F;
+    // NOLINTEND(*-non-private-*)
+};
+
+inline void alias_table::build(const std::vector<float>& weights) {
+    probabilities.clear();
+    aliases.clear();
+    pdfs.clear();
+    total_weight = 0.F;
+
+    for (float weight : weights)
+        total_weight += std::max(weight, 0.F);
+    if (total_weight <= 0.F)
+        return;
+
+    std::size_t count = weights.size();
+    probabilities.resize(count);
+    aliases.resize(count);
+    pdfs.resize(count);
+
+    std::vector<float> scaled(count);
+    std::vector<std::size_t> small;
+    std::vector<std::size_t> large;
+    for (std::size_t i = 0; i < count; ++i) {
+        pdfs[i] = std::max(weights[i], 0.F) / total_weight;
+        scaled[i] = pdfs[i] * static_cast<float>(count);
+        (scaled[i] < 1.F ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        std::size_t less = small.back();
+        small.pop_back();
+        std::size_t more = large.back();
+        large.pop_back();
+
+        probabilities[less] = scaled[less];
+        aliases[less] = more;
+
+        scaled[more] = (scaled[more] + scaled[less]) - 1.F;
+        (scaled[more] < 1.F ? small : large).push_back(more);
+    }
+    // Leftovers are 1 up to rounding error
+    for (std::size_t i : large) {
+        probabilities[i] = 1.F;
+        aliases[i] = i;
+    }
+    for (std::size_t i : small) {
+        probabilities[i] = 1.F;
+        aliases[i] = i;
+    }
+}
+
+// `u` is uniform in [0, 1): its integer part picks a column, the fraction decides between the column and its alias
+inline std::size_t alias_table::sample(float u) const {
+    float scaled = u * static_cast<float>(probabilities.size());
+    std::size_t column = std::min(static_cast<std::size_t>(scaled), probabilities.size() - 1);
+    float fraction = scaled - static_cast<float>(column);
+    return fraction < probabilities[column] ? column : aliases[column];
+}
+
+inline float alias_table::get_pdf(std::size_t index) const {
+    return pdfs[index];
+}
+
+inline bool alias_table::empty() const {
+    return probabilities.empty();
+}
+
+inline std::size_t alias_table::size() const {
+    return probabilities.size();
+}
+
+inline float alias_table::get_total_weight() const {
+    return total_weight;
+}
+
+} // namespace cg::renderer
@@ -0,0 +1,625 @@
+#pragma once
+
+#include "utils/binary_io.h"
+
+#include <linalg.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cg::renderer {
+
+using namespace linalg::aliases;
+
+struct bvh_node {
+    float3 bounds_min;
+    float3 bounds_max;
+    std::uint32_t offset; // first primitive of a leaf, or second child of an interior node (the first one follows it)
+    std::uint32_t count;  // number of primitives in a leaf, zero for interior nodes
+};
+
+// A primitive, or the part of it inside `bounds` once spatial splits clipped it
+struct bvh_reference {
+    float3 bounds_min;
+    float3 bounds_max;
+    std::uint32_t primitive;
+};
+
+// Bounds of the parts of a reference on either side of the plane at `position` along `axis`
+using bvh_split_function =
+    std::function<std::pair<bvh_reference, bvh_reference>(const bvh_reference& reference, int axis, float position)>;
+
+struct bvh_build_settings {
+    // Split bounds by planes and duplicate straddling references (SBVH) where object splits overlap badly
+    bool spatial_splits = false;
+    // Extra references spatial splits may add, as a fraction of the primitive count
+    float duplication_budget = 0.3F;
+    // Spatial splits are only tried where object split children overlap by more than this share of the root area
+    float overlap_threshold = 1e-5F;
+};
+
+struct bvh_build_stats {
+    std::size_t primitive_count = 0;
+    std::size_t reference_count = 0;
+    std::size_t node_count = 0;
+    std::size_t memory_bytes = 0;
+};
+
+inline float get_surface_area(const float3& bounds_min, const float3& bounds_max) {
+    float3 extent = linalg::max(bounds_max - bounds_min, float3{0.F, 0.F, 0.F});
+    return 2.F * ((extent.x * extent.y) + (extent.y * extent.z) + (extent.z * extent.x));
+}
+
+// Slab test; `t_near` is where the ray enters the box
+inline bool intersect_bounds(const float3& bounds_min,
+                             const float3& bounds_max,
+                             const float3& origin,
+                             const float3& inv_direction,
+                             float max_t,
+                             float& t_near) {
+    float3 t0 = (bounds_min - origin) * inv_direction;
+    float3 t1 = (bounds_max - origin) * inv_direction;
+    t_near = std::max(linalg::maxelem(linalg::min(t0, t1)), 0.F);
+    float t_far = std::min(linalg::minelem(linalg::max(t0, t1)), max_t);
+    return t_near <= t_far;
+}
+
+inline bool is_valid(const bvh_reference& reference) {
+    return reference.bounds_min.x <= reference.bounds_max.x && reference.bounds_min.y <= reference.bounds_max.y &&
+           reference.bounds_min.z <= reference.bounds_max.z;
+}
+
+// Conservative split that only cuts the reference box; primitives with exact clipping provide their own
+inline std::pair<bvh_reference, bvh_reference> split_bounds(const bvh_reference& reference, int axis, float position) {
+    std::pair<bvh_reference, bvh_reference> halves{reference, reference};
+    halves.first.bounds_max[axis] = std::min(reference.bounds_max[axis], position);
+    halves.second.bounds_min[axis] = std::max(reference.bounds_min[axis], position);
+    return halves;
+}
+
+// Bounding volume hierarchy over abstract primitives, built with binned SAH and optional spatial splits. Nodes are
+// stored depth-first; with spatial splits a primitive may be referenced from several leaves.
+class bvh {
+  public:
+    static constexpr std::uint32_t kMaxLeafSize = 4;
+    static constexpr std::size_t kMaxDepth = 64;
+
+    void build(const std::vector<float3>& primitive_min,
+               const std::vector<float3>& primitive_max,
+               const bvh_build_settings& settings = {},
+               const bvh_split_function& split = nullptr);
+    // Recomputes node bounds bottom-up for primitives that moved while keeping the topology. Each level runs in
+    // parallel once the one below it is done, so it must be called outside other parallel regions.
+    void refit(const std::vector<float3>& primitive_min, const std::vector<float3>& primitive_max);
+
+    [[nodiscard]] bool empty() const;
+    [[nodiscard]] float3 get_bounds_min() const;
+    [[nodiscard]] float3 get_bounds_max() const;
+    [[nodiscard]] const std::vector<bvh_node>& get_nodes() const;
+    [[nodiscard]] const std::vector<std::uint32_t>& get_primitive_indices() const;
+    // SAH cost relative to the root area; refits make it grow as boxes loosen
+    [[nodiscard]] float get_sah_cost() const;
+    // As it was when built or loaded
+    [[nodiscard]] float get_build_sah_cost() const;
+    [[nodiscard]] bvh_build_stats get_stats() const;
+
+    void save(cg::utils::binary_writer& writer) const;
+    void load(cg::utils::binary_reader& reader);
+
+    // Visits primitives whose leaves the ray reaches before `max_t`, nearest child first. `intersect(primitive,
+    // max_t)` may shrink `max_t` after a hit and returns true to stop the traversal; so does `traverse`.
+    template <typename Intersect>
+    bool traverse(const float3& origin, const float3& inv_direction, float& max_t, Intersect&& intersect) const;
+
+  protected:
+    // NOLINTBEGIN(*-non-private-*)
+    std::vector<bvh_node> nodes;
+    std::vector<std::uint32_t> primitive_indices;
+    std::vector<std::vector<std::uint32_t>> node_levels; // nodes by depth, for level-parallel refits
+    float build_sah_cost = 0.F;
+    std::size_t primitive_count = 0;
+    // NOLINTEND(*-non-private-*)
+
+    static constexpr std::size_t kBinCount = 16;
+
+    struct build_context {
+        bvh_build_settings settings;
+        bvh_split_function split;
+        std::size_t reference_count;
+        std::size_t max_reference_count;
+        float root_area;
+    };
+
+    struct split_candidate {
+        float cost = std::numeric_limits<float>::max();
+        int axis = -1;
+        std::size_t bin = 0;
+        float position = 0.F; // spatial splits only
+        float3 left_min;
+        float3 left_max;
+        float3 right_min;
+        float3 right_max;
+    };
+
+    std::uint32_t build_recursive(build_context& context, std::vector<bvh_reference> references, std::size_t depth);
+    void collect_node_levels();
+    static split_candidate find_object_split(const std::vector<bvh_reference>& references,
+                                             const float3& centroid_min,
+                                             const float3& centroid_max);
+    static split_candidate find_spatial_split(const build_context& context,
+                                              const std::vector<bvh_reference>& references,
+                                              const float3& bounds_min,
+                                              const float3& bounds_max);
+};
+
+inline void bvh::build(const std::vector<float3>& primitive_min,
+                       const std::vector<float3>& primitive_max,
+                       const bvh_build_settings& settings,
+                       const bvh_split_function& split) {
+    nodes.clear();
+    primitive_indices.clear();
+    node_levels.clear();
+    build_sah_cost = 0.F;
+    primitive_count = primitive_min.size();
+    if (primitive_min.empty())
+        return;
+
+    std::vector<bvh_reference> references(primitive_min.size());
+    float3 bounds_min = primitive_min.front();
+    float3 bounds_max = primitive_max.front();
+    for (std::size_t i = 0; i < primitive_min.size(); ++i) {
+        references[i] = {primitive_min[i], primitive_max[i], static_cast<std::uint32_t>(i)};
+        bounds_min = linalg::min(bounds_min, primitive_min[i]);
+        bounds_max = linalg::max(bounds_max, primitive_max[i]);
+    }
+
+    build_context context;
+    context.settings = settings;
+    context.split = split ? split : bvh_split_function{split_bounds};
+    context.reference_count = primitive_count;
+    context.max_reference_count = primitive_count;
+    if (settings.spatial_splits) {
+        context.max_reference_count +=
+            static_cast<std::size_t>(static_cast<float>(primitive_count) * settings.duplication_budget);
+    }
+    context.root_area = get_surface_area(bounds_min, bounds_max);
+    nodes.reserve((2 * primitive_count) - 1);
+    primitive_indices.reserve(primitive_count);
+    build_recursive(context, std::move(references), 0);
+    collect_node_levels();
+    build_sah_cost = get_sah_cost();
+}
+
+inline void bvh::refit(const std::vector<float3>& primitive_min, const std::vector<float3>& primitive_max) {
+    static constexpr std::size_t kParallelLevelSize = 256;
+
+    // Deeper levels first, so both children are final before their parent
+    for (auto level = node_levels.rbegin(); level != node_levels.rend(); ++level) {
+        auto level_size = static_cast<int>(level->size());
+#pragma omp parallel for if (level->size() >= kParallelLevelSize)
+        for (int i = 0; i < level_size; ++i) {
+            std::uint32_t node_index = (*level)[i];
+            bvh_node& node = nodes[node_index];
+            if (node.count > 0) {
+                node.bounds_min = primitive_min[primitive_indices[node.offset]];
+                node.bounds_max = primitive_max[primitive_indices[node.offset]];
+                for (std::uint32_t primitive_i = node.offset + 1; primitive_i < node.offset + node.count;
+                     ++primitive_i) {
+                    node.bounds_min = linalg::min(node.bounds_min, primitive_min[primitive_indices[primitive_i]]);
+                    node.bounds_max = linalg::max(node.bounds_max, primitive_max[primitive_indices[primitive_i]]);
+                }
+            } else {
+                const bvh_node& first = nodes[node_index + 1];
+                const bvh_node& second = nodes[node.offset];
+                node.bounds_min = linalg::min(first.bounds_min, second.bounds_min);
+                node.bounds_max = linalg::max(first.bounds_max, second.bounds_max);
+            }
+        }
+    }
+}
+
+inline std::uint32_t
+bvh::build_recursive(build_context& context, std::vector<bvh_reference> references, std::size_t depth) {
+    auto node_index = static_cast<std::uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    float3 bounds_min = references.front().bounds_min;
+    float3 bounds_max = references.front().bounds_max;
+    float3 centroid_min = (bounds_min + bounds_max) * 0.5F;
+    float3 centroid_max = centroid_min;
+    for (const bvh_reference& reference : references) {
+        float3 centroid = (reference.bounds_min + reference.bounds_max) * 0.5F;
+        bounds_min = linalg::min(bounds_min, reference.bounds_min);
+        bounds_max = linalg::max(bounds_max, reference.bounds_max);
+        centroid_min = linalg::min(centroid_min, centroid);
+        centroid_max = linalg::max(centroid_max, centroid);
+    }
+    nodes[node_index].bounds_min = bounds_min;
+    nodes[node_index].bounds_max = bounds_max;
+
+    auto count = static_cast<std::uint32_t>(references.size());
+    auto make_leaf = [&]() {
+        nodes[node_index].offset = static_cast<std::uint32_t>(primitive_indices.size());
+        nodes[node_index].count = count;
+        for (const bvh_reference& reference : references)
+            primitive_indices.push_back(reference.primitive);
+        return node_index;
+    };
+    if (count == 1 || depth + 1 >= kMaxDepth)
+        return make_leaf();
+
+    split_candidate object = find_object_split(references, centroid_min, centroid_max);
+    split_candidate spatial{};
+    if (context.settings.spatial_splits && context.reference_count < context.max_reference_count) {
+        float3 overlap_min = linalg::max(object.left_min, object.right_min);
+        float3 overlap_max = linalg::min(object.left_max, object.right_max);
+        bool overlaps = object.axis < 0 || (overlap_min.x < overlap_max.x && overlap_min.y < overlap_max.y &&
+                                            overlap_min.z < overlap_max.z);
+        float overlap_area = object.axis < 0 ? context.root_area : get_surface_area(overlap_min, overlap_max);
+        if (overlaps && overlap_area > context.settings.overlap_threshold * context.root_area)
+            spatial = find_spatial_split(context, references, bounds_min, bounds_max);
+    }
+
+    float best_cost = std::min(object.cost, spatial.cost);
+    float leaf_cost = get_surface_area(bounds_min, bounds_max) * static_cast<float>(count);
+    if (count <= kMaxLeafSize && best_cost >= leaf_cost)
+        return make_leaf();
+
+    std::vector<bvh_reference> left;
+    std::vector<bvh_reference> right;
+    if (spatial.cost < object.cost) {
+        int axis = spatial.axis;
+        for (const bvh_reference& reference : references) {
+            if (reference.bounds_max[axis] <= spatial.position) {
+                left.push_back(reference);
+            } else if (reference.bounds_min[axis] >= spatial.position) {
+                right.push_back(reference);
+            } else {
+                // Clipping may find the primitive entirely on one side of the plane inside this reference
+                auto [left_part, right_part] = context.split(reference, axis, spatial.position);
+                if (is_valid(left_part))
+                    left.push_back(left_part);
+                if (is_valid(right_part))
+                    right.push_back(right_part);
+            }
+        }
+    }
+
+    // Spatial splits over the duplication budget fall back to the object split
+    std::size_t duplicates = left.size() + right.size() - std::min(left.size() + right.size(), references.size());
+    if (!left.empty() && !right.empty() && context.reference_count + duplicates <= context.max_reference_count) {
+        context.reference_count += duplicates;
+    } else {
+        left.clear();
+        right.clear();
+        if (object.axis >= 0) {
+            float scale = static_cast<float>(kBinCount) / (centroid_max[object.axis] - centroid_min[object.axis]);
+            for (const bvh_reference& reference : references) {
+                float centroid = (reference.bounds_min[object.axis] + reference.bounds_max[object.axis]) * 0.5F;
+                auto bin = std::min(static_cast<std::size_t>((centroid - centroid_min[object.axis]) * scale),
+                                    kBinCount - 1);
+                (bin <= object.bin ? left : right).push_back(reference);
+            }
+        }
+        if (left.empty() || right.empty()) {
+            left.assign(references.begin(), references.begin() + (count / 2));
+            right.assign(references.begin() + (count / 2), references.end());
+        }
+    }
+    references.clear();
+    references.shrink_to_fit();
+
+    build_recursive(context, std::move(left), depth + 1);
+    std::uint32_t second_child = build_recursive(context, std::move(right), depth + 1);
+    nodes[node_index].offset = second_child;
+    nodes[node_index].count = 0;
+    return node_index;
+}
+
+// Cheapest centroid bin boundary over all three axes
+inline bvh::split_candidate bvh::find_object_split(const std::vector<bvh_reference>& references,
+                                                   const float3& centroid_min,
+                                                   const float3& centroid_max) {
+    split_candidate best{};
+    float3 centroid_extent = centroid_max - centroid_min;
+    auto count = static_cast<std::uint32_t>(references.size());
+    for (int axis = 0; axis < 3; ++axis) {
+        if (centroid_extent[axis] <= 0.F)
+            continue;
+
+        std::array<float3, kBinCount> bin_min{};
+        std::array<float3, kBinCount> bin_max{};
+        std::array<std::uint32_t, kBinCount> bin_count{};
+        float scale = static_cast<float>(kBinCount) / centroid_extent[axis];
+        for (const bvh_reference& reference : references) {
+            float centroid = (reference.bounds_min[axis] + reference.bounds_max[axis]) * 0.5F;
+            auto bin = std::min(static_cast<std::size_t>((centroid - centroid_min[axis]) * scale), kBinCount - 1);
+            bin_min[bin] = bin_count[bin] == 0 ? reference.bounds_min : linalg::min(bin_min[bin], reference.bounds_min);
+            bin_max[bin] = bin_count[bin] == 0 ? reference.bounds_max : linalg::max(bin_max[bin], reference.bounds_max);
+            ++bin_count[bin];
+        }
+
+        // Sweep from the right to get every right-hand side, then from the left
+        std::array<float3, kBinCount> right_min{};
+        std::array<float3, kBinCount> right_max{};
+        std::array<std::uint32_t, kBinCount> right_count{};
+        float3 sweep_min{};
+        float3 sweep_max{};
+        std::uint32_t sweep_count = 0;
+        for (std::size_t bin = kBinCount - 1; bin > 0; --bin) {
+            if (bin_count[bin] > 0) {
+                sweep_min = sweep_count == 0 ? bin_min[bin] : linalg::min(sweep_min, bin_min[bin]);
+                sweep_max = sweep_count == 0 ? bin_max[bin] : linalg::max(sweep_max, bin_max[bin]);
+            }
+            sweep_count += bin_count[bin];
+            right_min[bin - 1] = sweep_min;
+            right_max[bin - 1] = sweep_max;
+            right_count[bin - 1] = sweep_count;
+        }
+
+        sweep_count = 0;
+        for (std::size_t split = 0; split + 1 < kBinCount; ++split) {
+            if (bin_count[split] > 0) {
+                sweep_min = sweep_count == 0 ? bin_min[split] : linalg::min(sweep_min, bin_min[split]);
+                sweep_max = sweep_count == 0 ? bin_max[split] : linalg::max(sweep_max, bin_max[split]);
+            }
+            sweep_count += bin_count[split];
+            if (sweep_count == 0 || sweep_count == count)
+                continue;
+
+            float cost = (get_surface_area(sweep_min, sweep_max) * static_cast<float>(sweep_count)) +
+                         (get_surface_area(right_min[split], right_max[split]) *
+                          static_cast<float>(right_count[split]));
+            if (cost < best.cost)
+                best = {cost, axis, split, 0.F, sweep_min, sweep_max, right_min[split], right_max[split]};
+        }
+    }
+    return best;
+}
+
+// Chops every reference into the spatial bins it spans; left sides count references entering a bin and right
+// sides the ones leaving it, so straddling references are charged to both children
+inline bvh::split_candidate bvh::find_spatial_split(const build_context& context,
+                                                    const std::vector<bvh_reference>& references,
+                                                    const float3& bounds_min,
+                                                    const float3& bounds_max) {
+    split_candidate best{};
+    float3 extent = bounds_max - bounds_min;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.F)
+            continue;
+
+        std::array<float3, kBinCount> bin_min{};
+        std::array<float3, kBinCount> bin_max{};
+        std::array<bool, kBinCount> bin_used{};
+        std::array<std::uint32_t, kBinCount> entries{};
+        std::array<std::uint32_t, kBinCount> exits{};
+        float bin_width = extent[axis] / static_cast<float>(kBinCount);
+        auto get_bin = [&](float position) {
+            return std::min(static_cast<std::size_t>(std::max(position - bounds_min[axis], 0.F) / bin_width),
+                            kBinCount - 1);
+        };
+        auto extend_bin = [&](std::size_t bin, const bvh_reference& part) {
+            if (!is_valid(part))
+                return;
+            bin_min[bin] = bin_used[bin] ? linalg::min(bin_min[bin], part.bounds_min) : part.bounds_min;
+            bin_max[bin] = bin_used[bin] ? linalg::max(bin_max[bin], part.bounds_max) : part.bounds_max;
+            bin_used[bin] = true;
+        };
+
+        for (const bvh_reference& reference : references) {
+            std::size_t first = get_bin(reference.bounds_min[axis]);
+            std::size_t last = get_bin(reference.bounds_max[axis]);
+            bvh_reference rest = reference;
+            for (std::size_t bin = first; bin < last; ++bin) {
+                auto [part, remainder] =
+                    context.split(rest, axis, bounds_min[axis] + (bin_width * static_cast<float>(bin + 1)));
+                extend_bin(bin, part);
+                rest = remainder;
+            }
+            extend_bin(last, rest);
+            ++entries[first];
+            ++exits[last];
+        }
+
+        std::array<float3, kBinCount> right_min{};
+        std::array<float3, kBinCount> right_max{};
+        std::array<std::uint32_t, kBinCount> right_count{};
+        float3 sweep_min{};
+        float3 sweep_max{};
+        bool has_bounds = false;
+        std::uint32_t sweep_count = 0;
+        for (std::size_t bin = kBinCount - 1; bin > 0; --bin) {
+            if (bin_used[bin]) {
+                sweep_min = has_bounds ? linalg::min(sweep_min, bin_min[bin]) : bin_min[bin];
+                sweep_max = has_bounds ? linalg::max(sweep_max, bin_max[bin]) : bin_max[bin];
+                has_bounds = true;
+            }
+            sweep_count += exits[bin];
+            right_min[bin - 1] = sweep_min;
+            right_max[bin - 1] = sweep_max;
+            right_count[bin - 1] = sweep_count;
+        }
+
+        has_bounds = false;
+        sweep_count = 0;
+        for (std::size_t split = 0; split + 1 < kBinCount; ++split) {
+            if (bin_used[split]) {
+                sweep_min = has_bounds ? linalg::min(sweep_min, bin_min[split]) : bin_min[split];
+                sweep_max = has_bounds ? linalg::max(sweep_max, bin_max[split]) : bin_max[split];
+                has_bounds = true;
+            }
+            sweep_count += entries[split];
+            if (sweep_count == 0 || right_count[split] == 0)
+                continue;
+
+            float cost = (get_surface_area(sweep_min, sweep_max) * static_cast<float>(sweep_count)) +
+                         (get_surface_area(right_min[split], right_max[split]) *
+                          static_cast<float>(right_count[split]));
+            if (cost < best.cost) {
+                best = {cost,
+                        axis,
+                        split,
+                        bounds_min[axis] + (bin_width * static_cast<float>(split + 1)),
+                        sweep_min,
+                        sweep_max,
+                        right_min[split],
+                        right_max[split]};
+            }
+        }
+    }
+    return best;
+}
+
+inline void bvh::save(cg::utils::binary_writer& writer) const {
+    writer.write(static_cast<std::uint64_t>(primitive_count));
+    writer.write_array(nodes);
+    writer.write_array(primitive_indices);
+}
+
+inline void bvh::load(cg::utils::binary_reader& reader) {
+    primitive_count = static_cast<std::size_t>(reader.read<std::uint64_t>());
+    reader.read_array(nodes);
+    reader.read_array(primitive_indices);
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        const bvh_node& node = nodes[i];
+        bool is_valid = node.count > 0 ? std::size_t{node.offset} + node.count <= primitive_indices.size()
+                                       : node.offset > i && node.offset < nodes.size();
+        if (!is_valid)
+            THROW_ERROR("Corrupted BVH node");
+    }
+    for (std::uint32_t primitive : primitive_indices) {
+        if (primitive >= primitive_count)
+            THROW_ERROR("Corrupted BVH primitive index");
+    }
+
+    // Traversal keeps one pending node per level on a fixed stack
+    collect_node_levels();
+    if (node_levels.size() > kMaxDepth)
+        THROW_ERROR("BVH is deeper than " + std::to_string(kMaxDepth) + " levels");
+    build_sah_cost = get_sah_cost();
+}
+
+// Children follow their parents, so one pass in storage order finds every node's deepest level
+inline void bvh::collect_node_levels() {
+    node_levels.clear();
+    std::vector<std::size_t> depths(nodes.size());
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        if (node_levels.size() <= depths[i])
+            node_levels.resize(depths[i] + 1);
+        node_levels[depths[i]].push_back(static_cast<std::uint32_t>(i));
+
+        const bvh_node& node = nodes[i];
+        if (node.count > 0)
+            continue;
+        depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+        depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+    }
+}
+
+inline bool bvh::empty() const {
+    return nodes.empty();
+}
+
+inline float3 bvh::get_bounds_min() const {
+    return nodes.front().bounds_min;
+}
+
+inline float3 bvh::get_bounds_max() const {
+    return nodes.front().bounds_max;
+}
+
+inline const std::vector<bvh_node>& bvh::get_nodes() const {
+    return nodes;
+}
+
+inline const std::vector<std::uint32_t>& bvh::get_primitive_indices() const {
+    return primitive_indices;
+}
+
+// Unit traversal and intersection costs: interior nodes weigh their area, leaves their area times primitive count
+inline float bvh::get_sah_cost() const {
+    if (nodes.empty())
+        return 0.F;
+
+    float root_area = get_surface_area(nodes[0].bounds_min, nodes[0].bounds_max);
+    if (root_area <= 0.F)
+        return 0.F;
+
+    float cost = 0.F;
+    for (const bvh_node& node : nodes) {
+        float area = get_surface_area(node.bounds_min, node.bounds_max);
+        cost += node.count == 0 ? area : area * static_cast<float>(node.count);
+    }
+    return cost / root_area;
+}
+
+inline float bvh::get_build_sah_cost() const {
+    return build_sah_cost;
+}
+
+inline bvh_build_stats bvh::get_stats() const {
+    bvh_build_stats stats;
+    stats.primitive_count = primitive_count;
+    stats.reference_count = primitive_indices.size();
+    stats.node_count = nodes.size();
+    stats.memory_bytes = (nodes.size() * sizeof(bvh_node)) + (primitive_indices.size() * sizeof(std::uint32_t));
+    return stats;
+}
+
+template <typename Intersect>
+inline bool
+bvh::traverse(const float3& origin, const float3& inv_direction, float& max_t, Intersect&& intersect) const {
+    if (nodes.empty())
+        return false;
+
+    float t_near = 0.F;
+    if (!intersect_bounds(nodes[0].bounds_min, nodes[0].bounds_max, origin, inv_direction, max_t, t_near))
+        return false;
+
+    std::array<std::uint32_t, kMaxDepth> stack{};
+    std::size_t stack_size = 0;
+    std::uint32_t node_index = 0;
+    while (true) {
+        const bvh_node& node = nodes[node_index];
+        if (node.count > 0) {
+            for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                if (intersect(primitive_indices[i], max_t))
+                    return true;
+            }
+        } else {
+            std::uint32_t first = node_index + 1;
+            std::uint32_t second = node.offset;
+            float t_first = 0.F;
+            float t_second = 0.F;
+            bool hit_first = intersect_bounds(
+                nodes[first].bounds_min, nodes[first].bounds_max, origin, inv_direction, max_t, t_first);
+            bool hit_second = intersect_bounds(
+                nodes[second].bounds_min, nodes[second].bounds_max, origin, inv_direction, max_t, t_second);
+            if (hit_first && hit_second) {
+                if (t_second < t_first)
+                    std::swap(first, second);
+                stack[stack_size++] = second;
+                node_index = first;
+                continue;
+            }
+            if (hit_first || hit_second) {
+                node_index = hit_first ? first : second;
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            return false;
+        node_index = stack[--stack_size];
+    }
+}
+
+} // namespace cg::renderer
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <linalg.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace cg::renderer {
+
+using namespace linalg::aliases;
+
+// Spatial and directional bounds of one or more emitters (Conty Estevez & Kulla, "Importance Sampling of Many Lights")
+struct light_bounds {
+    float3 bounds_min;
+    float3 bounds_max;
+    float3 axis;       // central direction of the emission
+    float cos_theta_o; // spread of `axis` over the bounded emitters
+    float cos_theta_e; // emission falloff past the normal cone; cos(pi / 2) for diffuse emitters
+    float power;
+    bool two_sided;
+
+    [[nodiscard]] float3 get_centroid() const;
+    [[nodiscard]] float importance(const float3& position, const float3& normal) const;
+
+    static light_bounds merge(const light_bounds& a, const light_bounds& b);
+};
+
+struct light_choice {
+    std::size_t index;
+    float pmf; // zero when no light can contribute
+};
+
+class light_bvh {
+  public:
+    void build(const std::vector<light_bounds>& lights);
+
+    [[nodiscard]] bool empty() const;
+    [[nodiscard]] std::size_t get_node_count() const;
+
+    // Descends the tree picking children proportionally to their importance for the shading point
+    [[nodiscard]] light_choice sample(const float3& position, const float3& normal, float u) const;
+
+  protected:
+    struct node {
+        light_bounds bounds;
+        std::size_t second_child; // first child directly follows its parent
+        std::size_t light_index;
+        bool is_leaf;
+    };
+
+    // NOLINTBEGIN(*-non-private-*)
+    std::vector<node> nodes;
+    // NOLINTEND(*-non-private-*)
+
+    std::size_t build_recursive(const std::vector<light_bounds>& lights,
+                                std::vector<std::size_t>& indices,
+                                std::size_t begin,
+                                std::size_t end);
+    static float evaluate_cost(const light_bounds& bounds, const float3& extent, int axis);
+};
+
+namespace detail {
+static constexpr float kPi = 3.14159265358979323846F;
+
+inline float safe_sqrt(float value) {
+    return std::sqrt(std::max(0.F, value));
+}
+
+inline float safe_acos(float value) {
+    return std::acos(std::clamp(value, -1.F, 1.F));
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from cosines and sines of `a` and `b`
+inline float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+    if (cos_a > cos_b)
+        return 1.F;
+    return (cos_a * cos_b) + (sin_a * sin_b);
+}
+
+inline float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+    if (cos_a > cos_b)
+        return 0.F;
+    return (sin_a * cos_b) - (cos_a * sin_b);
+}
+
+inline float3 rotate(const float3& v, const float3& axis, float angle) {
+    float3 k = linalg::normalize(axis);
+    float cos_angle = std::cos(angle);
+    float sin_angle = std::sin(angle);
+    return (v * cos_angle) + (linalg::cross(k, v) * sin_angle) + (k * (linalg::dot(k, v) * (1.F - cos_angle)));
+}
+
+inline float surface_area(const float3& extent) {
+    return 2.F * ((extent.x * extent.y) + (extent.y * extent.z) + (extent.z * extent.x));
+}
+} // namespace detail
+
+inline float3 light_bounds::get_centroid() const {
+    return (bounds_min + bounds_max) * 0.5F;
+}
+
+inline float light_bounds::importance(const float3& position, const float3& normal) const {
+    if (power <= 0.F)
+        return 0.F;
+
+    float3 centroid = get_centroid();
+    float3 from_centroid = position - centroid;
+    float distance2 = linalg::length2(from_centroid);
+    float radius2 = linalg::length2(bounds_max - bounds_min) / 4.F;
+    // Clamp the distance so points close to or inside the bounds do not blow up
+    distance2 = std::max(distance2, linalg::length(bounds_max - bounds_min) / 2.F);
+    if (distance2 <= 0.F)
+        return power;
+
+    float3 direction = from_centroid / std::sqrt(linalg::length2(from_centroid) + std::numeric_limits<float>::min());
+    float cos_theta_w = linalg::dot(axis, direction);
+    if (two_sided)
+        cos_theta_w = std::abs(cos_theta_w);
+    float sin_theta_w = detail::safe_sqrt(1.F - (cos_theta_w * cos_theta_w));
+
+    // Cone of directions from `position` subtended by the bounding sphere
+    float centroid_distance2 = linalg::length2(from_centroid);
+    float cos_theta_b = centroid_distance2 < radius2 ? -1.F : detail::safe_sqrt(1.F - (radius2 / centroid_distance2));
+    float sin_theta_b = detail::safe_sqrt(1.F - (cos_theta_b * cos_theta_b));
+
+    float sin_theta_o = detail::safe_sqrt(1.F - (cos_theta_o * cos_theta_o));
+    float cos_theta_x = detail::cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    float sin_theta_x = detail::sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    float cos_theta_p = detail::cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_p <= cos_theta_e)
+        return 0.F;
+
+    float result = power * cos_theta_p / distance2;
+    if (linalg::length2(normal) > 0.F) {
+        float cos_theta_i = -linalg::dot(direction, normal);
+        float sin_theta_i = detail::safe_sqrt(1.F - (cos_theta_i * cos_theta_i));
+        result *= detail::cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+    return std::max(result, 0.F);
+}
+
+inline light_bounds light_bounds::merge(const light_bounds& a, const light_bounds& b) {
+    if (a.power <= 0.F)
+        return b;
+    if (b.power <= 0.F)
+        return a;
+
+    light_bounds result{};
+    result.bounds_min = linalg::min(a.bounds_min, b.bounds_min);
+    result.bounds_max = linalg::max(a.bounds_max, b.bounds_max);
+    result.power = a.power + b.power;
+    result.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    result.two_sided = a.two_sided || b.two_sided;
+
+    // Union of the two normal cones
+    float theta_a = detail::safe_acos(a.cos_theta_o);
+    float theta_b = detail::safe_acos(b.cos_theta_o);
+    float theta_d = detail::safe_acos(linalg::dot(a.axis, b.axis));
+    if (std::min(theta_d + theta_b, detail::kPi) <= theta_a) {
+        result.axis = a.axis;
+        result.cos_theta_o = a.cos_theta_o;
+        return result;
+    }
+    if (std::min(theta_d + theta_a, detail::kPi) <= theta_b) {
+        result.axis = b.axis;
+        result.cos_theta_o = b.cos_theta_o;
+        return result;
+    }
+
+    float theta_o = (theta_a + theta_d + theta_b) / 2.F;
+    float3 rotation_axis = linalg::cross(a.axis, b.axis);
+    if (theta_o >= detail::kPi || linalg::length2(rotation_axis) == 0.F) {
+        result.axis = a.axis;
+        result.cos_theta_o = -1.F;
+        return result;
+    }
+    result.axis = linalg::normalize(detail::rotate(a.axis, rotation_axis, theta_o - theta_a));
+    result.cos_theta_o = std::cos(theta_o);
+    return result;
+}
+
+inline void light_bvh::build(const std::vector<light_bounds>& lights) {
+    nodes.clear();
+
+    std::vector<std::size_t> indices;
+    indices.reserve(lights.size());
+    for (std::size_t i = 0; i < lights.size(); ++i) {
+        if (lights[i].power > 0.F)
+            indices.push_back(i);
+    }
+    if (indices.empty())
+        return;
+
+    nodes.reserve((2 * indices.size()) - 1);
+    build_recursive(lights, indices, 0, indices.size());
+}
+
+inline bool light_bvh::empty() const {
+    return nodes.empty();
+}
+
+inline std::size_t light_bvh::get_node_count() const {
+    return nodes.size();
+}
+
+inline float light_bvh::evaluate_cost(const light_bounds& bounds, const float3& extent, int axis) {
+    // Surface area orientation heuristic
+    float theta_o = detail::safe_acos(bounds.cos_theta_o);
+    float theta_e = detail::safe_acos(bounds.cos_theta_e);
+    float theta_w = std::min(theta_o + theta_e, detail::kPi);
+    float sin_theta_o = detail::safe_sqrt(1.F - (bounds.cos_theta_o * bounds.cos_theta_o));
+    float m_omega = (2.F * detail::kPi * (1.F - bounds.cos_theta_o)) +
+                    (detail::kPi / 2.F *
+                     ((2.F * theta_w * sin_theta_o) - std::cos(theta_o - (2.F * theta_w)) -
+                      (2.F * theta_o * sin_theta_o) + bounds.cos_theta_o));
+    float regularization = extent[axis] > 0.F ? linalg::maxelem(extent) / extent[axis] : 1.F;
+    return bounds.power * m_omega * regularization *
+           detail::surface_area(bounds.bounds_max - bounds.bounds_min);
+}
+
+inline std::size_t light_bvh::build_recursive(const std::vector<light_bounds>& lights,
+                                              std::vector<std::size_t>& indices,
+                                              std::size_t begin,
+                                              std::size_t end) {
+    static constexpr std::size_t kBucketCount = 12;
+
+    std::size_t node_index = nodes.size();
+    nodes.emplace_back();
+
+    light_bounds bounds = lights[indices[begin]];
+    float3 centroid_min = bounds.get_centroid();
+    float3 centroid_max = centroid_min;
+    for (std::size_t i = begin + 1; i < end; ++i) {
+        const light_bounds& light = lights[indices[i]];
+        bounds = light_bounds::merge(bounds, light);
+        centroid_min = linalg::min(centroid_min, light.get_centroid());
+        centroid_max = linalg::max(centroid_max, light.get_centroid());
+    }
+    nodes[node_index].bounds = bounds;
+
+    if (end - begin == 1) {
+        nodes[node_index].is_leaf = true;
+        nodes[node_index].light_index = indices[begin];
+        return node_index;
+    }
+
+    float3 extent = bounds.bounds_max - bounds.bounds_min;
+    float3 centroid_extent = centroid_max - centroid_min;
+
+    float best_cost = std::numeric_limits<float>::max();
+    int best_axis = -1;
+    std::size_t best_bucket = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (centroid_extent[axis] <= 0.F)
+            continue;
+
+        std::array<light_bounds, kBucketCount> buckets{};
+        for (std::size_t i = begin; i < end; ++i) {
+            const light_bounds& light = lights[indices[i]];
+            float offset = (light.get_centroid()[axis] - centroid_min[axis]) / centroid_extent[axis];
+            light_bounds& bucket = buckets[std::min(static_cast<std::size_t>(offset * kBucketCount), kBucketCount - 1)];
+            bucket = light_bounds::merge(bucket, light);
+        }
+
+        for (std::size_t split = 0; split + 1 < kBucketCount; ++split) {
+            light_bounds below{};
+            light_bounds above{};
+            for (std::size_t i = 0; i <= split; ++i)
+                below = light_bounds::merge(below, buckets[i]);
+            for (std::size_t i = split + 1; i < kBucketCount; ++i)
+                above = light_bounds::merge(above, buckets[i]);
+            if (below.power <= 0.F || above.power <= 0.F)
+                continue;
+
+            float cost = evaluate_cost(below, extent, axis) + evaluate_cost(above, extent, axis);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bucket = split;
+            }
+        }
+
+    }
+
+    std::size_t middle = begin + ((end - begin) / 2);
+    if (best_axis >= 0) {
+        auto bucket_of = [&](std::size_t i) {
+            float offset =
+                (lights[i].get_centroid()[best_axis] - centroid_min[best_axis]) / centroid_extent[best_axis];
+            return std::min(static_cast<std::size_t>(offset * kBucketCount), kBucketCount - 1);
+        };
+        auto split = std::partition(indices.begin() + static_cast<std::ptrdiff_t>(begin),
+                                    indices.begin() + static_cast<std::ptrdiff_t>(end),
+                                    [&](std::size_t i) { return bucket_of(i) <= best_bucket; });
+        middle = static_cast<std::size_t>(split - indices.begin());
+    }
+    if (middle == begin || middle == end)
+        middle = begin + ((end - begin) / 2);
+
+    build_recursive(lights, indices, begin, middle);
+    std::size_t second_child = build_recursive(lights, indices, middle, end);
+    nodes[node_index].second_child = second_child;
+    nodes[node_index].is_leaf = false;
+    return node_index;
+}
+
+inline light_choice light_bvh::sample(const float3& position, const float3& normal, float u) const {
+    static constexpr float kOneMinusEpsilon = 0x1.fffffep-1F;
+    if (nodes.empty())
+        return {0, 0.F};
+
+    std::size_t node_index = 0;
+    float pmf = 1.F;
+    while (true) {
+        const node& current = nodes[node_index];
+        if (current.is_leaf) {
+            if (current.bounds.importance(position, normal) <= 0.F)
+                return {0, 0.F};
+            return {current.light_index, pmf};
+        }
+
+        std::size_t first_child = node_index + 1;
+        float first_importance = nodes[first_child].bounds.importance(position, normal);
+        float second_importance = nodes[current.second_child].bounds.importance(position, normal);
+        if (first_importance <= 0.F && second_importance <= 0.F)
+            return {0, 0.F};
+
+        float first_probability = first_importance / (first_importance + second_importance);
+        if (u < first_probability) {
+            node_index = first_child;
+            pmf *= first_probability;
+            u = std::min(u / first_probability, kOneMinusEpsilon);
+        } else {
+            node_index = current.second_child;
+            pmf *= 1.F - first_probability;
+            u = std::min((u - first_probability) / (1.F - first_probability), kOneMinusEpsilon);
+        }
+    }
+}
+
+} // namespace cg::renderer
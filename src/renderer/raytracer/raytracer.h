@@ -1,22 +1,53 @@
 #pragma once
 
+#include "renderer/raytracer/alias_table.h"
+#include "renderer/raytracer/bvh.h"
+#include "renderer/raytracer/light_bvh.h"
 #include "resource.h"
+#include "utils/binary_io.h"
+#include "utils/hash.h"
+#include "utils/mapped_file.h"
+#include "world/primitive.h"
+#include "world/texture.h"
 
-#include <iostream>
 #include <linalg.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <limits>
 #include <memory>
 #include <omp.h>
+#include <optional>
 #include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 using namespace linalg::aliases;
 
 namespace cg::renderer {
 struct ray {
-    ray(float3 position, float3 direction) : position(position) {
+    ray(float3 position, float3 direction, float3 throughput = {1.F, 1.F, 1.F})
+        : position(position), throughput(throughput) {
         this->direction = normalize(direction);
     }
     float3 position;
     float3 direction;
+    float3 throughput; // product of the path weights (BRDF, cosine, pdf and roulette) up to this ray
+    // Ray cone for texture filtering: its width at `position` and how much wider it gets per unit of distance
+    float cone_width = 0.F;
+    float cone_spread = 0.F;
+
+    [[nodiscard]] float get_cone_width(float t) const {
+        return cone_width + (cone_spread * t);
+    }
 };
 
 struct payload {
@@ -25,8 +56,11 @@ struct payload {
     cg::color color;
 };
 
+static constexpr std::uint32_t kNoTexture = std::numeric_limits<std::uint32_t>::max();
+
 template <typename VB>
 struct triangle {
+    triangle() = default;
     triangle(const VB& vertex_a, const VB& vertex_b, const VB& vertex_c);
 
     float3 a;
@@ -40,28 +74,145 @@ struct triangle {
     float3 nb;
     float3 nc;
 
-    float3 ambient;
-    float3 diffuse;
-    float3 emissive;
+    float2 ta;
+    float2 tb;
+    float2 tc;
+
+    std::uint32_t material = 0;         // looked up with `raytracer::get_material`
+    std::uint32_t texture = kNoTexture; // shape whose texture `raytracer::get_albedo` samples
+};
+
+template <typename VB>
+inline triangle<VB>::triangle(const VB& vertex_a, const VB& vertex_b, const VB& vertex_c)
+    : a{vertex_a.v}, b{vertex_b.v}, c{vertex_c.v}, ba{b - a}, ca{c - a}, na{vertex_a.n}, nb{vertex_b.n},
+      nc{vertex_c.n}, ta{vertex_a.tex}, tb{vertex_b.tex}, tc{vertex_c.tex}, material{vertex_a.material} {}
+
+// Analytic primitives keep a proxy triangle with the shape's material for hit shaders. Its vertex normals are
+// the unit axes and the intersection reports the surface normal in `payload::bary`, so barycentric
+// interpolation in the hit shaders yields the exact normal. That leaves no texture coordinates to sample.
+template <typename VB>
+triangle<VB> make_analytic_attributes(triangle<VB> source) {
+    source.texture = kNoTexture;
+    source.na = float3{1.F, 0.F, 0.F};
+    source.nb = float3{0.F, 1.F, 0.F};
+    source.nc = float3{0.F, 0.F, 1.F};
+    return source;
+}
+
+template <typename VB>
+struct sphere {
+    float3 center;
+    float radius;
+    triangle<VB> attributes;
 };
 
 template <typename VB>
-inline triangle<VB>::triangle(const VB& vertex_a, const VB& vertex_b, const VB& vertex_c) {
-    // TODO Lab: 2.02 Implement a constructor of `triangle` struct
+struct quad {
+    float3 origin;
+    float3 edge_u;
+    float3 edge_v;
+    float3 normal;
+    triangle<VB> attributes;
+};
+
+inline float3 transform_point(const float4x4& matrix, const float3& point) {
+    return linalg::mul(matrix, float4{point, 1.F}).xyz();
+}
+
+inline float3 transform_vector(const float4x4& matrix, const float3& vector) {
+    return linalg::mul(matrix, float4{vector, 0.F}).xyz();
+}
+
+// Normals go through the inverse transpose, and `world_to_object` already is the inverse
+inline float3 transform_normal(const float4x4& world_to_object, const float3& normal) {
+    return linalg::normalize(float3{linalg::dot(world_to_object.x.xyz(), normal),
+                                    linalg::dot(world_to_object.y.xyz(), normal),
+                                    linalg::dot(world_to_object.z.xyz(), normal)});
+}
+
+template <typename VB>
+triangle<VB> transform_triangle(triangle<VB> source, const float4x4& object_to_world, const float4x4& world_to_object) {
+    source.a = transform_point(object_to_world, source.a);
+    source.b = transform_point(object_to_world, source.b);
+    source.c = transform_point(object_to_world, source.c);
+    source.ba = source.b - source.a;
+    source.ca = source.c - source.a;
+    source.na = transform_normal(world_to_object, source.na);
+    source.nb = transform_normal(world_to_object, source.nb);
+    source.nc = transform_normal(world_to_object, source.nc);
+    return source;
 }
 
+// Bottom-level structure: one shape's primitives in object space with a BVH over them. Triangles, spheres and
+// quads share the BVH primitive index space in that order.
 template <typename VB>
-class aabb {
+class blas {
   public:
-    void add_triangle(const triangle<VB> triangle);
+    void add_triangle(const triangle<VB>& triangle);
+    void add_sphere(const sphere<VB>& sphere);
+    void add_quad(const quad<VB>& quad);
+    void add_emissive_triangle(const triangle<VB>& triangle);
+    void clear();
+    void build(const bvh_build_settings& settings = {});
+    // Keeps the hierarchy of the last build or load for primitives that moved but kept their order
+    void refit();
+
     const std::vector<triangle<VB>>& get_triangles() const;
-    bool aabb_test(const ray& ray) const;
+    const std::vector<sphere<VB>>& get_spheres() const;
+    const std::vector<quad<VB>>& get_quads() const;
+    const std::vector<triangle<VB>>& get_emissive_triangles() const;
+    const bvh& get_hierarchy() const;
+    [[nodiscard]] bool empty() const;
+
+    void save(cg::utils::binary_writer& writer) const;
+    void load(cg::utils::binary_reader& reader);
 
   protected:
+    // NOLINTBEGIN(*-non-private-*)
     std::vector<triangle<VB>> triangles;
+    std::vector<sphere<VB>> spheres;
+    std::vector<quad<VB>> quads;
+    std::vector<triangle<VB>> emissive_triangles;
+    bvh hierarchy;
+    // NOLINTEND(*-non-private-*)
+
+    void get_primitive_bounds(std::vector<float3>& primitive_min, std::vector<float3>& primitive_max) const;
+    std::pair<bvh_reference, bvh_reference>
+    split_reference(const bvh_reference& reference, int axis, float position) const;
+};
+
+template <typename VB>
+struct instance {
+    std::shared_ptr<const blas<VB>> structure;
+    float4x4 object_to_world;
+    float4x4 world_to_object;
+    bool is_identity; // lets traversal skip transforming rays and hits
+};
+
+// Top-level structure: a BVH over the world-space bounds of placed bottom-level structures. Instances share
+// their geometry, and moving one only needs the top level rebuilt.
+template <typename VB>
+class tlas {
+  public:
+    void clear();
+    std::size_t add_instance(std::shared_ptr<const blas<VB>> structure, const float4x4& transform);
+    void set_transform(std::size_t instance_index, const float4x4& transform);
+    void build();
 
-    float3 aabb_min;
-    float3 aabb_max;
+    const std::vector<instance<VB>>& get_instances() const;
+    const bvh& get_hierarchy() const;
+
+  protected:
+    // NOLINTBEGIN(*-non-private-*)
+    std::vector<instance<VB>> instances;
+    bvh hierarchy;
+    // NOLINTEND(*-non-private-*)
+};
+
+// Places the bottom-level structure of shape `shape_index` in the world
+struct instance_placement {
+    std::size_t shape_index;
+    float4x4 transform;
 };
 
 struct light {
@@ -69,6 +220,45 @@ struct light {
     float3 color;
 };
 
+// Emissive analytic sphere where an instance placed it. It is sampled in object space, where it is round, and the
+// samples are carried to the world through the instance transform.
+struct sphere_emitter {
+    float3 center;
+    float radius;
+    float4x4 object_to_world;
+    float4x4 world_to_object;
+    float determinant; // of `object_to_world`, for how much it stretches areas
+    float3 emissive;
+};
+
+enum class light_sampling_mode {
+    power, // alias table over emitted power
+    tree,  // stochastic light BVH traversal
+};
+
+// A point on an emissive surface with `pdf` with respect to surface area, or a point light with its selection pmf
+struct light_sample {
+    float3 position;
+    float3 normal;
+    float3 emissive;
+    float pdf;
+    bool is_point;
+};
+
+inline float luminance(const float3& color) {
+    static constexpr float3 kWeights{0.2126F, 0.7152F, 0.0722F};
+    return linalg::dot(color, kWeights);
+}
+
+inline float get_random_float() {
+    thread_local std::mt19937 generator{std::random_device{}()};
+    thread_local std::uniform_real_distribution<float> distribution{0.F, 1.F};
+    return distribution(generator);
+}
+
+static constexpr std::uint64_t kAccelerationCacheMagic = 0x3130484356424743ULL; // "CGBVCH01"
+static constexpr std::uint32_t kAccelerationCacheVersion = 2;
+
 template <typename VB, typename RT>
 class raytracer {
   public:
@@ -80,110 +270,1215 @@ class raytracer {
     void set_viewport(size_t in_width, size_t in_height);
 
     void set_vertex_buffers(std::vector<std::shared_ptr<cg::resource<VB>>> in_vertex_buffers);
-    void set_index_buffers(std::vector<std::shared_ptr<cg::resource<unsigned int>>> in_index_buffers);
+    // Replaces the vertex buffers; vertices are decoded as triangles are set up
+    void set_packed_vertex_buffers(std::vector<std::shared_ptr<cg::resource<cg::packed_vertex>>> in_vertex_buffers,
+                                   std::vector<cg::vertex_quantization> in_quantizations);
+    // Replaces the vertex buffers
+    void set_vertex_streams(std::vector<cg::vertex_streams> in_vertex_streams);
+    void set_index_buffers(std::vector<std::shared_ptr<cg::resource<std::size_t>>> in_index_buffers);
     void build_acceleration_structure();
-    std::vector<aabb<VB>> acceleration_structures;
+    // Builds the bottom levels of `shape_indices` only, keeping the ones built before, then the top level over all
+    void build_acceleration_structure(const std::vector<std::size_t>& shape_indices);
+    // Updates the bottom levels after `set_vertex_buffers` moved the vertices of every shape while keeping its
+    // triangles in order, fitting recognized spheres and quads again. A bottom level whose primitives changed, or
+    // whose SAH cost grew past `rebuild_threshold` times its build cost, is rebuilt instead; returns how many were
+    // rebuilt. The top level, emitters and light structures are built again.
+    std::size_t refit_acceleration_structure();
+    void set_rebuild_threshold(float in_rebuild_threshold);
+    void set_build_settings(const bvh_build_settings& in_build_settings);
+    // Totals over the top level and every bottom level
+    [[nodiscard]] bvh_build_stats get_acceleration_structure_stats() const;
+
+    // Bottom levels can be cached in a file keyed by the geometry and builder settings. Loading returns false
+    // when the file is missing, stale or unreadable, and places the instances like a build would otherwise.
+    [[nodiscard]] std::uint64_t get_acceleration_structure_key() const;
+    bool load_acceleration_structure(const std::filesystem::path& path);
+    void save_acceleration_structure(const std::filesystem::path& path) const;
+    // Without placements every shape gets one instance at the origin
+    void set_instances(std::vector<instance_placement> in_instances);
+    void build_top_level();
+    std::shared_ptr<tlas<VB>> acceleration_structure = std::make_shared<tlas<VB>>();
 
     void
     ray_generation(float3 position, float3 direction, float3 right, float3 up, size_t depth, size_t accumulation_num);
 
     payload trace_ray(const ray& ray, size_t depth, float max_t = 1000.f, float min_t = 0.001f) const;
+    payload trace_path(const ray& ray, size_t depth, float max_t = 1000.f, float min_t = 0.001f) const;
     payload intersection_shader(const triangle<VB>& triangle, const ray& ray) const;
+    // The nearer root in (`min_t`, `max_t`), so rays starting inside the sphere hit its far side
+    payload intersection_shader(const sphere<VB>& sphere, const ray& ray, float min_t, float max_t) const;
+    payload intersection_shader(const quad<VB>& quad, const ray& ray) const;
+
+    void set_shape_primitives(std::vector<cg::world::shape_primitive> in_shape_primitives);
+    void set_materials(std::vector<cg::material> in_materials);
+    // Black for indices past the table
+    [[nodiscard]] const cg::material& get_material(const triangle<VB>& triangle) const;
+    // Per shape; null entries leave the shape untextured
+    void set_textures(std::vector<std::shared_ptr<const cg::world::texture>> in_textures);
+    // Diffuse color times the texture, filtered over the footprint of the ray cone at the hit
+    [[nodiscard]] float3 get_albedo(const ray& ray, const payload& payload, const triangle<VB>& triangle) const;
+
+    void set_russian_roulette_depth(size_t in_russian_roulette_depth);
+    [[nodiscard]] float get_survival_probability(const float3& throughput, size_t bounce) const;
+
+    void set_lights(std::vector<light> in_lights);
+    void set_light_sampling(light_sampling_mode in_light_sampling);
+    void build_light_structures();
+
+    [[nodiscard]] bool has_emissive_surfaces() const;
+    [[nodiscard]] bool has_lights() const;
+    [[nodiscard]] light_sample sample_light(const float3& position, const float3& normal, float3 xi) const;
+    [[nodiscard]] static light_sample
+    sample_sphere(const sphere_emitter& sphere, const float3& position, float pmf, float3 xi);
 
     std::function<payload(const ray& ray)> miss_shader = nullptr;
     std::function<payload(const ray& ray, payload& payload, const triangle<VB>& triangle, size_t depth)>
         closest_hit_shader = nullptr;
     std::function<payload(const ray& ray, payload& payload, const triangle<VB>& triangle)> any_hit_shader = nullptr;
+    // Non-recursive alternative to `closest_hit_shader`: writes the radiance gathered at the hit into `payload`,
+    // the continuation ray with its path weight into `next`, and returns false to end the path
+    std::function<bool(
+        const ray& ray, payload& payload, const triangle<VB>& triangle, size_t bounce, cg::renderer::ray& next)>
+        scatter_shader = nullptr;
 
     float2 get_jitter(int frame_id);
 
   protected:
     std::shared_ptr<cg::resource<RT>> render_target;
     std::shared_ptr<cg::resource<float3>> history;
-    std::vector<std::shared_ptr<cg::resource<unsigned int>>> index_buffers;
+    std::vector<std::shared_ptr<cg::resource<std::size_t>>> index_buffers;
     std::vector<std::shared_ptr<cg::resource<VB>>> vertex_buffers;
-    std::vector<triangle<VB>> triangles;
+    std::vector<std::shared_ptr<cg::resource<cg::packed_vertex>>> packed_vertex_buffers;
+    std::vector<cg::vertex_quantization> vertex_quantizations;
+    std::vector<cg::vertex_streams> vertex_streams;
+    std::vector<cg::world::shape_primitive> shape_primitives;
+    std::vector<cg::material> materials;
+    std::vector<std::shared_ptr<const cg::world::texture>> textures;
+    std::vector<std::shared_ptr<blas<VB>>> bottom_level_structures;
+    std::vector<instance_placement> instance_placements;
+    float rebuild_threshold = 1.5F;
+    bvh_build_settings build_settings;
+
+    // Emissive triangles, emissive spheres and point lights share one index space, in that order, in
+    // `light_table` and `light_tree`
+    std::vector<triangle<VB>> emissive_triangles;
+    std::vector<float> emissive_areas;
+    std::vector<sphere_emitter> emissive_spheres;
+    std::vector<light> lights;
+    alias_table light_table;
+    light_bvh light_tree;
+    light_sampling_mode light_sampling = light_sampling_mode::tree;
+
+    size_t russian_roulette_depth = 3;
 
     size_t width = 1920;
     size_t height = 1080;
+
+    // Returns the hit triangle moved to world space
+    std::optional<triangle<VB>>
+    find_closest_hit(const ray& ray, float max_t, float min_t, payload& closest_hit_payload) const;
+    [[nodiscard]] VB get_vertex(std::size_t shape_index, std::size_t index) const;
+    void populate_bottom_level(std::size_t shape_index, blas<VB>& structure) const;
+    const triangle<VB>* intersect_primitive(const blas<VB>& structure,
+                                            std::uint32_t primitive,
+                                            const ray& ray,
+                                            float max_t,
+                                            float min_t,
+                                            payload& payload) const;
 };
 
 template <typename VB, typename RT>
 inline void raytracer<VB, RT>::set_render_target(std::shared_ptr<resource<RT>> in_render_target) {
-    // TODO Lab: 2.01 Implement `set_render_target`, `set_viewport`, and `clear_render_target` methods of `raytracer`
-    // class
+    render_target = std::move(in_render_target);
 }
 
 template <typename VB, typename RT>
 inline void raytracer<VB, RT>::set_viewport(size_t in_width, size_t in_height) {
-    // TODO Lab: 2.01 Implement `set_render_target`, `set_viewport`, and `clear_render_target` methods of `raytracer`
-    // class
-    // TODO Lab: 2.06 Add `history` resource in `raytracer` class
+    width = in_width;
+    height = in_height;
+    history = std::make_shared<cg::resource<float3>>(width, height);
 }
 
 template <typename VB, typename RT>
 inline void raytracer<VB, RT>::clear_render_target(const RT& in_clear_value) {
-    // TODO Lab: 2.01 Implement `set_render_target`, `set_viewport`, and `clear_render_target` methods of `raytracer`
-    // class
-    // TODO Lab: 2.06 Add `history` resource in `raytracer` class
+    for (std::size_t i = 0; i < render_target->count(); ++i) {
+        render_target->item(i) = in_clear_value;
+    }
+    if (history) {
+        for (std::size_t i = 0; i < history->count(); ++i) {
+            history->item(i) = float3{0.F, 0.F, 0.F};
+        }
+    }
 }
 
 template <typename VB, typename RT>
 inline void raytracer<VB, RT>::set_vertex_buffers(std::vector<std::shared_ptr<cg::resource<VB>>> in_vertex_buffers) {
-    // TODO Lab: 2.02 Implement `set_vertex_buffers` and `set_index_buffers` of `raytracer` class
+    vertex_buffers = std::move(in_vertex_buffers);
+    packed_vertex_buffers.clear();
+    vertex_quantizations.clear();
+    vertex_streams.clear();
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_packed_vertex_buffers(
+    std::vector<std::shared_ptr<cg::resource<cg::packed_vertex>>> in_vertex_buffers,
+    std::vector<cg::vertex_quantization> in_quantizations) {
+    static_assert(std::is_same_v<VB, cg::vertex>, "Packed vertices decode to cg::vertex only");
+    packed_vertex_buffers = std::move(in_vertex_buffers);
+    vertex_quantizations = std::move(in_quantizations);
+    vertex_buffers.clear();
+    vertex_streams.clear();
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_vertex_streams(std::vector<cg::vertex_streams> in_vertex_streams) {
+    static_assert(std::is_same_v<VB, cg::vertex>, "Vertex streams gather into cg::vertex only");
+    vertex_streams = std::move(in_vertex_streams);
+    vertex_buffers.clear();
+    packed_vertex_buffers.clear();
+    vertex_quantizations.clear();
+}
+
+template <typename VB, typename RT>
+inline VB raytracer<VB, RT>::get_vertex(std::size_t shape_index, std::size_t index) const {
+    if constexpr (std::is_same_v<VB, cg::vertex>) {
+        if (!packed_vertex_buffers.empty())
+            return vertex_quantizations[shape_index].decode(packed_vertex_buffers[shape_index]->item(index));
+        if (!vertex_streams.empty())
+            return vertex_streams[shape_index].gather(index, {});
+    }
+    return vertex_buffers[shape_index]->item(index);
+}
+
+template <typename VB, typename RT>
+void raytracer<VB, RT>::set_index_buffers(std::vector<std::shared_ptr<cg::resource<std::size_t>>> in_index_buffers) {
+    index_buffers = std::move(in_index_buffers);
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_shape_primitives(std::vector<cg::world::shape_primitive> in_shape_primitives) {
+    shape_primitives = std::move(in_shape_primitives);
 }
 
 template <typename VB, typename RT>
-void raytracer<VB, RT>::set_index_buffers(std::vector<std::shared_ptr<cg::resource<unsigned int>>> in_index_buffers) {
-    // TODO Lab: 2.02 Implement `set_vertex_buffers` and `set_index_buffers` of `raytracer` class
+inline void raytracer<VB, RT>::set_materials(std::vector<cg::material> in_materials) {
+    materials = std::move(in_materials);
+}
+
+template <typename VB, typename RT>
+inline const cg::material& raytracer<VB, RT>::get_material(const triangle<VB>& triangle) const {
+    static const cg::material kMissingMaterial{};
+    return triangle.material < materials.size() ? materials[triangle.material] : kMissingMaterial;
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_textures(std::vector<std::shared_ptr<const cg::world::texture>> in_textures) {
+    textures = std::move(in_textures);
+}
+
+// Ray cone level of detail after Akenine-Moller et al., "Improved Shader and Texture Level of Detail Using Ray
+// Cones": the texel-to-surface area ratio of the triangle, scaled by the cone's width across the surface
+template <typename VB, typename RT>
+inline float3
+raytracer<VB, RT>::get_albedo(const ray& ray, const payload& payload, const triangle<VB>& triangle) const {
+    const float3& diffuse = get_material(triangle).diffuse;
+    if (triangle.texture >= textures.size() || !textures[triangle.texture])
+        return diffuse;
+    const cg::world::texture& texture = *textures[triangle.texture];
+
+    float2 uv = (payload.bary.x * triangle.ta) + (payload.bary.y * triangle.tb) + (payload.bary.z * triangle.tc);
+    float3 scaled_normal = linalg::cross(triangle.ba, triangle.ca);
+    float world_area = linalg::length(scaled_normal);
+    float2 uv_ba = triangle.tb - triangle.ta;
+    float2 uv_ca = triangle.tc - triangle.ta;
+    float texel_area = std::abs((uv_ba.x * uv_ca.y) - (uv_ba.y * uv_ca.x)) *
+                       static_cast<float>(texture.get_width() * texture.get_height());
+    float lod = 0.F;
+    if (world_area > 0.F && texel_area > 0.F) {
+        float cosine = std::abs(linalg::dot(scaled_normal / world_area, ray.direction));
+        float width = ray.get_cone_width(payload.t) / std::max(cosine, 1e-3F);
+        lod = (0.5F * std::log2(texel_area / world_area)) + std::log2(width);
+    }
+    return diffuse * texture.sample(uv, lod);
 }
 
 template <typename VB, typename RT>
 inline void raytracer<VB, RT>::build_acceleration_structure() {
-    // TODO Lab: 2.02 Fill `triangles` vector in `build_acceleration_structure` of `raytracer` class
-    // TODO Lab: 2.05 Implement `build_acceleration_structure` method of `raytracer` class
+    bottom_level_structures.assign(index_buffers.size(), nullptr);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int shape_i = 0; shape_i < static_cast<int>(index_buffers.size()); ++shape_i) {
+        auto structure = std::make_shared<blas<VB>>();
+        populate_bottom_level(shape_i, *structure);
+        if (!structure->empty()) {
+            structure->build(build_settings);
+            bottom_level_structures[shape_i] = std::move(structure);
+        }
+    }
+    build_top_level();
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::build_acceleration_structure(const std::vector<std::size_t>& shape_indices) {
+    bottom_level_structures.resize(index_buffers.size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (int order_i = 0; order_i < static_cast<int>(shape_indices.size()); ++order_i) {
+        std::size_t shape_i = shape_indices[order_i];
+        auto structure = std::make_shared<blas<VB>>();
+        populate_bottom_level(shape_i, *structure);
+        if (!structure->empty()) {
+            structure->build(build_settings);
+            bottom_level_structures[shape_i] = std::move(structure);
+        } else
+            bottom_level_structures[shape_i] = nullptr;
+    }
+    build_top_level();
+}
+
+template <typename VB, typename RT>
+inline std::size_t raytracer<VB, RT>::refit_acceleration_structure() {
+    using cg::world::primitive_type;
+
+    if (vertex_buffers.empty())
+        THROW_ERROR("Only full vertex buffers can be refitted");
+
+    auto get_primitive_count = [](const blas<VB>& structure) {
+        return structure.get_triangles().size() + structure.get_spheres().size() + structure.get_quads().size();
+    };
+    std::size_t rebuilt = 0;
+    std::vector<std::uint8_t> is_refitted(bottom_level_structures.size(), 0);
+#pragma omp parallel for schedule(dynamic) reduction(+ : rebuilt)
+    for (int shape_i = 0; shape_i < static_cast<int>(bottom_level_structures.size()); ++shape_i) {
+        blas<VB>* structure = bottom_level_structures[shape_i].get();
+        if (structure == nullptr)
+            continue;
+
+        // A shape that stopped fitting its sphere or quad changes its primitive count
+        auto shape = static_cast<std::size_t>(shape_i);
+        if (shape < shape_primitives.size() && shape_primitives[shape].type != primitive_type::mesh)
+            shape_primitives[shape] = cg::world::fit_primitive(*vertex_buffers[shape], *index_buffers[shape]);
+        std::size_t primitive_count = get_primitive_count(*structure);
+        structure->clear();
+        populate_bottom_level(shape, *structure);
+        if (get_primitive_count(*structure) != primitive_count) {
+            structure->build(build_settings);
+            ++rebuilt;
+        } else
+            is_refitted[shape] = 1;
+    }
+
+    // One shape at a time, as each refit runs its levels in parallel
+    for (std::size_t shape_i = 0; shape_i < bottom_level_structures.size(); ++shape_i) {
+        if (is_refitted[shape_i] == 0)
+            continue;
+
+        blas<VB>& structure = *bottom_level_structures[shape_i];
+        structure.refit();
+        const bvh& hierarchy = structure.get_hierarchy();
+        if (hierarchy.get_sah_cost() > rebuild_threshold * hierarchy.get_build_sah_cost()) {
+            structure.build(build_settings);
+            ++rebuilt;
+        }
+    }
+    // The top level only holds one box per instance, so it is cheaper to rebuild than to track
+    build_top_level();
+    return rebuilt;
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_rebuild_threshold(float in_rebuild_threshold) {
+    rebuild_threshold = in_rebuild_threshold;
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_build_settings(const bvh_build_settings& in_build_settings) {
+    build_settings = in_build_settings;
+}
+
+template <typename VB, typename RT>
+inline bvh_build_stats raytracer<VB, RT>::get_acceleration_structure_stats() const {
+    bvh_build_stats total = acceleration_structure->get_hierarchy().get_stats();
+    for (const auto& structure : bottom_level_structures) {
+        if (!structure)
+            continue;
+
+        bvh_build_stats stats = structure->get_hierarchy().get_stats();
+        total.primitive_count += stats.primitive_count;
+        total.reference_count += stats.reference_count;
+        total.node_count += stats.node_count;
+        total.memory_bytes += stats.memory_bytes;
+    }
+    return total;
+}
+
+template <typename VB, typename RT>
+inline std::uint64_t raytracer<VB, RT>::get_acceleration_structure_key() const {
+    using cg::utils::hash_value;
+
+    // Structs are hashed field by field, as their padding bytes are undefined. Vertex and index arrays are hashed
+    // whole, which holds only while the vertex types have no padding.
+    static_assert(sizeof(cg::vertex) == 9 * sizeof(float));
+    static_assert(sizeof(cg::packed_vertex) == 8 * sizeof(std::uint16_t));
+    std::uint64_t key = hash_value(sizeof(triangle<VB>));
+    key = hash_value(build_settings.spatial_splits, key);
+    key = hash_value(build_settings.duplication_budget, key);
+    key = hash_value(build_settings.overlap_threshold, key);
+    // Materials decide which triangles are stored as emitters
+    key = hash_value(materials.size(), key);
+    for (const cg::material& material : materials) {
+        key = hash_value(material.ambient, key);
+        key = hash_value(material.diffuse, key);
+        key = hash_value(material.emissive, key);
+    }
+    for (std::size_t shape_i = 0; shape_i < index_buffers.size(); ++shape_i) {
+        const auto& index_buffer = index_buffers[shape_i];
+        if (!vertex_streams.empty()) {
+            const cg::vertex_streams& streams = vertex_streams[shape_i];
+            std::size_t count = streams.count();
+            key = cg::utils::hash_bytes(streams.positions->get_data(), count * sizeof(float3), key);
+            key = cg::utils::hash_bytes(streams.normals->get_data(), count * sizeof(float3), key);
+            key = cg::utils::hash_bytes(streams.texcoords->get_data(), count * sizeof(float2), key);
+            key = cg::utils::hash_bytes(streams.materials->get_data(), count * sizeof(std::uint32_t), key);
+        } else if (packed_vertex_buffers.empty()) {
+            const auto& vertex_buffer = vertex_buffers[shape_i];
+            key = cg::utils::hash_bytes(vertex_buffer->get_data(), vertex_buffer->count() * sizeof(VB), key);
+        } else {
+            const auto& vertex_buffer = packed_vertex_buffers[shape_i];
+            key = cg::utils::hash_bytes(
+                vertex_buffer->get_data(), vertex_buffer->count() * sizeof(cg::packed_vertex), key);
+            key = hash_value(vertex_quantizations[shape_i].origin, key);
+            key = hash_value(vertex_quantizations[shape_i].step, key);
+        }
+        key = cg::utils::hash_bytes(index_buffer->get_data(), index_buffer->count() * sizeof(std::size_t), key);
+        if (shape_i < shape_primitives.size()) {
+            const cg::world::shape_primitive& primitive = shape_primitives[shape_i];
+            key = hash_value(primitive.type, key);
+            key = hash_value(primitive.origin, key);
+            key = hash_value(primitive.radius, key);
+            key = hash_value(primitive.edge_u, key);
+            key = hash_value(primitive.edge_v, key);
+        }
+    }
+    return key;
+}
+
+template <typename VB, typename RT>
+inline bool raytracer<VB, RT>::load_acceleration_structure(const std::filesystem::path& path) {
+    if (!std::filesystem::exists(path))
+        return false;
+
+    std::vector<std::shared_ptr<blas<VB>>> structures;
+    try {
+        cg::utils::mapped_file file(path);
+        cg::utils::binary_reader reader(file.get_data(), file.get_size());
+        if (reader.read<std::uint64_t>() != kAccelerationCacheMagic ||
+            reader.read<std::uint32_t>() != kAccelerationCacheVersion ||
+            reader.read<std::uint64_t>() != get_acceleration_structure_key())
+            return false;
+
+        auto shape_count = static_cast<std::size_t>(reader.read<std::uint64_t>());
+        if (shape_count != index_buffers.size())
+            return false;
+
+        structures.resize(shape_count);
+        for (auto& structure : structures) {
+            if (reader.read<std::uint8_t>() == 0)
+                continue;
+            structure = std::make_shared<blas<VB>>();
+            structure->load(reader);
+        }
+    } catch (const std::runtime_error& error) {
+        std::cout << "Ignoring " << path.string() << ": " << cg::utils::get_error_line(error);
+        return false;
+    }
+
+    bottom_level_structures = std::move(structures);
+    build_top_level();
+    return true;
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::save_acceleration_structure(const std::filesystem::path& path) const {
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path());
+
+    cg::utils::write_file_atomically(path, [&](cg::utils::binary_writer& writer) {
+        writer.write(kAccelerationCacheMagic);
+        writer.write(kAccelerationCacheVersion);
+        writer.write(get_acceleration_structure_key());
+        writer.write(static_cast<std::uint64_t>(bottom_level_structures.size()));
+        for (const auto& structure : bottom_level_structures) {
+            writer.write(static_cast<std::uint8_t>(structure ? 1 : 0));
+            if (structure)
+                structure->save(writer);
+        }
+    });
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::populate_bottom_level(std::size_t shape_index, blas<VB>& structure) const {
+    using cg::world::primitive_type;
+
+    const auto& index_buffer = index_buffers[shape_index];
+    if (index_buffer->count() < 3)
+        return;
+
+    primitive_type type =
+        shape_index < shape_primitives.size() ? shape_primitives[shape_index].type : primitive_type::mesh;
+
+    for (std::size_t index_i = 0; index_i + 2 < index_buffer->count(); index_i += 3) {
+        triangle<VB> triangle(get_vertex(shape_index, index_buffer->item(index_i)),
+                              get_vertex(shape_index, index_buffer->item(index_i + 1)),
+                              get_vertex(shape_index, index_buffer->item(index_i + 2)));
+        triangle.texture = static_cast<std::uint32_t>(shape_index);
+        if (type == primitive_type::mesh)
+            structure.add_triangle(triangle);
+        // Emissive spheres are sampled on their analytic surface, which hides the triangles inside it. Quads
+        // lie in the plane of their triangles, so those can stand in for them.
+        if (type != primitive_type::sphere && luminance(get_material(triangle).emissive) > 0.F)
+            structure.add_emissive_triangle(triangle);
+    }
+
+    triangle<VB> attributes = make_analytic_attributes(triangle<VB>(get_vertex(shape_index, index_buffer->item(0)),
+                                                                    get_vertex(shape_index, index_buffer->item(1)),
+                                                                    get_vertex(shape_index, index_buffer->item(2))));
+    if (type == primitive_type::sphere) {
+        const cg::world::shape_primitive& primitive = shape_primitives[shape_index];
+        structure.add_sphere({primitive.origin, primitive.radius, attributes});
+    } else if (type == primitive_type::quad) {
+        const cg::world::shape_primitive& primitive = shape_primitives[shape_index];
+        float3 normal = linalg::normalize(linalg::cross(primitive.edge_u, primitive.edge_v));
+        if (linalg::dot(normal, get_vertex(shape_index, index_buffer->item(0)).n) < 0.F)
+            normal = -normal;
+        structure.add_quad({primitive.origin, primitive.edge_u, primitive.edge_v, normal, attributes});
+    }
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_instances(std::vector<instance_placement> in_instances) {
+    instance_placements = std::move(in_instances);
+}
+
+// Instances and the emitters they carry are placed in the world here; bottom levels are left untouched
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::build_top_level() {
+    std::vector<instance_placement> placements = instance_placements;
+    if (placements.empty()) {
+        for (std::size_t shape_i = 0; shape_i < bottom_level_structures.size(); ++shape_i)
+            placements.push_back({shape_i, linalg::identity});
+    }
+
+    acceleration_structure->clear();
+    emissive_triangles.clear();
+    emissive_areas.clear();
+    emissive_spheres.clear();
+    for (const instance_placement& placement : placements) {
+        if (placement.shape_index >= bottom_level_structures.size() ||
+            !bottom_level_structures[placement.shape_index])
+            continue;
+
+        const blas<VB>& structure = *bottom_level_structures[placement.shape_index];
+        std::size_t instance_index =
+            acceleration_structure->add_instance(bottom_level_structures[placement.shape_index], placement.transform);
+        const instance<VB>& instance = acceleration_structure->get_instances()[instance_index];
+
+        for (const triangle<VB>& source : structure.get_emissive_triangles()) {
+            triangle<VB> triangle =
+                instance.is_identity ? source
+                                     : transform_triangle(source, instance.object_to_world, instance.world_to_object);
+            float area = linalg::length(linalg::cross(triangle.ba, triangle.ca)) / 2.F;
+            if (area > 0.F) {
+                emissive_triangles.push_back(triangle);
+                emissive_areas.push_back(area);
+            }
+        }
+        for (const sphere<VB>& source : structure.get_spheres()) {
+            float3 emissive = get_material(source.attributes).emissive;
+            if (luminance(emissive) <= 0.F || source.radius <= 0.F)
+                continue;
+            emissive_spheres.push_back({source.center,
+                                        source.radius,
+                                        instance.object_to_world,
+                                        instance.world_to_object,
+                                        linalg::determinant(instance.object_to_world),
+                                        emissive});
+        }
+    }
+    acceleration_structure->build();
+    build_light_structures();
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_lights(std::vector<light> in_lights) {
+    lights = std::move(in_lights);
+    build_light_structures();
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_light_sampling(light_sampling_mode in_light_sampling) {
+    light_sampling = in_light_sampling;
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::build_light_structures() {
+    static constexpr float kPi = 3.14159265358979323846F;
+
+    std::vector<float> weights;
+    std::vector<light_bounds> bounds;
+    std::size_t emitter_count = emissive_triangles.size() + emissive_spheres.size() + lights.size();
+    weights.reserve(emitter_count);
+    bounds.reserve(emitter_count);
+
+    for (std::size_t i = 0; i < emissive_triangles.size(); ++i) {
+        const triangle<VB>& triangle = emissive_triangles[i];
+        // Emitters are two-sided diffuse surfaces
+        float power = 2.F * kPi * emissive_areas[i] * luminance(get_material(triangle).emissive);
+        weights.push_back(power);
+        light_bounds emitter;
+        emitter.bounds_min = linalg::min(triangle.a, linalg::min(triangle.b, triangle.c));
+        emitter.bounds_max = linalg::max(triangle.a, linalg::max(triangle.b, triangle.c));
+        emitter.axis = linalg::normalize(linalg::cross(triangle.ba, triangle.ca));
+        emitter.cos_theta_o = 1.F;
+        emitter.cos_theta_e = 0.F;
+        emitter.power = power;
+        emitter.two_sided = true;
+        bounds.push_back(emitter);
+    }
+    for (const sphere_emitter& sphere : emissive_spheres) {
+        // Diffuse outward emission over the area, which an uneven scale makes only roughly that of a sphere
+        float radius = sphere.radius * std::cbrt(std::abs(sphere.determinant));
+        float power = 4.F * kPi * kPi * radius * radius * luminance(sphere.emissive);
+        weights.push_back(power);
+        light_bounds emitter;
+        emitter.bounds_min = float3{std::numeric_limits<float>::max()};
+        emitter.bounds_max = float3{std::numeric_limits<float>::lowest()};
+        for (int corner = 0; corner < 8; ++corner) {
+            auto sign = [&](int bit) { return (corner & bit) != 0 ? 1.F : -1.F; };
+            float3 offset{sign(1), sign(2), sign(4)};
+            float3 point = transform_point(sphere.object_to_world, sphere.center + (offset * sphere.radius));
+            emitter.bounds_min = linalg::min(emitter.bounds_min, point);
+            emitter.bounds_max = linalg::max(emitter.bounds_max, point);
+        }
+        emitter.axis = float3{0.F, 0.F, 1.F};
+        emitter.cos_theta_o = -1.F;
+        emitter.cos_theta_e = 0.F;
+        emitter.power = power;
+        emitter.two_sided = false;
+        bounds.push_back(emitter);
+    }
+    for (const light& light : lights) {
+        float power = 4.F * kPi * luminance(light.color);
+        weights.push_back(power);
+        // Point lights emit in every direction
+        light_bounds emitter;
+        emitter.bounds_min = light.position;
+        emitter.bounds_max = light.position;
+        emitter.axis = float3{0.F, 0.F, 1.F};
+        emitter.cos_theta_o = -1.F;
+        emitter.cos_theta_e = 0.F;
+        emitter.power = power;
+        emitter.two_sided = false;
+        bounds.push_back(emitter);
+    }
+
+    light_table.build(weights);
+    light_tree.build(bounds);
 }
 
 template <typename VB, typename RT>
 inline void raytracer<VB, RT>::ray_generation(
     float3 position, float3 direction, float3 right, float3 up, size_t depth, size_t accumulation_num) {
-    // TODO Lab: 2.01 Implement `ray_generation` and `trace_ray` method of `raytracer` class
-    // TODO Lab: 2.06 Implement TAA in `ray_generation` method of `raytracer` class
+    float frame_weight = 1.F / static_cast<float>(accumulation_num);
+    float aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
+    // Angle a pixel spans at the center of the view
+    float pixel_spread = 2.F * linalg::length(up) / (linalg::length(direction) * static_cast<float>(height));
+
+    for (int frame_id = 0; frame_id < static_cast<int>(accumulation_num); ++frame_id) {
+        std::cout << "Tracing frame #" << frame_id + 1 << '\n';
+        float2 jitter = get_jitter(frame_id);
+
+#pragma omp parallel for schedule(dynamic)
+        for (int y = 0; y < static_cast<int>(height); ++y) {
+            for (int x = 0; x < static_cast<int>(width); ++x) {
+                float u = ((2.F * (static_cast<float>(x) + 0.5F + jitter.x)) / static_cast<float>(width)) - 1.F;
+                float v = ((2.F * (static_cast<float>(y) + 0.5F + jitter.y)) / static_cast<float>(height)) - 1.F;
+                u *= aspect_ratio;
+
+                float3 ray_direction = direction + (u * right) - (v * up);
+                ray ray(position, ray_direction);
+                ray.cone_spread = pixel_spread;
+
+                payload payload = scatter_shader ? trace_path(ray, depth) : trace_ray(ray, depth);
+                history->item(x, y) += payload.color.to_float3() * frame_weight;
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < history->count(); ++i) {
+        render_target->item(i) = RT::from_float3(linalg::sqrt(history->item(i))); // approximate gamma 2.0
+    }
 }
 
 template <typename VB, typename RT>
 inline payload raytracer<VB, RT>::trace_ray(const ray& ray, size_t depth, float max_t, float min_t) const {
-    // TODO Lab: 2.01 Implement `ray_generation` and `trace_ray` method of `raytracer` class
-    // TODO Lab: 2.02 Adjust `trace_ray` method of `raytracer` class to traverse geometry and call a closest hit shader
-    // TODO Lab: 2.04 Adjust `trace_ray` method of `raytracer` to use `any_hit_shader`
-    // TODO Lab: 2.05 Adjust `trace_ray` method of `raytracer` class to traverse the acceleration structure
-    return payload{};
+    if (depth == 0)
+        return miss_shader(ray);
+    --depth;
+
+    payload closest_hit_payload{};
+    std::optional<triangle<VB>> closest_triangle = find_closest_hit(ray, max_t, min_t, closest_hit_payload);
+
+    if (!closest_triangle)
+        return miss_shader(ray);
+    if (any_hit_shader)
+        return any_hit_shader(ray, closest_hit_payload, *closest_triangle);
+    if (closest_hit_shader)
+        return closest_hit_shader(ray, closest_hit_payload, *closest_triangle, depth);
+    return closest_hit_payload;
+}
+
+// Iterative path loop: throughput is carried in the ray instead of the call stack, and Russian roulette ends
+// paths whose remaining contribution is small
+template <typename VB, typename RT>
+inline payload raytracer<VB, RT>::trace_path(const ray& ray, size_t depth, float max_t, float min_t) const {
+    float3 radiance{0.F, 0.F, 0.F};
+    cg::renderer::ray current = ray;
+
+    for (size_t bounce = 0; bounce < depth; ++bounce) {
+        payload hit_payload{};
+        std::optional<triangle<VB>> triangle = find_closest_hit(current, max_t, min_t, hit_payload);
+        if (!triangle) {
+            radiance += current.throughput * miss_shader(current).color.to_float3();
+            break;
+        }
+
+        cg::renderer::ray next = current;
+        bool scattered = scatter_shader(current, hit_payload, *triangle, bounce, next);
+        radiance += current.throughput * hit_payload.color.to_float3();
+        if (!scattered || bounce + 1 == depth)
+            break;
+
+        float3 throughput = current.throughput * next.throughput;
+        float survival = get_survival_probability(throughput, bounce + 1);
+        if (get_random_float() >= survival)
+            break;
+        next.throughput = throughput / survival;
+        current = next;
+    }
+
+    payload result{};
+    result.color = cg::color::from_float3(radiance);
+    return result;
+}
+
+template <typename VB, typename RT>
+inline void raytracer<VB, RT>::set_russian_roulette_depth(size_t in_russian_roulette_depth) {
+    russian_roulette_depth = in_russian_roulette_depth;
+}
+
+// Paths keep going with a probability tied to their throughput; survivors are reweighted by its inverse, so
+// the estimate stays unbiased while dim paths stop early
+template <typename VB, typename RT>
+inline float raytracer<VB, RT>::get_survival_probability(const float3& throughput, size_t bounce) const {
+    static constexpr float kMinSurvival = 0.05F;
+    if (bounce < russian_roulette_depth)
+        return 1.F;
+    return std::clamp(linalg::maxelem(throughput), kMinSurvival, 1.F);
+}
+
+// Rays enter each instance in object space without renormalizing the direction, so hit distances stay in world units
+template <typename VB, typename RT>
+inline std::optional<triangle<VB>> raytracer<VB, RT>::find_closest_hit(const ray& ray,
+                                                                       float max_t,
+                                                                       float min_t,
+                                                                       payload& closest_hit_payload) const {
+    closest_hit_payload.t = max_t;
+    const std::vector<instance<VB>>& instances = acceleration_structure->get_instances();
+    const triangle<VB>* closest_triangle = nullptr;
+    const instance<VB>* closest_instance = nullptr;
+    bool closest_is_analytic = false;
+
+    float closest_t = max_t;
+    acceleration_structure->get_hierarchy().traverse(
+        ray.position, 1.F / ray.direction, closest_t, [&](std::uint32_t instance_index, float& instance_max_t) {
+            const instance<VB>& instance = instances[instance_index];
+            cg::renderer::ray local_ray = ray;
+            if (!instance.is_identity) {
+                local_ray.position = transform_point(instance.world_to_object, ray.position);
+                local_ray.direction = transform_vector(instance.world_to_object, ray.direction);
+            }
+
+            const blas<VB>& structure = *instance.structure;
+            return structure.get_hierarchy().traverse(
+                local_ray.position,
+                1.F / local_ray.direction,
+                instance_max_t,
+                [&](std::uint32_t primitive, float& primitive_max_t) {
+                    payload payload{};
+                    const triangle<VB>* triangle =
+                        intersect_primitive(structure, primitive, local_ray, primitive_max_t, min_t, payload);
+                    if (payload.t <= min_t || payload.t >= primitive_max_t)
+                        return false;
+
+                    primitive_max_t = payload.t;
+                    closest_hit_payload = payload;
+                    closest_triangle = triangle;
+                    closest_instance = &instance;
+                    closest_is_analytic = primitive >= structure.get_triangles().size();
+                    // Any hit is enough for occlusion queries
+                    return static_cast<bool>(any_hit_shader);
+                });
+        });
+
+    if (closest_triangle == nullptr)
+        return std::nullopt;
+    if (closest_instance->is_identity)
+        return *closest_triangle;
+    // Analytic hits report their normal in `bary`, and their proxy normals must stay the unit axes
+    if (closest_is_analytic) {
+        closest_hit_payload.bary = transform_normal(closest_instance->world_to_object, closest_hit_payload.bary);
+        return *closest_triangle;
+    }
+    return transform_triangle(*closest_triangle, closest_instance->object_to_world, closest_instance->world_to_object);
+}
+
+template <typename VB, typename RT>
+inline const triangle<VB>* raytracer<VB, RT>::intersect_primitive(const blas<VB>& structure,
+                                                                  std::uint32_t primitive,
+                                                                  const ray& ray,
+                                                                  float max_t,
+                                                                  float min_t,
+                                                                  payload& payload) const {
+    std::size_t index = primitive;
+    if (index < structure.get_triangles().size()) {
+        const triangle<VB>& triangle = structure.get_triangles()[index];
+        payload = intersection_shader(triangle, ray);
+        return &triangle;
+    }
+    index -= structure.get_triangles().size();
+    if (index < structure.get_spheres().size()) {
+        const sphere<VB>& sphere = structure.get_spheres()[index];
+        payload = intersection_shader(sphere, ray, min_t, max_t);
+        return &sphere.attributes;
+    }
+    index -= structure.get_spheres().size();
+    const quad<VB>& quad = structure.get_quads()[index];
+    payload = intersection_shader(quad, ray);
+    return &quad.attributes;
 }
 
 template <typename VB, typename RT>
 inline payload raytracer<VB, RT>::intersection_shader(const triangle<VB>& triangle, const ray& ray) const {
-    // TODO Lab: 2.02 Implement an `intersection_shader` method of `raytracer` class
-    return payload{};
+    // Möller–Trumbore
+    static constexpr float kEpsilon = 1e-8F;
+    payload payload{};
+    payload.t = -1.F;
+
+    float3 pvec = linalg::cross(ray.direction, triangle.ca);
+    float det = linalg::dot(triangle.ba, pvec);
+    if (std::abs(det) < kEpsilon)
+        return payload;
+
+    float inv_det = 1.F / det;
+    float3 tvec = ray.position - triangle.a;
+    float u = linalg::dot(tvec, pvec) * inv_det;
+    if (u < 0.F || u > 1.F)
+        return payload;
+
+    float3 qvec = linalg::cross(tvec, triangle.ba);
+    float v = linalg::dot(ray.direction, qvec) * inv_det;
+    if (v < 0.F || u + v > 1.F)
+        return payload;
+
+    payload.t = linalg::dot(triangle.ca, qvec) * inv_det;
+    payload.bary = float3{1.F - u - v, u, v};
+    return payload;
+}
+
+template <typename VB, typename RT>
+inline payload
+raytracer<VB, RT>::intersection_shader(const sphere<VB>& sphere, const ray& ray, float min_t, float max_t) const {
+    payload payload{};
+    payload.t = -1.F;
+
+    // The direction is not unit length inside transformed instances
+    float3 oc = ray.position - sphere.center;
+    float a = linalg::dot(ray.direction, ray.direction);
+    float b = linalg::dot(oc, ray.direction);
+    float c = linalg::dot(oc, oc) - (sphere.radius * sphere.radius);
+    float discriminant = (b * b) - (a * c);
+    if (discriminant < 0.F)
+        return payload;
+
+    float root = std::sqrt(discriminant);
+    float t = (-b - root) / a;
+    if (t <= min_t)
+        t = (-b + root) / a;
+    if (t <= min_t || t >= max_t)
+        return payload;
+
+    payload.t = t;
+    payload.bary = ((ray.position + (ray.direction * t)) - sphere.center) / sphere.radius;
+    return payload;
+}
+
+template <typename VB, typename RT>
+inline payload raytracer<VB, RT>::intersection_shader(const quad<VB>& quad, const ray& ray) const {
+    static constexpr float kEpsilon = 1e-8F;
+    payload payload{};
+    payload.t = -1.F;
+
+    float3 normal = linalg::cross(quad.edge_u, quad.edge_v);
+    float denominator = linalg::dot(normal, ray.direction);
+    if (std::abs(denominator) < kEpsilon)
+        return payload;
+
+    float t = linalg::dot(normal, quad.origin - ray.position) / denominator;
+    float3 planar = (ray.position + (ray.direction * t)) - quad.origin;
+    float3 w = normal / linalg::dot(normal, normal);
+    float alpha = linalg::dot(w, linalg::cross(planar, quad.edge_v));
+    float beta = linalg::dot(w, linalg::cross(quad.edge_u, planar));
+    if (alpha < 0.F || alpha > 1.F || beta < 0.F || beta > 1.F)
+        return payload;
+
+    payload.t = t;
+    payload.bary = quad.normal;
+    return payload;
+}
+
+template <typename VB, typename RT>
+inline bool raytracer<VB, RT>::has_emissive_surfaces() const {
+    return !emissive_triangles.empty() || !emissive_spheres.empty();
+}
+
+template <typename VB, typename RT>
+inline bool raytracer<VB, RT>::has_lights() const {
+    return !light_table.empty();
+}
+
+// `xi` holds three uniform numbers: x picks a light, y and z pick a point on an emissive surface.
+// A zero `pdf` means no light could be chosen for this shading point.
+template <typename VB, typename RT>
+inline light_sample
+raytracer<VB, RT>::sample_light(const float3& position, const float3& normal, float3 xi) const {
+    light_sample sample{};
+    if (light_table.empty())
+        return sample;
+
+    std::size_t index = 0;
+    float pmf = 0.F;
+    if (light_sampling == light_sampling_mode::tree) {
+        light_choice choice = light_tree.sample(position, normal, xi.x);
+        index = choice.index;
+        pmf = choice.pmf;
+    } else {
+        index = light_table.sample(xi.x);
+        pmf = light_table.get_pdf(index);
+    }
+    if (pmf <= 0.F)
+        return sample;
+
+    if (index < emissive_triangles.size()) {
+        const triangle<VB>& triangle = emissive_triangles[index];
+        float su = std::sqrt(xi.y);
+        float b = su * (1.F - xi.z);
+        float c = su * xi.z;
+
+        sample.position = triangle.a + (b * triangle.ba) + (c * triangle.ca);
+        sample.normal = linalg::normalize(linalg::cross(triangle.ba, triangle.ca));
+        sample.emissive = get_material(triangle).emissive;
+        sample.pdf = pmf / emissive_areas[index];
+        return sample;
+    }
+
+    index -= emissive_triangles.size();
+    if (index >= emissive_spheres.size()) {
+        const light& light = lights[index - emissive_spheres.size()];
+        sample.position = light.position;
+        sample.emissive = light.color;
+        sample.pdf = pmf;
+        sample.is_point = true;
+        return sample;
+    }
+    return sample_sphere(emissive_spheres[index], position, pmf, xi);
+}
+
+// Uniform over the area of the cap `position` sees, or of the whole sphere from inside it. The cap is taken in
+// object space, where its area is 2 pi r^2 (1 - cos of its half angle), and the instance transform stretches
+// each area element by |det| times the length of the normal it carries to the world.
+template <typename VB, typename RT>
+inline light_sample
+raytracer<VB, RT>::sample_sphere(const sphere_emitter& sphere, const float3& position, float pmf, float3 xi) {
+    static constexpr float kPi = 3.14159265358979323846F;
+
+    float3 to_position = transform_point(sphere.world_to_object, position) - sphere.center;
+    float distance = linalg::length(to_position);
+    float cos_cap = distance > sphere.radius ? sphere.radius / distance : -1.F;
+    float3 axis = distance > 0.F ? to_position / distance : float3{0.F, 0.F, 1.F};
+    float3 tangent =
+        linalg::normalize(linalg::cross(std::abs(axis.x) > 0.9F ? float3{0.F, 1.F, 0.F} : float3{1.F, 0.F, 0.F}, axis));
+    float3 bitangent = linalg::cross(axis, tangent);
+
+    float cos_theta = 1.F - (xi.y * (1.F - cos_cap));
+    float sin_theta = std::sqrt(std::max(0.F, 1.F - (cos_theta * cos_theta)));
+    float phi = 2.F * kPi * xi.z;
+    float3 normal = (tangent * (sin_theta * std::cos(phi))) + (bitangent * (sin_theta * std::sin(phi))) +
+                    (axis * cos_theta);
+    float3 world_normal{linalg::dot(sphere.world_to_object.x.xyz(), normal),
+                        linalg::dot(sphere.world_to_object.y.xyz(), normal),
+                        linalg::dot(sphere.world_to_object.z.xyz(), normal)};
+    float stretch = std::abs(sphere.determinant) * linalg::length(world_normal);
+    float cap_area = 2.F * kPi * sphere.radius * sphere.radius * (1.F - cos_cap);
+
+    light_sample sample{};
+    sample.position = transform_point(sphere.object_to_world, sphere.center + (normal * sphere.radius));
+    sample.normal = linalg::normalize(world_normal);
+    sample.emissive = sphere.emissive;
+    sample.pdf = pmf / (cap_area * stretch);
+    return sample;
 }
 
 template <typename VB, typename RT>
 float2 raytracer<VB, RT>::get_jitter(int frame_id) {
-    // TODO Lab: 2.06 Implement `get_jitter` method of `raytracer` class
+    // Halton (2, 3) sequence centered around the pixel center
+    auto radical_inverse = [](int index, int base) {
+        float result = 0.F;
+        float fraction = 1.F / static_cast<float>(base);
+        while (index > 0) {
+            result += static_cast<float>(index % base) * fraction;
+            index /= base;
+            fraction /= static_cast<float>(base);
+        }
+        return result;
+    };
+    return float2{radical_inverse(frame_id + 1, 2) - 0.5F, radical_inverse(frame_id + 1, 3) - 0.5F};
+}
+
+template <typename VB>
+inline void blas<VB>::add_triangle(const triangle<VB>& triangle) {
+    triangles.push_back(triangle);
+}
+
+template <typename VB>
+inline void blas<VB>::add_sphere(const sphere<VB>& sphere) {
+    spheres.push_back(sphere);
+}
+
+template <typename VB>
+inline void blas<VB>::add_quad(const quad<VB>& quad) {
+    quads.push_back(quad);
+}
+
+template <typename VB>
+inline void blas<VB>::add_emissive_triangle(const triangle<VB>& triangle) {
+    emissive_triangles.push_back(triangle);
 }
 
 template <typename VB>
-inline void aabb<VB>::add_triangle(const triangle<VB> triangle) {
-    // TODO Lab: 2.05 Implement `aabb` class
+inline void blas<VB>::clear() {
+    triangles.clear();
+    spheres.clear();
+    quads.clear();
+    emissive_triangles.clear();
+}
+
+template <typename VB>
+inline void blas<VB>::build(const bvh_build_settings& settings) {
+    std::vector<float3> primitive_min;
+    std::vector<float3> primitive_max;
+    get_primitive_bounds(primitive_min, primitive_max);
+    hierarchy.build(
+        primitive_min, primitive_max, settings, [this](const bvh_reference& reference, int axis, float position) {
+            return split_reference(reference, axis, position);
+        });
+}
+
+// Triangles are clipped exactly: vertices on each side and edge crossings bound the halves, which then stay
+// within the reference. Analytic primitives only get their box cut.
+template <typename VB>
+inline std::pair<bvh_reference, bvh_reference>
+blas<VB>::split_reference(const bvh_reference& reference, int axis, float position) const {
+    if (reference.primitive >= triangles.size())
+        return split_bounds(reference, axis, position);
+
+    static constexpr float kInfinity = std::numeric_limits<float>::infinity();
+    bvh_reference left{{kInfinity, kInfinity, kInfinity}, {-kInfinity, -kInfinity, -kInfinity}, reference.primitive};
+    bvh_reference right = left;
+    auto extend = [](bvh_reference& side, const float3& point) {
+        side.bounds_min = linalg::min(side.bounds_min, point);
+        side.bounds_max = linalg::max(side.bounds_max, point);
+    };
+
+    const triangle<VB>& triangle = triangles[reference.primitive];
+    std::array<float3, 3> vertices{triangle.a, triangle.b, triangle.c};
+    for (std::size_t i = 0; i < vertices.size(); ++i) {
+        const float3& from = vertices[i];
+        const float3& to = vertices[(i + 1) % vertices.size()];
+        if (from[axis] <= position)
+            extend(left, from);
+        if (from[axis] >= position)
+            extend(right, from);
+        if ((from[axis] < position && to[axis] > position) || (from[axis] > position && to[axis] < position)) {
+            float3 crossing = from + ((to - from) * ((position - from[axis]) / (to[axis] - from[axis])));
+            crossing[axis] = position;
+            extend(left, crossing);
+            extend(right, crossing);
+        }
+    }
+
+    for (bvh_reference* side : {&left, &right}) {
+        side->bounds_min = linalg::max(side->bounds_min, reference.bounds_min);
+        side->bounds_max = linalg::min(side->bounds_max, reference.bounds_max);
+    }
+    left.bounds_max[axis] = std::min(left.bounds_max[axis], position);
+    right.bounds_min[axis] = std::max(right.bounds_min[axis], position);
+    return {left, right};
+}
+
+template <typename VB>
+inline void blas<VB>::refit() {
+    std::vector<float3> primitive_min;
+    std::vector<float3> primitive_max;
+    get_primitive_bounds(primitive_min, primitive_max);
+    hierarchy.refit(primitive_min, primitive_max);
+}
+
+template <typename VB>
+inline void blas<VB>::get_primitive_bounds(std::vector<float3>& primitive_min,
+                                           std::vector<float3>& primitive_max) const {
+    std::size_t count = triangles.size() + spheres.size() + quads.size();
+    primitive_min.clear();
+    primitive_max.clear();
+    primitive_min.reserve(count);
+    primitive_max.reserve(count);
+
+    for (const triangle<VB>& triangle : triangles) {
+        primitive_min.push_back(linalg::min(triangle.a, linalg::min(triangle.b, triangle.c)));
+        primitive_max.push_back(linalg::max(triangle.a, linalg::max(triangle.b, triangle.c)));
+    }
+    for (const sphere<VB>& sphere : spheres) {
+        float3 radius{sphere.radius, sphere.radius, sphere.radius};
+        primitive_min.push_back(sphere.center - radius);
+        primitive_max.push_back(sphere.center + radius);
+    }
+    for (const quad<VB>& quad : quads) {
+        float3 opposite = quad.origin + quad.edge_u + quad.edge_v;
+        float3 corner_u = quad.origin + quad.edge_u;
+        float3 corner_v = quad.origin + quad.edge_v;
+        primitive_min.push_back(linalg::min(linalg::min(quad.origin, opposite), linalg::min(corner_u, corner_v)));
+        primitive_max.push_back(linalg::max(linalg::max(quad.origin, opposite), linalg::max(corner_u, corner_v)));
+    }
+}
+
+template <typename VB>
+inline const std::vector<triangle<VB>>& blas<VB>::get_triangles() const {
+    return triangles;
+}
+
+template <typename VB>
+inline const std::vector<sphere<VB>>& blas<VB>::get_spheres() const {
+    return spheres;
+}
+
+template <typename VB>
+inline const std::vector<quad<VB>>& blas<VB>::get_quads() const {
+    return quads;
+}
+
+template <typename VB>
+inline const std::vector<triangle<VB>>& blas<VB>::get_emissive_triangles() const {
+    return emissive_triangles;
+}
+
+template <typename VB>
+inline const bvh& blas<VB>::get_hierarchy() const {
+    return hierarchy;
+}
+
+template <typename VB>
+inline bool blas<VB>::empty() const {
+    return triangles.empty() && spheres.empty() && quads.empty();
+}
+
+template <typename VB>
+inline void blas<VB>::save(cg::utils::binary_writer& writer) const {
+    static_assert(std::is_trivially_copyable_v<triangle<VB>>);
+    writer.write_array(triangles);
+    writer.write_array(spheres);
+    writer.write_array(quads);
+    writer.write_array(emissive_triangles);
+    hierarchy.save(writer);
+}
+
+template <typename VB>
+inline void blas<VB>::load(cg::utils::binary_reader& reader) {
+    reader.read_array(triangles);
+    reader.read_array(spheres);
+    reader.read_array(quads);
+    reader.read_array(emissive_triangles);
+    hierarchy.load(reader);
+    if (hierarchy.get_stats().primitive_count != triangles.size() + spheres.size() + quads.size())
+        THROW_ERROR("BVH does not match its primitives");
+}
+
+template <typename VB>
+inline void tlas<VB>::clear() {
+    instances.clear();
+    hierarchy = {};
+}
+
+template <typename VB>
+inline std::size_t tlas<VB>::add_instance(std::shared_ptr<const blas<VB>> structure, const float4x4& transform) {
+    instances.push_back({std::move(structure), {}, {}, false});
+    set_transform(instances.size() - 1, transform);
+    return instances.size() - 1;
+}
+
+template <typename VB>
+inline void tlas<VB>::set_transform(std::size_t instance_index, const float4x4& transform) {
+    static const float4x4 kIdentity = linalg::identity;
+    instance<VB>& instance = instances[instance_index];
+    instance.object_to_world = transform;
+    instance.world_to_object = linalg::inverse(transform);
+    instance.is_identity = transform.x == kIdentity.x && transform.y == kIdentity.y && transform.z == kIdentity.z &&
+                           transform.w == kIdentity.w;
+}
+
+template <typename VB>
+inline void tlas<VB>::build() {
+    std::vector<float3> instance_min;
+    std::vector<float3> instance_max;
+    instance_min.reserve(instances.size());
+    instance_max.reserve(instances.size());
+
+    for (const instance<VB>& instance : instances) {
+        float3 bounds_min = instance.structure->get_hierarchy().get_bounds_min();
+        float3 bounds_max = instance.structure->get_hierarchy().get_bounds_max();
+        float3 world_min = transform_point(instance.object_to_world, bounds_min);
+        float3 world_max = world_min;
+        for (int corner = 1; corner < 8; ++corner) {
+            float3 point{(corner & 1) != 0 ? bounds_max.x : bounds_min.x,
+                         (corner & 2) != 0 ? bounds_max.y : bounds_min.y,
+                         (corner & 4) != 0 ? bounds_max.z : bounds_min.z};
+            point = transform_point(instance.object_to_world, point);
+            world_min = linalg::min(world_min, point);
+            world_max = linalg::max(world_max, point);
+        }
+        instance_min.push_back(world_min);
+        instance_max.push_back(world_max);
+    }
+    hierarchy.build(instance_min, instance_max);
 }
 
 template <typename VB>
-inline const std::vector<triangle<VB>>& aabb<VB>::get_triangles() const {
-    // TODO Lab: 2.05 Implement `aabb` class
+inline const std::vector<instance<VB>>& tlas<VB>::get_instances() const {
+    return instances;
 }
 
 template <typename VB>
-inline bool aabb<VB>::aabb_test(const ray& ray) const {
-    // TODO Lab: 2.05 Implement `aabb` class
+inline const bvh& tlas<VB>::get_hierarchy() const {
+    return hierarchy;
 }
 
 } // namespace cg::renderer
@@ -1,27 +1,350 @@
+#define _USE_MATH_DEFINES
 #include "raytracer_renderer.h"
 
+#include "utils/error_handler.h"
 #include "utils/resource_utils.h"
 #include "utils/timer.h"
 
+#include <linalg.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace {
+using namespace linalg::aliases;
+
+// Cosine-weighted direction around `normal`, so the Lambertian cosine and pdf cancel out
+float3 sample_cosine_hemisphere(const float3& normal) {
+    float r = std::sqrt(cg::renderer::get_random_float());
+    float phi = 2.F * M_PIf * cg::renderer::get_random_float();
+    float3 local{r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.F, 1.F - (r * r)))};
+
+    float3 helper = std::abs(normal.x) > 0.9F ? float3{0.F, 1.F, 0.F} : float3{1.F, 0.F, 0.F};
+    float3 tangent = linalg::normalize(linalg::cross(helper, normal));
+    float3 bitangent = linalg::cross(normal, tangent);
+    return (tangent * local.x) + (bitangent * local.y) + (normal * local.z);
+}
+
+struct surface_point {
+    float3 position;
+    float3 normal; // shading normal facing the incoming ray
+};
+
+surface_point get_surface_point(const cg::renderer::ray& ray,
+                                const cg::renderer::payload& payload,
+                                const cg::renderer::triangle<cg::vertex>& triangle) {
+    float3 normal = linalg::normalize((payload.bary.x * triangle.na) + (payload.bary.y * triangle.nb) +
+                                      (payload.bary.z * triangle.nc));
+    if (linalg::dot(normal, ray.direction) > 0.F)
+        normal = -normal;
+    return {ray.position + (ray.direction * payload.t), normal};
+}
+} // namespace
+
+cg::renderer::ray_tracing_renderer::ray_tracing_renderer(std::shared_ptr<cg::settings> settings)
+    : renderer{std::move(settings)} {}
 
 void cg::renderer::ray_tracing_renderer::init() {
-    // TODO Lab: 2.01 Add `render_target`, `camera`, and `raytracer` in `ray_tracing_renderer` class
-    // TODO Lab: 2.03 Add light information to `lights` array of `ray_tracing_renderer`
-    // TODO Lab: 2.04 Initialize `shadow_raytracer` in `ray_tracing_renderer`
+    render_target = std::make_shared<cg::resource<cg::unsigned_color>>(settings->width, settings->height);
+
+    raytracer = std::make_shared<cg::renderer::raytracer<cg::vertex, cg::unsigned_color>>();
+    raytracer->set_render_target(render_target);
+    raytracer->set_viewport(settings->width, settings->height);
+
+    renderer::load_camera();
+    // A streamed model arrives during `render`
+    if (!settings->stream_geometry) {
+        renderer::load_model();
+        set_geometry();
+    }
+    bvh_build_settings build_settings;
+    build_settings.spatial_splits = settings->spatial_splits;
+    build_settings.duplication_budget = settings->spatial_split_budget;
+    raytracer->set_build_settings(build_settings);
+
+    lights.push_back({float3{0.F, 1.58F, -0.03F}, float3{0.78F, 0.78F, 0.78F}});
+    raytracer->set_light_sampling(settings->light_sampling == "power" ? light_sampling_mode::power
+                                                                      : light_sampling_mode::tree);
+
+    shadow_raytracer = std::make_shared<cg::renderer::raytracer<cg::vertex, cg::unsigned_color>>();
+}
+
+void cg::renderer::ray_tracing_renderer::set_geometry() {
+    if (!model->get_packed_vertex_buffers().empty())
+        raytracer->set_packed_vertex_buffers(model->get_packed_vertex_buffers(), model->get_vertex_quantizations());
+    else if (!model->get_vertex_streams().empty())
+        raytracer->set_vertex_streams(model->get_vertex_streams());
+    else
+        raytracer->set_vertex_buffers(model->get_vertex_buffers());
+    raytracer->set_index_buffers(model->get_index_buffers());
+    place_instances();
+    raytracer->set_materials(model->get_materials());
+    raytracer->set_textures(shape_textures);
+    if (settings->analytic_primitives)
+        raytracer->set_shape_primitives(model->get_per_shape_primitives());
+}
+
+// The model's per-shape vectors are still being filled on other threads, so only the slots of arrived shapes are
+// copied out, into vectors of the full size with empty slots for the rest
+void cg::renderer::ray_tracing_renderer::add_streamed_shapes(const std::vector<std::size_t>& shape_indices) {
+    std::size_t shape_count = model->get_index_buffers().size();
+    streamed_vertex_buffers.resize(shape_count);
+    streamed_index_buffers.resize(shape_count);
+    streamed_primitives.resize(shape_count);
+    shape_textures.resize(shape_count);
+    for (std::size_t shape_i : shape_indices) {
+        streamed_vertex_buffers[shape_i] = model->get_vertex_buffers()[shape_i];
+        streamed_index_buffers[shape_i] = model->get_index_buffers()[shape_i];
+        streamed_primitives[shape_i] = model->get_per_shape_primitives()[shape_i];
+        shape_textures[shape_i] = peek_texture(shape_i);
+    }
+
+    raytracer->set_vertex_buffers(streamed_vertex_buffers);
+    raytracer->set_index_buffers(streamed_index_buffers);
+    place_instances();
+    raytracer->set_materials(model->get_materials());
+    raytracer->set_textures(shape_textures);
+    if (settings->analytic_primitives)
+        raytracer->set_shape_primitives(streamed_primitives);
+    raytracer->build_acceleration_structure(shape_indices);
+    // The lab point light stands in until an emissive shape arrives
+    raytracer->set_lights(get_scene_lights());
+}
+
+void cg::renderer::ray_tracing_renderer::place_instances() {
+    std::vector<instance_placement> instances;
+    for (const world::shape_instance& instance : scene->get_shape_instances(*model))
+        instances.push_back({instance.shape_index, instance.transform});
+    raytracer->set_instances(std::move(instances));
+}
+
+std::vector<cg::renderer::light> cg::renderer::ray_tracing_renderer::get_scene_lights() const {
+    if (scene->get_lights().empty())
+        return raytracer->has_emissive_surfaces() ? std::vector<light>{} : lights;
+    std::vector<light> result;
+    for (const world::scene_light& light : scene->get_lights())
+        result.push_back({light.position, light.color});
+    return result;
 }
 
-void cg::renderer::ray_tracing_renderer::destroy() {}
+void cg::renderer::ray_tracing_renderer::destroy() {
+    utils::save_resource(*render_target, settings->result_path);
+    print_texture_stats();
+}
 
 void cg::renderer::ray_tracing_renderer::update() {}
 
+void cg::renderer::ray_tracing_renderer::build_scene() {
+    {
+        utils::timer timer{"build acceleration structure"};
+        std::filesystem::path cache_file;
+        if (!settings->cache_path.empty()) {
+            std::ostringstream name;
+            name << "bvh_" << std::hex << raytracer->get_acceleration_structure_key() << ".bin";
+            cache_file = settings->cache_path / name.str();
+        }
+        if (cache_file.empty() || !raytracer->load_acceleration_structure(cache_file)) {
+            raytracer->build_acceleration_structure();
+            // A cache folder that can't be written leaves the structure just built in memory
+            try {
+                if (!cache_file.empty())
+                    raytracer->save_acceleration_structure(cache_file);
+            } catch (const std::exception& error) {
+                std::cout << "Can't cache " << cache_file.string() << ": " << utils::get_error_line(error);
+            }
+        }
+        shadow_raytracer->acceleration_structure = raytracer->acceleration_structure;
+    }
+    print_acceleration_structure_stats();
+    std::vector<light> scene_lights = get_scene_lights();
+    if (!scene_lights.empty()) {
+        utils::timer timer{"build light structures"};
+        raytracer->set_lights(std::move(scene_lights));
+    }
+}
+
+void cg::renderer::ray_tracing_renderer::print_acceleration_structure_stats() const {
+    bvh_build_stats stats = raytracer->get_acceleration_structure_stats();
+    float duplication = static_cast<float>(stats.reference_count) /
+                        static_cast<float>(std::max<std::size_t>(stats.primitive_count, 1));
+    std::cout << "Acceleration structure: " << stats.node_count << " nodes, " << duplication
+              << " references per primitive, " << stats.memory_bytes / 1024 << " KiB\n";
+}
+
 void cg::renderer::ray_tracing_renderer::render() {
-    // TODO Lab: 2.01 Implement `miss_shader`, image clearing, calling `ray_generation`, and saving in
-    // `ray_tracing_renderer` class
-    // TODO Lab: 2.02 Add `closest_hit_shader` to `raytracer` class to return diffuse color
-    // TODO Lab: 2.03 Adjust `closest_hit_shader` of `raytracer` to implement Lambertian shading model
-    // TODO Lab: 2.04 Define `any_hit_shader` and `miss_shader` for `shadow_raytracer`
-    // TODO Lab: 2.04 Adjust `closest_hit_shader` of `raytracer` to cast shadows rays and to ignore occluded lights
-    // TODO Lab: 2.05 Adjust `ray_tracing_renderer` class to build the acceleration structure
-    // TODO Lab: 2.06 (Bonus) Adjust `closest_hit_shader` for Monte-Carlo light tracing
+    raytracer->miss_shader = [](const ray& /*ray*/) {
+        payload payload{};
+        payload.color = {0.F, 0.F, 0.F};
+        return payload;
+    };
+
+    shadow_raytracer->miss_shader = [](const ray& /*ray*/) {
+        payload payload{};
+        payload.t = -1.F;
+        return payload;
+    };
+    shadow_raytracer->any_hit_shader =
+        [](const ray& /*ray*/, payload& payload, const triangle<cg::vertex>& /*triangle*/) { return payload; };
+
+    auto is_visible = [this](const float3& from, const float3& to) {
+        static constexpr float kShadowBias = 0.001F;
+        float3 to_target = to - from;
+        ray shadow_ray(from, to_target);
+        return shadow_raytracer->trace_ray(shadow_ray, 1, linalg::length(to_target) - kShadowBias).t < 0.F;
+    };
+
+    auto light_samples = static_cast<float>(settings->light_samples);
+    // Emission plus light sampling at a hit; emission found by bounces is already accounted for by light sampling
+    auto shade_surface = [&](const surface_point& surface,
+                             const triangle<cg::vertex>& triangle,
+                             const float3& albedo,
+                             bool is_primary) {
+        float3 result = is_primary ? raytracer->get_material(triangle).emissive : float3{0.F, 0.F, 0.F};
+
+        for (unsigned sample_i = 0; sample_i < settings->light_samples; ++sample_i) {
+            light_sample light = raytracer->sample_light(
+                surface.position, surface.normal, {get_random_float(), get_random_float(), get_random_float()});
+            if (light.pdf <= 0.F)
+                continue;
+
+            float3 to_light = light.position - surface.position;
+            float distance2 = linalg::length2(to_light);
+            float3 light_direction = to_light / std::sqrt(distance2);
+            float cos_surface = linalg::dot(surface.normal, light_direction);
+            if (cos_surface <= 0.F || !is_visible(surface.position, light.position))
+                continue;
+
+            if (light.is_point) {
+                result += albedo * light.emissive * cos_surface / (light.pdf * light_samples);
+            } else {
+                float cos_light = std::abs(linalg::dot(light.normal, light_direction));
+                result += albedo * M_1_PIf * light.emissive * cos_surface * cos_light /
+                          (distance2 * light.pdf * light_samples);
+            }
+        }
+        return result;
+    };
+
+    raytracer->set_russian_roulette_depth(settings->russian_roulette_depth);
+    if (settings->iterative_paths) {
+        raytracer->closest_hit_shader = nullptr;
+        raytracer->scatter_shader = [&](const ray& ray,
+                                        payload& payload,
+                                        const triangle<cg::vertex>& triangle,
+                                        std::size_t bounce,
+                                        cg::renderer::ray& next) {
+            surface_point surface = get_surface_point(ray, payload, triangle);
+            float3 albedo = raytracer->get_albedo(ray, payload, triangle);
+            payload.color = cg::color::from_float3(shade_surface(surface, triangle, albedo, bounce == 0));
+            next = cg::renderer::ray(surface.position, sample_cosine_hemisphere(surface.normal), albedo);
+            next.cone_width = ray.get_cone_width(payload.t);
+            next.cone_spread = ray.cone_spread;
+            return true;
+        };
+    } else {
+        raytracer->scatter_shader = nullptr;
+        raytracer->closest_hit_shader =
+            [&](const ray& ray, payload& payload, const triangle<cg::vertex>& triangle, std::size_t depth) {
+                surface_point surface = get_surface_point(ray, payload, triangle);
+                float3 albedo = raytracer->get_albedo(ray, payload, triangle);
+                float3 result = shade_surface(surface, triangle, albedo, depth + 1 == settings->raytracing_depth);
+
+                if (depth > 0) {
+                    float3 throughput = ray.throughput * albedo;
+                    float survival =
+                        raytracer->get_survival_probability(throughput, settings->raytracing_depth - depth);
+                    if (get_random_float() < survival) {
+                        cg::renderer::ray bounce(
+                            surface.position, sample_cosine_hemisphere(surface.normal), throughput / survival);
+                        // Bounces keep the cone as it was at the hit; diffuse reflection would only widen it
+                        bounce.cone_width = ray.get_cone_width(payload.t);
+                        bounce.cone_spread = ray.cone_spread;
+                        cg::renderer::payload bounce_payload = raytracer->trace_ray(bounce, depth);
+                        result += albedo * bounce_payload.color.to_float3() / survival;
+                    }
+                }
+
+                payload.color = cg::color::from_float3(result);
+                return payload;
+            };
+    }
+
+    float half_view = std::tan(settings->camera_angle_of_view * M_PIf / 360.F);
+    auto trace = [&](std::size_t accumulation_num) {
+        raytracer->ray_generation(camera->get_position(),
+                                  camera->get_direction(),
+                                  linalg::normalize(camera->get_right()) * half_view,
+                                  linalg::normalize(camera->get_up()) * half_view,
+                                  settings->raytracing_depth,
+                                  accumulation_num);
+    };
+
+    if (settings->stream_geometry) {
+        shadow_raytracer->acceleration_structure = raytracer->acceleration_structure;
+        auto first_preview = std::make_unique<utils::timer>("first preview");
+        renderer::stream_model([&](const std::vector<std::size_t>& shape_indices) {
+            add_streamed_shapes(shape_indices);
+            // A single sample per pixel, so previews keep up with the loading
+            raytracer->clear_render_target({0, 0, 0});
+            trace(1);
+            first_preview.reset();
+            utils::save_resource(*render_target, settings->result_path);
+        });
+        // Swaps in the complete model's buffers and textures; the bottom levels were built from the same shapes
+        set_geometry();
+        print_acceleration_structure_stats();
+    } else
+        build_scene();
+
+    raytracer->clear_render_target({0, 0, 0});
+    {
+        utils::timer timer{"ray generation"};
+        trace(settings->accumulation_num);
+    }
+    if (settings->animation_path.empty())
+        return;
+
+    std::vector<std::filesystem::path> frames;
+    for (const auto& entry : std::filesystem::directory_iterator(settings->animation_path)) {
+        if (entry.path().extension() == ".obj")
+            frames.push_back(entry.path());
+    }
+    std::sort(frames.begin(), frames.end());
+    for (std::size_t frame_i = 0; frame_i < frames.size(); ++frame_i) {
+        load_frame_vertices(frames[frame_i]);
+        {
+            utils::timer timer{"refit acceleration structure"};
+            std::size_t rebuilt = raytracer->refit_acceleration_structure();
+            std::cout << "Frame " << frame_i << ": " << rebuilt << " bottom levels rebuilt\n";
+        }
+        raytracer->clear_render_target({0, 0, 0});
+        trace(settings->accumulation_num);
+
+        std::filesystem::path frame_path = settings->result_path;
+        frame_path.replace_filename(settings->result_path.stem().string() + "_" + std::to_string(frame_i) +
+                                    settings->result_path.extension().string());
+        utils::save_resource(*render_target, frame_path);
+    }
+}
+
+void cg::renderer::ray_tracing_renderer::load_frame_vertices(const std::filesystem::path& frame_path) {
+    world::model frame;
+    frame.load(frame_path, settings->mesh_cache, settings->optimize_meshes);
+    const auto& index_buffers = model->get_index_buffers();
+    bool is_matching = frame.get_index_buffers().size() == index_buffers.size();
+    for (std::size_t shape_i = 0; is_matching && shape_i < index_buffers.size(); ++shape_i)
+        is_matching = frame.get_index_buffers()[shape_i]->count() == index_buffers[shape_i]->count();
+    if (!is_matching)
+        THROW_ERROR("Frame " + frame_path.string() + " doesn't have the shapes and triangles of the model");
+
+    raytracer->set_vertex_buffers(frame.get_vertex_buffers());
+    raytracer->set_index_buffers(frame.get_index_buffers());
 }
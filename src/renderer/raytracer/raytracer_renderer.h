@@ -2,21 +2,49 @@
 #include "renderer/renderer.h"
 #include "resource.h"
 
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
 namespace cg::renderer {
 class ray_tracing_renderer : public renderer {
   public:
-    virtual void init();
-    virtual void destroy();
+    explicit ray_tracing_renderer(std::shared_ptr<cg::settings> settings);
+
+    void init() override;
+    void destroy() override;
 
-    virtual void update();
-    virtual void render();
+    void update() override;
+    void render() override;
 
   protected:
+    // NOLINTBEGIN(*-non-private-*)
     std::shared_ptr<cg::resource<cg::unsigned_color>> render_target;
 
     std::shared_ptr<cg::renderer::raytracer<cg::vertex, cg::unsigned_color>> raytracer;
     std::shared_ptr<cg::renderer::raytracer<cg::vertex, cg::unsigned_color>> shadow_raytracer;
 
+    // Lab point light, for models that bring no lights of their own
     std::vector<cg::renderer::light> lights;
+
+    // Shapes that arrived so far while streaming, at their model index
+    std::vector<std::shared_ptr<cg::resource<cg::vertex>>> streamed_vertex_buffers;
+    std::vector<std::shared_ptr<cg::resource<std::size_t>>> streamed_index_buffers;
+    std::vector<cg::world::shape_primitive> streamed_primitives;
+    // NOLINTEND(*-non-private-*)
+
+    void set_geometry();
+    void add_streamed_shapes(const std::vector<std::size_t>& shape_indices);
+    // One instance per shape of every scene instance
+    void place_instances();
+    // The scene's lights; without any, the lab point light stands in unless the model has emissive geometry
+    [[nodiscard]] std::vector<cg::renderer::light> get_scene_lights() const;
+    // Bottom levels from the cache when it has them, then the top level and lights
+    void build_scene();
+    void print_acceleration_structure_stats() const;
+    // Hands the raytracer the vertices of one animation frame, which must hold the model's shapes with the same
+    // triangle counts
+    void load_frame_vertices(const std::filesystem::path& frame_path);
 };
 } // namespace cg::renderer
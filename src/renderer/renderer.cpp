@@ -1,10 +1,20 @@
 #include "renderer.h"
 
 #include "settings.h"
+#include "utils/error_handler.h"
+#include "utils/timer.h"
 #include "world/camera.h"
 #include "world/model.h"
+#include "world/tile_cache.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <future>
+#include <iostream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <utility>
 
 #ifdef RASTERIZATION
@@ -70,9 +80,147 @@ void cg::renderer::renderer::move_pitch(float delta) {
     camera->set_phi(camera->get_phi() + delta);
 }
 
-void cg::renderer::renderer::load_model() {
+void cg::renderer::renderer::create_model() {
     model = std::make_shared<world::model>();
-    model->load_obj(settings->model_path);
+    scene = std::make_shared<world::scene>();
+    if (settings->load_textures) {
+        if (!textures) {
+            static constexpr float kMebibyte = 1024.F * 1024.F;
+            if (settings->texture_budget > 0.F) {
+                texture_tiles =
+                    std::make_shared<world::tile_cache>(static_cast<std::size_t>(settings->texture_budget * kMebibyte));
+            }
+            textures = std::make_shared<world::texture_cache>(settings->texture_containers, texture_tiles);
+        }
+        model->set_texture_cache(textures);
+    }
+}
+
+void cg::renderer::renderer::load_model() {
+    create_model();
+    scene->load(settings->model_path,
+                *model,
+                settings->mesh_cache,
+                settings->optimize_meshes,
+                settings->merge_shapes);
+    finish_model();
+}
+
+void cg::renderer::renderer::stream_model(const std::function<void(const std::vector<std::size_t>&)>& on_shapes) {
+    create_model();
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::vector<std::size_t> ready;
+    bool loaded = false;
+    model->set_shape_callback([&](std::size_t shape_i) {
+        {
+            std::lock_guard lock(mutex);
+            ready.push_back(shape_i);
+        }
+        arrived.notify_one();
+    });
+    auto finish = [&] {
+        {
+            std::lock_guard lock(mutex);
+            loaded = true;
+        }
+        arrived.notify_one();
+    };
+    std::future<void> loading = std::async(std::launch::async, [&] {
+        try {
+            scene->load(settings->model_path,
+                        *model,
+                        settings->mesh_cache,
+                        settings->optimize_meshes,
+                        settings->merge_shapes);
+        } catch (...) {
+            finish();
+            throw;
+        }
+        finish();
+    });
+
+    // Shapes that arrive while a batch is handled make up the next one, so slow batches mean fewer of them
+    std::vector<std::size_t> batch;
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            arrived.wait(lock, [&] { return loaded || !ready.empty(); });
+            if (ready.empty())
+                break;
+            batch.swap(ready);
+        }
+        on_shapes(batch);
+        batch.clear();
+    }
+    loading.get();
+    model->set_shape_callback(nullptr);
+    finish_model();
+}
+
+std::shared_ptr<const cg::world::texture> cg::renderer::renderer::peek_texture(std::size_t shape_i) const {
+    if (!textures)
+        return nullptr;
+    const std::filesystem::path& file = model->get_per_shape_texture_files()[shape_i];
+    if (file.empty())
+        return nullptr;
+    // Requests for files the parse already asked for return the same decode
+    world::texture_future texture = textures->request(file);
+    if (texture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return nullptr;
+    try {
+        return texture.get();
+    } catch (const std::runtime_error&) {
+        return nullptr;
+    }
+}
+
+void cg::renderer::renderer::finish_model() {
+    if (settings->merge_shapes) {
+        std::cout << "Merged shapes: " << model->get_shape_ranges().size() << " -> "
+                  << model->get_index_buffers().size() << "\n";
+    }
+    if (settings->quantize_vertices) {
+        world::quantization_stats stats = model->quantize_vertices();
+        std::cout << "Quantized vertices: " << stats.full_bytes << " -> " << stats.packed_bytes
+                  << " bytes, max error: position " << stats.max_position_error << " of the shape extent, normal "
+                  << stats.max_normal_error << " deg, texcoord " << stats.max_texcoord_error << "\n";
+    }
+    if (settings->vertex_streams)
+        model->split_vertex_streams();
+
+    shape_textures.assign(model->get_index_buffers().size(), nullptr);
+    if (!settings->load_textures)
+        return;
+    // Decoding started with the parse, so this waits about as long as the slowest texture still takes
+    utils::timer timer{"texture wait"};
+    for (std::size_t shape_i = 0; shape_i < shape_textures.size(); ++shape_i) {
+        const world::texture_future& texture = model->get_per_shape_textures()[shape_i];
+        if (!texture.valid())
+            continue;
+        try {
+            shape_textures[shape_i] = texture.get();
+        } catch (const std::runtime_error& error) {
+            std::cout << "Ignoring texture: " << utils::get_error_line(error);
+        }
+    }
+}
+
+void cg::renderer::renderer::print_texture_stats() const {
+    if (!texture_tiles)
+        return;
+    std::cout << "Texture tiles: " << texture_tiles->get_resident_bytes() << " of "
+              << texture_tiles->get_budget_bytes() << " budgeted bytes resident\n";
+    for (const world::tile_cache::texture_stats& stats : texture_tiles->get_stats()) {
+        if (stats.mapped) {
+            std::cout << "  " << stats.name << ": " << stats.tile_count << " tiles, mapped from its container\n";
+            continue;
+        }
+        std::size_t lookups = stats.hits + stats.misses;
+        double hit_rate = lookups > 0 ? 100.0 * static_cast<double>(stats.hits) / static_cast<double>(lookups) : 0.0;
+        std::cout << "  " << stats.name << ": " << stats.tile_count << " tiles, " << stats.hits << " hits, "
+                  << stats.misses << " misses (" << hit_rate << "% hit rate)\n";
+    }
 }
 
 void cg::renderer::renderer::load_camera() {
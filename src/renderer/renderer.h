@@ -3,6 +3,12 @@
 #include "settings.h"
 #include "world/camera.h"
 #include "world/model.h"
+#include "world/scene.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
 
 namespace cg::renderer {
 
@@ -29,7 +35,13 @@ class renderer { // NOLINT(*special-member*)
     void move_pitch(float delta = 0.F);
 
     void load_model();
+    // Loads the model on a background thread, calling `on_shapes` on this one with batches of shapes as they are
+    // converted, and returns once all of them are handled and the model is complete. Shapes of a batch may be read
+    // through `model` already; textures may still be decoding. Scene files deliver all their shapes in one batch.
+    void stream_model(const std::function<void(const std::vector<std::size_t>& shape_indices)>& on_shapes);
     void load_camera();
+    // Per-texture hit rates of the tile cache, when textures are paged
+    void print_texture_stats() const;
 
   protected:
     // NOLINTBEGIN(*-non-private-*)
@@ -37,11 +49,27 @@ class renderer { // NOLINT(*special-member*)
 
     std::shared_ptr<cg::world::camera> camera;
     std::shared_ptr<cg::world::model> model;
+    // Instances and lights of `model` when it was loaded from a scene file
+    std::shared_ptr<cg::world::scene> scene;
+    // Shared by every model loaded, when textures are enabled
+    std::shared_ptr<cg::world::texture_cache> textures;
+    // Where `textures` pages decoded textures to, when they have a memory budget
+    std::shared_ptr<cg::world::tile_cache> texture_tiles;
+    // Per shape of `model`; null without a texture or when it failed to decode
+    std::vector<std::shared_ptr<const cg::world::texture>> shape_textures;
 
     std::chrono::time_point<std::chrono::high_resolution_clock> current_time =
         std::chrono::high_resolution_clock::now();
     float frame_duration = 0.F;
     // NOLINTEND(*-non-private-*)
+
+    // The texture of a streamed shape if it is decoded already, so previews don't wait for the rest
+    [[nodiscard]] std::shared_ptr<const cg::world::texture> peek_texture(std::size_t shape_i) const;
+
+  private:
+    void create_model();
+    // Vertex layout changes and texture waits, once every shape is in
+    void finish_model();
 };
 
 std::shared_ptr<renderer> make_renderer(std::shared_ptr<cg::settings> settings);
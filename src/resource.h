@@ -2,6 +2,13 @@
 
 #include <linalg.h>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
 #include <vector>
 
 namespace cg {
@@ -14,6 +21,10 @@ class resource {
 
     explicit resource(std::size_t size);
     resource(std::size_t x_size, std::size_t y_size);
+    // Takes over storage that was filled incrementally
+    explicit resource(std::vector<T> in_data);
+    // Views items stored elsewhere, such as a mapped file, which `in_owner` keeps alive
+    resource(T* in_items, std::size_t in_count, std::shared_ptr<void> in_owner);
 
     T* get_data();
     const T* get_data() const;
@@ -30,6 +41,10 @@ class resource {
   private:
     std::vector<T> data;
     std::size_t stride;
+    // Used instead of `data` by viewing resources
+    T* external_items = nullptr;
+    std::size_t external_count = 0;
+    std::shared_ptr<void> external_owner;
 };
 
 struct color {
@@ -51,15 +66,64 @@ struct unsigned_color {
     [[nodiscard]] float3 to_float3() const;
 };
 
+struct material {
+    float3 ambient;
+    float3 diffuse;
+    float3 emissive;
+};
+
+// All three vertices of a triangle carry its material
 struct vertex {
     float3 v;
     float3 n;
     float2 tex;
-    float3 ambient;
-    float3 diffuse;
-    float3 emissive;
+    std::uint32_t material; // into the model's material table
+};
+
+// 16-byte form of `vertex`: positions in 16-bit steps across the shape's bounds, octahedral normals in two
+// snorm16 values, half-float texcoords and a 16-bit material index
+struct packed_vertex {
+    std::array<std::uint16_t, 3> v;
+    std::array<std::int16_t, 2> n;
+    std::array<std::uint16_t, 2> tex;
+    std::uint16_t material;
 };
 
+// Per-shape mapping between `vertex` and `packed_vertex`
+struct vertex_quantization {
+    float3 origin;
+    float3 step; // bounds extent over 65535 on each axis
+
+    static vertex_quantization from_bounds(const float3& bounds_min, const float3& bounds_max);
+    [[nodiscard]] packed_vertex encode(const vertex& vertex) const;
+    [[nodiscard]] vertex decode(const packed_vertex& packed) const;
+};
+
+// Members of `vertex` a pass reads besides its position
+struct vertex_attributes {
+    bool normal = true;
+    bool texcoord = true;
+    bool material = true;
+};
+
+// `vertex` split into one array per member, so a pass reads only the members it uses, each from contiguous memory
+struct vertex_streams {
+    std::shared_ptr<resource<float3>> positions;
+    std::shared_ptr<resource<float3>> normals;
+    std::shared_ptr<resource<float2>> texcoords;
+    std::shared_ptr<resource<std::uint32_t>> materials;
+
+    static vertex_streams from_vertices(const resource<vertex>& vertices);
+    [[nodiscard]] std::size_t count() const;
+    // Members left out of `attributes` stay zeroed
+    [[nodiscard]] vertex gather(std::size_t index, const vertex_attributes& attributes) const;
+};
+
+std::uint16_t float_to_half(float value);
+float half_to_float(std::uint16_t half);
+float2 encode_octahedral(const float3& normal);
+float3 decode_octahedral(const float2& encoded);
+
 } // namespace cg
 
 namespace cg {
@@ -69,39 +133,46 @@ inline resource<T>::resource(std::size_t size) : data(size), stride{0} {}
 template <typename T>
 inline resource<T>::resource(std::size_t x_size, std::size_t y_size) : data(x_size * y_size), stride{x_size} {}
 
+template <typename T>
+inline resource<T>::resource(std::vector<T> in_data) : data(std::move(in_data)), stride{0} {}
+
+template <typename T>
+inline resource<T>::resource(T* in_items, std::size_t in_count, std::shared_ptr<void> in_owner)
+    : stride{0}, external_items(in_items), external_count(in_count), external_owner(std::move(in_owner)) {}
+
 template <typename T>
 inline T* resource<T>::get_data() {
-    return data.data();
+    return external_items != nullptr ? external_items : data.data();
 }
 
 template <typename T>
 inline const T* resource<T>::get_data() const {
-    return data.data();
+    return external_items != nullptr ? external_items : data.data();
 }
 
 template <typename T>
 inline T& resource<T>::item(std::size_t item) {
-    return data[item];
+    return get_data()[item];
 }
 
 template <typename T>
 inline const T& resource<T>::item(std::size_t item) const {
-    return data[item];
+    return get_data()[item];
 }
 
 template <typename T>
 inline T& resource<T>::item(std::size_t x, std::size_t y) {
-    return data[x + (stride * y)];
+    return get_data()[x + (stride * y)];
 }
 
 template <typename T>
 inline const T& resource<T>::item(std::size_t x, std::size_t y) const {
-    return data[x + (stride * y)];
+    return get_data()[x + (stride * y)];
 }
 
 template <typename T>
 inline std::size_t resource<T>::count() const {
-    return data.size();
+    return external_items != nullptr ? external_count : data.size();
 }
 
 template <typename T>
@@ -146,5 +217,138 @@ inline float3 unsigned_color::to_float3() const {
         static_cast<float>(b) / kMax,
         static_cast<float>(g) / kMax,
     };
-};
+}
+
+inline vertex_quantization vertex_quantization::from_bounds(const float3& bounds_min, const float3& bounds_max) {
+    static constexpr float kSteps = 65535.F;
+    return {bounds_min, (bounds_max - bounds_min) / kSteps};
+}
+
+inline packed_vertex vertex_quantization::encode(const vertex& vertex) const {
+    static constexpr float kSteps = 65535.F;
+    static constexpr float kSnormMax = 32767.F;
+
+    packed_vertex packed{};
+    for (std::size_t axis = 0; axis < 3; ++axis) {
+        float position = step[axis] > 0.F ? (vertex.v[axis] - origin[axis]) / step[axis] : 0.F;
+        packed.v[axis] = static_cast<std::uint16_t>(std::lround(std::clamp(position, 0.F, kSteps)));
+    }
+    float2 normal = encode_octahedral(vertex.n);
+    for (std::size_t axis = 0; axis < 2; ++axis) {
+        packed.n[axis] = static_cast<std::int16_t>(std::lround(std::clamp(normal[axis], -1.F, 1.F) * kSnormMax));
+        packed.tex[axis] = float_to_half(vertex.tex[axis]);
+    }
+    packed.material = static_cast<std::uint16_t>(vertex.material);
+    return packed;
+}
+
+inline vertex vertex_quantization::decode(const packed_vertex& packed) const {
+    static constexpr float kSnormMax = 32767.F;
+    float3 steps{static_cast<float>(packed.v[0]), static_cast<float>(packed.v[1]), static_cast<float>(packed.v[2])};
+    float2 normal{static_cast<float>(packed.n[0]), static_cast<float>(packed.n[1])};
+    return {
+        origin + step * steps,
+        decode_octahedral(normal / kSnormMax),
+        {half_to_float(packed.tex[0]), half_to_float(packed.tex[1])},
+        packed.material,
+    };
+}
+
+inline vertex_streams vertex_streams::from_vertices(const resource<vertex>& vertices) {
+    std::size_t count = vertices.count();
+    vertex_streams streams{
+        std::make_shared<resource<float3>>(count),
+        std::make_shared<resource<float3>>(count),
+        std::make_shared<resource<float2>>(count),
+        std::make_shared<resource<std::uint32_t>>(count),
+    };
+    for (std::size_t vertex_i = 0; vertex_i < count; ++vertex_i) {
+        const vertex& source = vertices.item(vertex_i);
+        streams.positions->item(vertex_i) = source.v;
+        streams.normals->item(vertex_i) = source.n;
+        streams.texcoords->item(vertex_i) = source.tex;
+        streams.materials->item(vertex_i) = source.material;
+    }
+    return streams;
+}
+
+inline std::size_t vertex_streams::count() const {
+    return positions->count();
+}
+
+inline vertex vertex_streams::gather(std::size_t index, const vertex_attributes& attributes) const {
+    vertex result{};
+    result.v = positions->item(index);
+    if (attributes.normal)
+        result.n = normals->item(index);
+    if (attributes.texcoord)
+        result.tex = texcoords->item(index);
+    if (attributes.material)
+        result.material = materials->item(index);
+    return result;
+}
+
+// Rounds to nearest; values past the half range become infinities and tiny ones flush to zero
+inline std::uint16_t float_to_half(float value) {
+    std::uint32_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    std::uint32_t sign = (bits >> 16U) & 0x8000U;
+    std::uint32_t exponent = (bits >> 23U) & 0xFFU;
+    std::uint32_t mantissa = bits & 0x7FFFFFU;
+
+    if (exponent == 0xFFU)
+        return static_cast<std::uint16_t>(sign | 0x7C00U | (mantissa != 0 ? 0x200U : 0U));
+    int half_exponent = static_cast<int>(exponent) - 127 + 15;
+    if (half_exponent >= 31)
+        return static_cast<std::uint16_t>(sign | 0x7C00U);
+    if (half_exponent <= 0) {
+        if (half_exponent < -10)
+            return static_cast<std::uint16_t>(sign);
+        mantissa |= 0x800000U;
+        auto shift = static_cast<std::uint32_t>(14 - half_exponent);
+        std::uint32_t half_mantissa = (mantissa >> shift) + ((mantissa >> (shift - 1)) & 1U);
+        return static_cast<std::uint16_t>(sign | half_mantissa);
+    }
+    // A carry out of the mantissa correctly bumps the exponent
+    std::uint32_t half = sign | (static_cast<std::uint32_t>(half_exponent) << 10U) | (mantissa >> 13U);
+    return static_cast<std::uint16_t>(half + ((mantissa >> 12U) & 1U));
+}
+
+inline float half_to_float(std::uint16_t half) {
+    std::uint32_t sign = (half & 0x8000U) << 16U;
+    std::uint32_t exponent = (half >> 10U) & 0x1FU;
+    std::uint32_t mantissa = half & 0x3FFU;
+
+    if (exponent == 0) {
+        float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign != 0 ? -value : value;
+    }
+    std::uint32_t bits = sign | (mantissa << 13U);
+    bits |= exponent == 0x1FU ? 0x7F800000U : (exponent + 112U) << 23U;
+    float value = 0.F;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Projects the unit sphere onto an octahedron unfolded into [-1, 1]^2
+inline float2 encode_octahedral(const float3& normal) {
+    float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (length == 0.F)
+        return {0.F, 0.F};
+    float3 projected = normal / length;
+    if (projected.z >= 0.F)
+        return {projected.x, projected.y};
+    return {
+        (1.F - std::abs(projected.y)) * (projected.x >= 0.F ? 1.F : -1.F),
+        (1.F - std::abs(projected.x)) * (projected.y >= 0.F ? 1.F : -1.F),
+    };
+}
+
+inline float3 decode_octahedral(const float2& encoded) {
+    float3 normal{encoded.x, encoded.y, 1.F - std::abs(encoded.x) - std::abs(encoded.y)};
+    float fold = std::max(-normal.z, 0.F);
+    normal.x += normal.x >= 0.F ? -fold : fold;
+    normal.y += normal.y >= 0.F ? -fold : fold;
+    return linalg::normalize(normal);
+}
 } // namespace cg
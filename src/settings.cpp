@@ -14,8 +14,9 @@ std::shared_ptr<settings> cg::settings::parse_settings(int argc, char** argv) {
     auto add_options = options.add_options();
     add_options("height", "Render target height", cxxopts::value<unsigned>()->default_value("1080"));
     add_options("width", "Render target width", cxxopts::value<unsigned>()->default_value("1920"));
-    add_options(
-        "model_path", "Path to OBJ model", cxxopts::value<std::filesystem::path>()->default_value("models/z_test.obj"));
+    add_options("model_path",
+                "Path to an OBJ or binary glTF model, or to a JSON scene file",
+                cxxopts::value<std::filesystem::path>()->default_value("models/z_test.obj"));
     add_options(
         "camera_position", "Camera position", cxxopts::value<std::vector<float>>()->default_value("0.0,1.0,5.0"));
     add_options("camera_theta", "Camera polar angle", cxxopts::value<float>()->default_value("0.0"));
@@ -27,6 +28,60 @@ std::shared_ptr<settings> cg::settings::parse_settings(int argc, char** argv) {
         "result_path", "Path to resulted image", cxxopts::value<std::filesystem::path>()->default_value("result.png"));
     add_options("raytracing_depth", "Maximum number of traces rays", cxxopts::value<unsigned>()->default_value("1"));
     add_options("accumulation_num", "Number of accumulated frames", cxxopts::value<unsigned>()->default_value("1"));
+    add_options("analytic_primitives",
+                "Trace shapes recognized as spheres or quads analytically",
+                cxxopts::value<bool>()->default_value("true"));
+    add_options("russian_roulette_depth",
+                "Bounce from which Russian roulette may terminate paths",
+                cxxopts::value<unsigned>()->default_value("3"));
+    add_options("iterative_paths",
+                "Trace paths in a loop instead of recursion",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("light_samples", "Number of light samples per hit", cxxopts::value<unsigned>()->default_value("1"));
+    add_options("light_sampling",
+                "Light selection strategy: `tree` (light BVH) or `power`",
+                cxxopts::value<std::string>()->default_value("tree"));
+    add_options("spatial_splits",
+                "Let the BVH builder split long primitives spatially (SBVH)",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("spatial_split_budget",
+                "Extra BVH references spatial splits may add, as a fraction of the primitive count",
+                cxxopts::value<float>()->default_value("0.3"));
+    add_options("cache_path",
+                "Folder for cached acceleration structures; empty disables caching",
+                cxxopts::value<std::filesystem::path>()->default_value("cache"));
+    add_options("mesh_cache",
+                "Keep a binary copy of the model next to it for faster loading",
+                cxxopts::value<bool>()->default_value("true"));
+    add_options("optimize_meshes",
+                "Reorder triangles and vertices at load time for vertex cache reuse and less overdraw",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("merge_shapes",
+                "Merge shapes that share a material and texture, for fewer draws and acceleration structures",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("load_textures",
+                "Decode the model's textures on background threads while the geometry loads",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("texture_containers",
+                "Keep each decoded texture's mip chain next to it for faster loading",
+                cxxopts::value<bool>()->default_value("true"));
+    add_options("texture_budget",
+                "MiB of texture tiles kept in memory, paging the rest from disk; 0 keeps whole textures in memory",
+                cxxopts::value<float>()->default_value("0"));
+    add_options("quantize_vertices",
+                "Store vertices as 16-bit positions, octahedral normals and half-float texture coordinates",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("vertex_streams",
+                "Store vertices as separate position, normal, texture coordinate and material arrays",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("stream_geometry",
+                "Render previews from the shapes loaded so far while the rest of the model loads",
+                cxxopts::value<bool>()->default_value("false"));
+    add_options("animation_path",
+                "Folder of OBJ frames moving the model's vertices, traced in name order after refitting the "
+                "acceleration structure and saved next to the result with their number appended; the result "
+                "keeps the last one",
+                cxxopts::value<std::filesystem::path>()->default_value(""));
     add_options("shader_path",
                 "Path to a shader file",
                 cxxopts::value<std::filesystem::path>()->default_value("shaders/shaders.hlsl"));
@@ -50,7 +105,45 @@ std::shared_ptr<settings> cg::settings::parse_settings(int argc, char** argv) {
     settings->result_path = result["result_path"].as<std::filesystem::path>();
     settings->raytracing_depth = result["raytracing_depth"].as<unsigned>();
     settings->accumulation_num = result["accumulation_num"].as<unsigned>();
+    settings->analytic_primitives = result["analytic_primitives"].as<bool>();
+    settings->russian_roulette_depth = result["russian_roulette_depth"].as<unsigned>();
+    settings->iterative_paths = result["iterative_paths"].as<bool>();
+    settings->light_samples = result["light_samples"].as<unsigned>();
+    settings->light_sampling = result["light_sampling"].as<std::string>();
+    settings->spatial_splits = result["spatial_splits"].as<bool>();
+    settings->spatial_split_budget = result["spatial_split_budget"].as<float>();
+    settings->cache_path = result["cache_path"].as<std::filesystem::path>();
+    settings->mesh_cache = result["mesh_cache"].as<bool>();
+    settings->optimize_meshes = result["optimize_meshes"].as<bool>();
+    settings->merge_shapes = result["merge_shapes"].as<bool>();
+    settings->load_textures = result["load_textures"].as<bool>();
+    settings->texture_containers = result["texture_containers"].as<bool>();
+    settings->texture_budget = result["texture_budget"].as<float>();
+    settings->quantize_vertices = result["quantize_vertices"].as<bool>();
+    settings->vertex_streams = result["vertex_streams"].as<bool>();
+    settings->stream_geometry = result["stream_geometry"].as<bool>();
+    settings->animation_path = result["animation_path"].as<std::filesystem::path>();
     settings->shader_path = result["shader_path"].as<std::filesystem::path>();
 
+    if (settings->light_sampling != "tree" && settings->light_sampling != "power") {
+        THROW_ERROR("Unknown light sampling strategy: " + settings->light_sampling);
+    }
+    if (settings->texture_budget < 0.F) {
+        THROW_ERROR("Texture budget can't be negative");
+    }
+    if (settings->quantize_vertices && settings->vertex_streams) {
+        THROW_ERROR("Vertices can't be both quantized and split into streams");
+    }
+    if (settings->stream_geometry && (settings->quantize_vertices || settings->vertex_streams)) {
+        THROW_ERROR("Streamed geometry keeps full interleaved vertices");
+    }
+    if (settings->stream_geometry && settings->merge_shapes) {
+        THROW_ERROR("Streamed shapes are drawn before they could be merged");
+    }
+    if (!settings->animation_path.empty() &&
+        (settings->quantize_vertices || settings->vertex_streams || settings->merge_shapes)) {
+        THROW_ERROR("Animation frames replace the full vertices of the shapes as loaded");
+    }
+
     return settings;
 }
@@ -2,6 +2,7 @@
 
 #include <filesystem>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace cg {
@@ -24,6 +25,24 @@ struct settings {
 
     unsigned raytracing_depth;
     unsigned accumulation_num;
+    bool analytic_primitives;
+    unsigned russian_roulette_depth;
+    bool iterative_paths;
+    unsigned light_samples;
+    std::string light_sampling;
+    bool spatial_splits;
+    float spatial_split_budget;
+    std::filesystem::path cache_path;
+    bool mesh_cache;
+    bool optimize_meshes;
+    bool merge_shapes;
+    bool load_textures;
+    bool texture_containers;
+    float texture_budget;
+    bool quantize_vertices;
+    bool vertex_streams;
+    bool stream_geometry;
+    std::filesystem::path animation_path;
 
     std::filesystem::path shader_path;
 };
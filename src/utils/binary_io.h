@@ -0,0 +1,174 @@
+#pragma once
+
+#include "utils/error_handler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace cg::utils {
+
+constexpr std::uint64_t kMissingSource = ~0ULL;
+
+// Size and modification time of a file a cache was built from; a missing file gets a stamp no file matches
+struct source_stamp {
+    std::uint64_t size = kMissingSource;
+    std::int64_t modified = 0;
+
+    bool operator==(const source_stamp& other) const {
+        return size == other.size && modified == other.modified;
+    }
+};
+
+inline source_stamp get_source_stamp(const std::filesystem::path& path) {
+    std::error_code error;
+    std::uintmax_t size = std::filesystem::file_size(path, error);
+    if (error)
+        return {};
+    auto modified = std::filesystem::last_write_time(path, error);
+    if (error)
+        return {};
+    return {static_cast<std::uint64_t>(size), static_cast<std::int64_t>(modified.time_since_epoch().count())};
+}
+
+// Writes plain values and arrays to a file in native byte order
+class binary_writer {
+  public:
+    explicit binary_writer(const std::filesystem::path& path) : stream(path, std::ios::binary) {
+        if (!stream)
+            THROW_ERROR("Can't open " + path.string() + " for writing");
+    }
+
+    template <typename T>
+    void write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        offset += sizeof(T);
+    }
+
+    // Element count first, then the elements
+    template <typename T>
+    void write_array(const T* values, std::size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(static_cast<std::uint64_t>(count));
+        stream.write(reinterpret_cast<const char*>(values), static_cast<std::streamsize>(count * sizeof(T)));
+        offset += count * sizeof(T);
+    }
+
+    template <typename T>
+    void write_array(const std::vector<T>& values) {
+        write_array(values.data(), values.size());
+    }
+
+    void write_string(const std::string& value) {
+        write_array(value.data(), value.size());
+    }
+
+    // Zero padding up to a multiple of `alignment` from the start of the file
+    void align(std::size_t alignment) {
+        while (offset % alignment != 0)
+            write(std::uint8_t{0});
+    }
+
+    [[nodiscard]] bool good() const {
+        return stream.good();
+    }
+
+  private:
+    std::ofstream stream;
+    std::size_t offset = 0;
+};
+
+// Writes `path` through `write` into a uniquely named file next to it, then renames that over `path`. Readers never
+// map a partial file, and writers racing on the same path each publish a whole file of their own.
+template <typename F>
+void write_file_atomically(const std::filesystem::path& path, const F& write) {
+    static const std::uint32_t process_tag = std::random_device{}();
+    static std::atomic<std::uint64_t> next_file{0};
+    std::filesystem::path temporary_path = path;
+    temporary_path += "." + std::to_string(process_tag) + "." +
+                      std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "." +
+                      std::to_string(next_file++) + ".tmp";
+    try {
+        {
+            binary_writer writer(temporary_path);
+            write(writer);
+            if (!writer.good())
+                THROW_ERROR("Can't write " + temporary_path.string());
+        }
+        std::filesystem::rename(temporary_path, path);
+    } catch (...) {
+        std::error_code ignored;
+        std::filesystem::remove(temporary_path, ignored);
+        throw;
+    }
+}
+
+// Reads what `binary_writer` wrote from memory, typically a mapped file; running past the end throws
+class binary_reader {
+  public:
+    binary_reader(const std::byte* data, std::size_t size) : data(data), size(size) {}
+
+    template <typename T>
+    T read() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    // Returns a pointer to `count` elements inside the buffer without copying them
+    template <typename T>
+    const T* view_array(std::size_t& count) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        count = static_cast<std::size_t>(read<std::uint64_t>());
+        if (count > (size - offset) / sizeof(T))
+            THROW_ERROR("Unexpected end of binary data");
+        return reinterpret_cast<const T*>(take(count * sizeof(T)));
+    }
+
+    template <typename T>
+    void read_array(std::vector<T>& values) {
+        std::size_t count = 0;
+        const T* source = view_array<T>(count);
+        values.resize(count);
+        if (count > 0)
+            std::memcpy(values.data(), source, count * sizeof(T));
+    }
+
+    std::string read_string() {
+        std::size_t length = 0;
+        const char* characters = view_array<char>(length);
+        return {characters, length};
+    }
+
+    // Skips the padding `binary_writer::align` wrote
+    void align(std::size_t alignment) {
+        take((alignment - offset % alignment) % alignment);
+    }
+
+  private:
+    const std::byte* data;
+    std::size_t size;
+    std::size_t offset = 0;
+
+    const std::byte* take(std::size_t count) {
+        if (count > size - offset)
+            THROW_ERROR("Unexpected end of binary data");
+        const std::byte* result = data + offset;
+        offset += count;
+        return result;
+    }
+};
+
+} // namespace cg::utils
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <exception>
 #include <stdexcept>
 #include <string>
 
@@ -14,3 +15,15 @@
             .append("\n");                                                                                             \
         throw std::runtime_error(message);                                                                             \
     }
+
+namespace cg::utils {
+
+// An error's message as one log line; THROW_ERROR messages already end in a newline, the standard library's don't
+inline std::string get_error_line(const std::exception& error) {
+    std::string line = error.what();
+    if (line.empty() || line.back() != '\n')
+        line += '\n';
+    return line;
+}
+
+} // namespace cg::utils
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace cg::utils {
+
+static constexpr std::uint64_t kHashSeed = 14695981039346656037ULL;
+
+// FNV-1a over 64-bit words with an extra shift to carry high bits down. Fast, not cryptographic: meant for
+// telling cache inputs apart.
+inline std::uint64_t hash_bytes(const void* data, std::size_t size, std::uint64_t seed = kHashSeed) {
+    static constexpr std::uint64_t kPrime = 1099511628211ULL;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = seed;
+
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * kPrime;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ bytes[i]) * kPrime;
+    return hash;
+}
+
+template <typename T>
+inline std::uint64_t hash_value(const T& value, std::uint64_t seed = kHashSeed) {
+    return hash_bytes(&value, sizeof(T), seed);
+}
+
+} // namespace cg::utils
@@ -0,0 +1,295 @@
+#include "json.h"
+
+#include "utils/error_handler.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+
+namespace cg::utils {
+
+// Recursive descent over the whole text; depth is bounded so a hostile file can't exhaust the stack
+class json_parser {
+  public:
+    explicit json_parser(std::string_view text) : text(text) {}
+
+    json_value parse_document() {
+        json_value result = parse_value(0);
+        skip_whitespace();
+        if (position != text.size())
+            fail("trailing characters");
+        return result;
+    }
+
+  private:
+    static constexpr std::size_t kMaxDepth = 256;
+
+    std::string_view text;
+    std::size_t position = 0;
+
+    [[noreturn]] void fail(const std::string& reason) const {
+        THROW_ERROR("Malformed JSON at offset " + std::to_string(position) + ": " + reason);
+    }
+
+    void skip_whitespace() {
+        while (position < text.size() &&
+               (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r'))
+            ++position;
+    }
+
+    char peek() {
+        skip_whitespace();
+        if (position == text.size())
+            fail("unexpected end");
+        return text[position];
+    }
+
+    void expect(char c) {
+        if (peek() != c)
+            fail(std::string("expected '") + c + "'");
+        ++position;
+    }
+
+    bool consume_literal(std::string_view literal) {
+        if (text.substr(position, literal.size()) != literal)
+            return false;
+        position += literal.size();
+        return true;
+    }
+
+    json_value parse_value(std::size_t depth) {
+        if (depth > kMaxDepth)
+            fail("nesting too deep");
+        json_value result;
+        char c = peek();
+        if (c == '{') {
+            result.type = json_value::kind::object;
+            ++position;
+            if (peek() == '}') {
+                ++position;
+                return result;
+            }
+            while (true) {
+                if (peek() != '"')
+                    fail("expected a member name");
+                result.keys.push_back(parse_string());
+                expect(':');
+                result.elements.push_back(parse_value(depth + 1));
+                if (peek() == '}') {
+                    ++position;
+                    return result;
+                }
+                expect(',');
+            }
+        }
+        if (c == '[') {
+            result.type = json_value::kind::array;
+            ++position;
+            if (peek() == ']') {
+                ++position;
+                return result;
+            }
+            while (true) {
+                result.elements.push_back(parse_value(depth + 1));
+                if (peek() == ']') {
+                    ++position;
+                    return result;
+                }
+                expect(',');
+            }
+        }
+        if (c == '"') {
+            result.type = json_value::kind::string;
+            result.string = parse_string();
+            return result;
+        }
+        if (consume_literal("true")) {
+            result.type = json_value::kind::boolean;
+            result.boolean = true;
+            return result;
+        }
+        if (consume_literal("false")) {
+            result.type = json_value::kind::boolean;
+            return result;
+        }
+        if (consume_literal("null"))
+            return result;
+        result.type = json_value::kind::number;
+        result.number = parse_number();
+        return result;
+    }
+
+    double parse_number() {
+        std::size_t begin = position;
+        auto is_number_char = [](char c) {
+            return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+        };
+        while (position < text.size() && is_number_char(text[position]))
+            ++position;
+        std::string token(text.substr(begin, position - begin));
+        char* end = nullptr;
+        double value = std::strtod(token.c_str(), &end);
+        if (token.empty() || end != token.c_str() + token.size() || !std::isfinite(value))
+            fail("invalid value");
+        return value;
+    }
+
+    unsigned parse_hex4() {
+        if (text.size() - position < 4)
+            fail("unexpected end");
+        unsigned value = 0;
+        for (std::size_t i = 0; i < 4; ++i) {
+            char c = text[position++];
+            value <<= 4U;
+            if (c >= '0' && c <= '9')
+                value |= static_cast<unsigned>(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                value |= static_cast<unsigned>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                value |= static_cast<unsigned>(c - 'A' + 10);
+            else
+                fail("invalid escape");
+        }
+        return value;
+    }
+
+    static void append_utf8(std::string& out, unsigned code_point) {
+        if (code_point < 0x80) {
+            out.push_back(static_cast<char>(code_point));
+        } else if (code_point < 0x800) {
+            out.push_back(static_cast<char>(0xC0U | (code_point >> 6U)));
+            out.push_back(static_cast<char>(0x80U | (code_point & 0x3FU)));
+        } else if (code_point < 0x10000) {
+            out.push_back(static_cast<char>(0xE0U | (code_point >> 12U)));
+            out.push_back(static_cast<char>(0x80U | ((code_point >> 6U) & 0x3FU)));
+            out.push_back(static_cast<char>(0x80U | (code_point & 0x3FU)));
+        } else {
+            out.push_back(static_cast<char>(0xF0U | (code_point >> 18U)));
+            out.push_back(static_cast<char>(0x80U | ((code_point >> 12U) & 0x3FU)));
+            out.push_back(static_cast<char>(0x80U | ((code_point >> 6U) & 0x3FU)));
+            out.push_back(static_cast<char>(0x80U | (code_point & 0x3FU)));
+        }
+    }
+
+    std::string parse_string() {
+        expect('"');
+        std::string result;
+        while (true) {
+            if (position == text.size())
+                fail("unterminated string");
+            char c = text[position++];
+            if (c == '"')
+                return result;
+            if (c != '\\') {
+                result.push_back(c);
+                continue;
+            }
+            if (position == text.size())
+                fail("unterminated string");
+            char escaped = text[position++];
+            switch (escaped) {
+                case '"':
+                case '\\':
+                case '/':
+                    result.push_back(escaped);
+                    break;
+                case 'b':
+                    result.push_back('\b');
+                    break;
+                case 'f':
+                    result.push_back('\f');
+                    break;
+                case 'n':
+                    result.push_back('\n');
+                    break;
+                case 'r':
+                    result.push_back('\r');
+                    break;
+                case 't':
+                    result.push_back('\t');
+                    break;
+                case 'u': {
+                    unsigned code_point = parse_hex4();
+                    // Characters outside the basic plane come as a surrogate pair
+                    if (code_point >= 0xD800 && code_point < 0xDC00 && consume_literal("\\u")) {
+                        unsigned low = parse_hex4();
+                        if (low < 0xDC00 || low >= 0xE000)
+                            fail("invalid surrogate pair");
+                        code_point = 0x10000 + ((code_point - 0xD800) << 10U) + (low - 0xDC00);
+                    }
+                    append_utf8(result, code_point);
+                    break;
+                }
+                default:
+                    fail("invalid escape");
+            }
+        }
+    }
+};
+
+} // namespace cg::utils
+
+namespace {
+
+const cg::utils::json_value kNull;
+const std::string kEmptyString;
+
+} // namespace
+
+cg::utils::json_value cg::utils::json_value::parse(std::string_view text) {
+    return json_parser(text).parse_document();
+}
+
+cg::utils::json_value::kind cg::utils::json_value::get_kind() const {
+    return type;
+}
+
+bool cg::utils::json_value::is_null() const {
+    return type == kind::null;
+}
+
+const cg::utils::json_value& cg::utils::json_value::operator[](std::string_view key) const {
+    if (type != kind::object)
+        return kNull;
+    for (std::size_t member_i = 0; member_i < keys.size(); ++member_i) {
+        if (keys[member_i] == key)
+            return elements[member_i];
+    }
+    return kNull;
+}
+
+const std::vector<std::string>& cg::utils::json_value::get_keys() const {
+    return keys;
+}
+
+const cg::utils::json_value& cg::utils::json_value::operator[](std::size_t index) const {
+    if ((type != kind::array && type != kind::object) || index >= elements.size())
+        return kNull;
+    return elements[index];
+}
+
+std::size_t cg::utils::json_value::size() const {
+    return elements.size();
+}
+
+bool cg::utils::json_value::as_bool(bool fallback) const {
+    return type == kind::boolean ? boolean : fallback;
+}
+
+double cg::utils::json_value::as_number(double fallback) const {
+    return type == kind::number ? number : fallback;
+}
+
+float cg::utils::json_value::as_float(float fallback) const {
+    return type == kind::number ? static_cast<float>(number) : fallback;
+}
+
+std::size_t cg::utils::json_value::as_index(std::size_t fallback) const {
+    if (type != kind::number || number < 0.0 || number != std::floor(number) || number >= 9.0e15)
+        return fallback;
+    return static_cast<std::size_t>(number);
+}
+
+const std::string& cg::utils::json_value::as_string() const {
+    return type == kind::string ? string : kEmptyString;
+}
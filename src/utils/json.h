@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cg::utils {
+
+// Parsed JSON document. Looking up a missing member or element, or one of another type, yields a null value
+// instead of throwing, so optional fields simply read as their fallbacks.
+class json_value {
+  public:
+    enum class kind : std::uint8_t {
+        null,
+        boolean,
+        number,
+        string,
+        array,
+        object,
+    };
+
+    // Throws on malformed text
+    static json_value parse(std::string_view text);
+
+    [[nodiscard]] kind get_kind() const;
+    [[nodiscard]] bool is_null() const;
+
+    // Members of an object, in file order
+    [[nodiscard]] const json_value& operator[](std::string_view key) const;
+    [[nodiscard]] const std::vector<std::string>& get_keys() const;
+    // Elements of an array, or member values of an object
+    [[nodiscard]] const json_value& operator[](std::size_t index) const;
+    [[nodiscard]] std::size_t size() const;
+
+    [[nodiscard]] bool as_bool(bool fallback = false) const;
+    [[nodiscard]] double as_number(double fallback = 0.0) const;
+    [[nodiscard]] float as_float(float fallback = 0.F) const;
+    // Non-negative integral numbers only
+    [[nodiscard]] std::size_t as_index(std::size_t fallback = 0) const;
+    // Empty for anything but a string
+    [[nodiscard]] const std::string& as_string() const;
+
+  private:
+    friend class json_parser;
+
+    kind type = kind::null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<std::string> keys;
+    std::vector<json_value> elements;
+};
+
+} // namespace cg::utils
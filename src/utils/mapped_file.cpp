@@ -0,0 +1,98 @@
+#include "mapped_file.h"
+
+#include "utils/error_handler.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+cg::utils::mapped_file::mapped_file(const std::filesystem::path& path, bool copy_on_write)
+    : copy_on_write(copy_on_write) {
+#ifdef _WIN32
+    file_handle = CreateFileW(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = nullptr;
+        THROW_ERROR("Can't open " + path.string());
+    }
+
+    LARGE_INTEGER file_size{};
+    GetFileSizeEx(file_handle, &file_size);
+    size = static_cast<std::size_t>(file_size.QuadPart);
+    if (size == 0)
+        return;
+
+    mapping_handle =
+        CreateFileMappingW(file_handle, nullptr, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle != nullptr)
+        data = static_cast<std::byte*>(
+            MapViewOfFile(mapping_handle, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr) {
+        if (mapping_handle != nullptr)
+            CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        THROW_ERROR("Can't map " + path.string());
+    }
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        THROW_ERROR("Can't open " + path.string());
+
+    struct stat file_stat {};
+    if (fstat(descriptor, &file_stat) != 0) {
+        close(descriptor);
+        THROW_ERROR("Can't read the size of " + path.string());
+    }
+    size = static_cast<std::size_t>(file_stat.st_size);
+    if (size > 0) {
+        int protection = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* mapping = mmap(nullptr, size, protection, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            close(descriptor);
+            THROW_ERROR("Can't map " + path.string());
+        }
+        data = static_cast<std::byte*>(mapping);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(descriptor);
+#endif
+}
+
+cg::utils::mapped_file::~mapped_file() {
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping_handle != nullptr)
+        CloseHandle(mapping_handle);
+    if (file_handle != nullptr)
+        CloseHandle(file_handle);
+#else
+    if (data != nullptr)
+        munmap(data, size);
+#endif
+}
+
+const std::byte* cg::utils::mapped_file::get_data() const {
+    return data;
+}
+
+std::byte* cg::utils::mapped_file::get_mutable_data() {
+    if (!copy_on_write)
+        THROW_ERROR("Read-only mapping can't be modified");
+    return data;
+}
+
+std::size_t cg::utils::mapped_file::get_size() const {
+    return size;
+}
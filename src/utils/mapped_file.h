@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace cg::utils {
+
+// Memory mapping of a whole file. A copy-on-write mapping may be modified in memory; the changes stay private
+// to the process and never reach the file.
+class mapped_file {
+  public:
+    explicit mapped_file(const std::filesystem::path& path, bool copy_on_write = false);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file(mapped_file&&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file& operator=(mapped_file&&) = delete;
+
+    [[nodiscard]] const std::byte* get_data() const;
+    // Only for copy-on-write mappings
+    [[nodiscard]] std::byte* get_mutable_data();
+    [[nodiscard]] std::size_t get_size() const;
+
+  private:
+    std::byte* data = nullptr;
+    std::size_t size = 0;
+    bool copy_on_write;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+} // namespace cg::utils
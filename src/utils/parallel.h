@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace cg::utils {
+
+inline std::size_t get_hardware_thread_count() {
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// Runs `function(item, worker)` for every item below `count` on up to `thread_count` threads, the caller's
+// included. Items go to whichever thread is free next; `worker` is below `thread_count` and lets callers keep
+// per-thread scratch data. The first exception `function` throws stops handing out items and is rethrown on the
+// caller once all threads are done.
+template <typename F>
+void parallel_for(std::size_t count, std::size_t thread_count, const F& function) {
+    std::atomic<std::size_t> next{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto work = [&](std::size_t worker) {
+        try {
+            for (std::size_t item = next++; item < count; item = next++)
+                function(item, worker);
+        } catch (...) {
+            next = count;
+            std::lock_guard lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t worker = 1; worker < std::min(thread_count, count); ++worker)
+        threads.emplace_back(work, worker);
+    work(0);
+    for (std::thread& thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Items below `count` by decreasing `get_size(item)`. Handed to `parallel_for` in this order, a big item picked up
+// last doesn't leave the other threads idle.
+template <typename S>
+std::vector<std::size_t> get_largest_first_order(std::size_t count, const S& get_size) {
+    std::vector<std::size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(
+        order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return get_size(a) > get_size(b); });
+    return order;
+}
+
+// Worker threads that run submitted jobs in submission order. Destruction waits for the queued jobs.
+class thread_pool {
+  public:
+    explicit thread_pool(std::size_t thread_count);
+    ~thread_pool();
+    thread_pool(const thread_pool&) = delete;
+    thread_pool(thread_pool&&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+    thread_pool& operator=(thread_pool&&) = delete;
+
+    // The future reports the job's result or rethrows what it threw
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F function);
+
+  private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> jobs;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void work();
+};
+
+inline thread_pool::thread_pool(std::size_t thread_count) {
+    for (std::size_t worker = 0; worker < std::max<std::size_t>(thread_count, 1); ++worker)
+        workers.emplace_back(&thread_pool::work, this);
+}
+
+inline thread_pool::~thread_pool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+template <typename F>
+std::future<std::invoke_result_t<F>> thread_pool::submit(F function) {
+    // std::function needs a copyable target
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(function));
+    std::future<std::invoke_result_t<F>> result = task->get_future();
+    {
+        std::lock_guard lock(mutex);
+        jobs.emplace_back([task] { (*task)(); });
+    }
+    wake.notify_one();
+    return result;
+}
+
+inline void thread_pool::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+} // namespace cg::utils
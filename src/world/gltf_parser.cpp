@@ -0,0 +1,275 @@
+#include "gltf_parser.h"
+
+#include "utils/binary_io.h"
+#include "utils/error_handler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace linalg::aliases;
+
+namespace {
+
+constexpr std::uint32_t kGlbMagic = 0x46546C67;     // "glTF"
+constexpr std::uint32_t kJsonChunkType = 0x4E4F534A; // "JSON"
+constexpr std::uint32_t kBinChunkType = 0x004E4942;  // "BIN\0"
+constexpr std::size_t kTrianglesMode = 4;
+
+enum component_type : std::uint32_t {
+    kByte = 5120,
+    kUnsignedByte = 5121,
+    kShort = 5122,
+    kUnsignedShort = 5123,
+    kUnsignedInt = 5125,
+    kFloat = 5126,
+};
+
+std::size_t get_component_size(std::uint32_t type) {
+    switch (type) {
+        case kByte:
+        case kUnsignedByte:
+            return 1;
+        case kShort:
+        case kUnsignedShort:
+            return 2;
+        case kUnsignedInt:
+        case kFloat:
+            return 4;
+        default:
+            THROW_ERROR("Unknown glTF component type " + std::to_string(type));
+    }
+}
+
+std::size_t get_component_count(const std::string& type) {
+    static constexpr std::pair<std::string_view, std::size_t> kTypes[] = {
+        {"SCALAR", 1},
+        {"VEC2", 2},
+        {"VEC3", 3},
+        {"VEC4", 4},
+        {"MAT2", 4},
+        {"MAT3", 9},
+        {"MAT4", 16},
+    };
+    for (const auto& [name, count] : kTypes) {
+        if (name == type)
+            return count;
+    }
+    THROW_ERROR("Unknown glTF accessor type " + type);
+}
+
+template <typename T>
+T read_unaligned(const std::byte* data) {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+// `matrix` when the node has one, translation * rotation * scale otherwise
+float4x4 get_local_transform(const cg::utils::json_value& node) {
+    const cg::utils::json_value& matrix = node["matrix"];
+    if (matrix.size() == 16) {
+        auto column = [&](std::size_t column_i) {
+            return float4{matrix[column_i * 4].as_float(),
+                          matrix[(column_i * 4) + 1].as_float(),
+                          matrix[(column_i * 4) + 2].as_float(),
+                          matrix[(column_i * 4) + 3].as_float()};
+        };
+        return {column(0), column(1), column(2), column(3)};
+    }
+    const cg::utils::json_value& translation = node["translation"];
+    const cg::utils::json_value& rotation = node["rotation"];
+    const cg::utils::json_value& scale = node["scale"];
+    float3 t{translation[0].as_float(), translation[1].as_float(), translation[2].as_float()};
+    float4 r{rotation[0].as_float(), rotation[1].as_float(), rotation[2].as_float(), rotation[3].as_float(1.F)};
+    float3 s{scale[0].as_float(1.F), scale[1].as_float(1.F), scale[2].as_float(1.F)};
+    return linalg::mul(linalg::mul(linalg::translation_matrix(t), linalg::rotation_matrix(r)),
+                       linalg::scaling_matrix(s));
+}
+
+// Depth-first over the node tree, children after their parent; a node reached twice would be a cycle
+void collect_draws(const cg::utils::json_value& document, cg::world::glb_data& data) {
+    const cg::utils::json_value& nodes = document["nodes"];
+    const cg::utils::json_value& scenes = document["scenes"];
+    std::vector<std::size_t> roots;
+    if (scenes.size() > 0) {
+        const cg::utils::json_value& scene = scenes[document["scene"].as_index(0)]["nodes"];
+        for (std::size_t root_i = 0; root_i < scene.size(); ++root_i)
+            roots.push_back(scene[root_i].as_index(nodes.size()));
+    } else {
+        // No scene: every node that isn't somebody's child
+        std::vector<bool> is_child(nodes.size());
+        for (std::size_t node_i = 0; node_i < nodes.size(); ++node_i) {
+            const cg::utils::json_value& children = nodes[node_i]["children"];
+            for (std::size_t child_i = 0; child_i < children.size(); ++child_i) {
+                std::size_t child = children[child_i].as_index(nodes.size());
+                if (child < nodes.size())
+                    is_child[child] = true;
+            }
+        }
+        for (std::size_t node_i = 0; node_i < nodes.size(); ++node_i) {
+            if (!is_child[node_i])
+                roots.push_back(node_i);
+        }
+    }
+
+    std::vector<bool> visited(nodes.size());
+    std::vector<std::pair<std::size_t, float4x4>> stack;
+    for (auto root = roots.rbegin(); root != roots.rend(); ++root)
+        stack.emplace_back(*root, linalg::identity);
+    std::size_t skipped_primitives = 0;
+    while (!stack.empty()) {
+        auto [node_i, parent_transform] = stack.back();
+        stack.pop_back();
+        if (node_i >= nodes.size() || visited[node_i])
+            THROW_ERROR("Invalid glTF node hierarchy at node " + std::to_string(node_i));
+        visited[node_i] = true;
+
+        const cg::utils::json_value& node = nodes[node_i];
+        float4x4 transform = linalg::mul(parent_transform, get_local_transform(node));
+        if (!node["mesh"].is_null()) {
+            std::size_t mesh = node["mesh"].as_index(~std::size_t{0});
+            const cg::utils::json_value& primitives = document["meshes"][mesh]["primitives"];
+            if (primitives.size() == 0)
+                THROW_ERROR("Invalid glTF mesh " + std::to_string(mesh));
+            for (std::size_t primitive_i = 0; primitive_i < primitives.size(); ++primitive_i) {
+                if (primitives[primitive_i]["mode"].as_index(kTrianglesMode) != kTrianglesMode) {
+                    ++skipped_primitives;
+                    continue;
+                }
+                data.draws.push_back({mesh, primitive_i, transform});
+            }
+        }
+        const cg::utils::json_value& children = node["children"];
+        for (std::size_t child_i = children.size(); child_i-- > 0;)
+            stack.emplace_back(children[child_i].as_index(nodes.size()), transform);
+    }
+    if (skipped_primitives > 0)
+        std::cout << "Skipping " << skipped_primitives << " glTF primitives that aren't triangle lists\n";
+}
+
+} // namespace
+
+float cg::world::gltf_accessor::read_float(std::size_t element, std::size_t component) const {
+    if (data == nullptr)
+        return 0.F;
+    const std::byte* source = data + (element * stride) + (component * get_component_size(component_type));
+    switch (component_type) {
+        case kFloat:
+            return read_unaligned<float>(source);
+        case kUnsignedByte: {
+            auto value = static_cast<float>(read_unaligned<std::uint8_t>(source));
+            return normalized ? value / 255.F : value;
+        }
+        case kByte: {
+            auto value = static_cast<float>(read_unaligned<std::int8_t>(source));
+            return normalized ? std::max(value / 127.F, -1.F) : value;
+        }
+        case kUnsignedShort: {
+            auto value = static_cast<float>(read_unaligned<std::uint16_t>(source));
+            return normalized ? value / 65535.F : value;
+        }
+        case kShort: {
+            auto value = static_cast<float>(read_unaligned<std::int16_t>(source));
+            return normalized ? std::max(value / 32767.F, -1.F) : value;
+        }
+        default:
+            return static_cast<float>(read_unaligned<std::uint32_t>(source));
+    }
+}
+
+std::uint32_t cg::world::gltf_accessor::read_index(std::size_t element) const {
+    if (data == nullptr)
+        return 0;
+    const std::byte* source = data + (element * stride);
+    switch (component_type) {
+        case kUnsignedByte:
+            return read_unaligned<std::uint8_t>(source);
+        case kUnsignedShort:
+            return read_unaligned<std::uint16_t>(source);
+        default:
+            return read_unaligned<std::uint32_t>(source);
+    }
+}
+
+const std::byte* cg::world::glb_data::get_buffer_view(std::size_t index, std::size_t& size) const {
+    const utils::json_value& view = document["bufferViews"][index];
+    if (view.is_null() || view["buffer"].as_index(1) != 0)
+        THROW_ERROR("glTF buffer view " + std::to_string(index) + " is not in the binary chunk");
+    std::size_t offset = view["byteOffset"].as_index(0);
+    size = view["byteLength"].as_index(0);
+    if (offset > binary_size || size > binary_size - offset)
+        THROW_ERROR("glTF buffer view " + std::to_string(index) + " reaches past the binary chunk");
+    return binary + offset;
+}
+
+cg::world::gltf_accessor cg::world::glb_data::get_accessor(std::size_t index) const {
+    const utils::json_value& accessor = document["accessors"][index];
+    if (accessor.is_null())
+        THROW_ERROR("Missing glTF accessor " + std::to_string(index));
+    if (!accessor["sparse"].is_null())
+        THROW_ERROR("Sparse glTF accessors are not supported");
+
+    gltf_accessor result;
+    result.count = accessor["count"].as_index(0);
+    result.component_type = static_cast<std::uint32_t>(accessor["componentType"].as_index(0));
+    result.component_count = get_component_count(accessor["type"].as_string());
+    result.normalized = accessor["normalized"].as_bool();
+    std::size_t element_size = get_component_size(result.component_type) * result.component_count;
+    if (accessor["bufferView"].is_null())
+        return result;
+
+    std::size_t view_index = accessor["bufferView"].as_index(~std::size_t{0});
+    std::size_t view_size = 0;
+    const std::byte* view = get_buffer_view(view_index, view_size);
+    result.stride = document["bufferViews"][view_index]["byteStride"].as_index(element_size);
+    std::size_t offset = accessor["byteOffset"].as_index(0);
+    if (result.stride < element_size || offset > view_size)
+        THROW_ERROR("Invalid glTF accessor " + std::to_string(index));
+    std::size_t available = view_size - offset;
+    if (result.count > 0 && (element_size > available || result.count - 1 > (available - element_size) / result.stride))
+        THROW_ERROR("glTF accessor " + std::to_string(index) + " reaches past its buffer view");
+    result.data = view + offset;
+    return result;
+}
+
+cg::world::glb_data cg::world::parse_glb(const std::filesystem::path& path) {
+    glb_data data;
+    data.file = std::make_shared<utils::mapped_file>(path);
+    utils::binary_reader reader(data.file->get_data(), data.file->get_size());
+    if (reader.read<std::uint32_t>() != kGlbMagic || reader.read<std::uint32_t>() != 2)
+        THROW_ERROR(path.string() + " is not a binary glTF 2.0 file");
+    auto length = static_cast<std::size_t>(reader.read<std::uint32_t>());
+    if (length > data.file->get_size())
+        THROW_ERROR(path.string() + " is truncated");
+
+    // A JSON chunk, then an optional BIN chunk; chunks of other types are skipped
+    std::string_view json;
+    std::size_t offset = 12;
+    while (offset + 8 <= length) {
+        auto chunk_length = static_cast<std::size_t>(read_unaligned<std::uint32_t>(data.file->get_data() + offset));
+        auto chunk_type = read_unaligned<std::uint32_t>(data.file->get_data() + offset + 4);
+        const std::byte* chunk = data.file->get_data() + offset + 8;
+        if (chunk_length > length - offset - 8)
+            THROW_ERROR(path.string() + " has a chunk past its end");
+        if (chunk_type == kJsonChunkType && json.empty())
+            json = {reinterpret_cast<const char*>(chunk), chunk_length};
+        else if (chunk_type == kBinChunkType && data.binary == nullptr) {
+            data.binary = chunk;
+            data.binary_size = chunk_length;
+        }
+        offset += 8 + ((chunk_length + 3) & ~std::size_t{3});
+    }
+    if (json.empty())
+        THROW_ERROR(path.string() + " has no JSON chunk");
+
+    data.document = utils::json_value::parse(json);
+    const utils::json_value& buffers = data.document["buffers"];
+    if (buffers.size() > 1 || !buffers[0]["uri"].is_null())
+        THROW_ERROR(path.string() + " refers to buffers outside the file");
+    collect_draws(data.document, data);
+    return data;
+}
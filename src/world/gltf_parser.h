@@ -0,0 +1,57 @@
+#pragma once
+
+#include "utils/json.h"
+#include "utils/mapped_file.h"
+
+#include <linalg.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace cg::world {
+
+using namespace linalg::aliases;
+
+// Elements of a glTF accessor, read in place from the binary chunk. Integer components are converted to float
+// following the accessor's `normalized` flag; an accessor without a buffer view reads as zeros.
+struct gltf_accessor {
+    const std::byte* data = nullptr;
+    std::size_t count = 0;
+    std::size_t stride = 0; // bytes between elements
+    std::uint32_t component_type = 0;
+    std::size_t component_count = 0;
+    bool normalized = false;
+
+    [[nodiscard]] float read_float(std::size_t element, std::size_t component) const;
+    [[nodiscard]] std::uint32_t read_index(std::size_t element) const;
+};
+
+// Triangle primitive of a mesh, placed by a node with its transform relative to the scene root
+struct gltf_draw {
+    std::size_t mesh = 0;
+    std::size_t primitive = 0;
+    float4x4 transform = linalg::identity;
+};
+
+struct glb_data {
+    std::shared_ptr<utils::mapped_file> file;
+    utils::json_value document;
+    const std::byte* binary = nullptr; // BIN chunk, inside `file`
+    std::size_t binary_size = 0;
+    // Every triangle primitive the default scene reaches, in node order
+    std::vector<gltf_draw> draws;
+
+    // Throw when the accessor or its buffer view reaches past the binary chunk
+    [[nodiscard]] gltf_accessor get_accessor(std::size_t index) const;
+    [[nodiscard]] const std::byte* get_buffer_view(std::size_t index, std::size_t& size) const;
+};
+
+// Binary glTF 2.0 loader. The file is memory-mapped and only its JSON chunk is parsed; accessors point into the
+// binary chunk, so vertex data is read once, straight from the mapping, by whoever converts it. Buffers outside
+// the file and sparse accessors are not supported.
+glb_data parse_glb(const std::filesystem::path& path);
+
+} // namespace cg::world
@@ -0,0 +1,255 @@
+#include "mesh_optimizer.h"
+
+#include <linalg.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+using namespace linalg::aliases;
+
+namespace {
+
+// Post-transform cache the orderings aim at; the rasterizer keeps one of a similar size
+constexpr std::size_t kCacheSize = 32;
+constexpr std::size_t kNoTriangle = std::numeric_limits<std::size_t>::max();
+
+// Scoring from Forsyth's "Linear-Speed Vertex Cache Optimisation"
+constexpr float kCacheDecayPower = 1.5F;
+constexpr float kLastTriangleScore = 0.75F;
+constexpr float kValenceBoostScale = 2.F;
+constexpr float kValenceBoostPower = 0.5F;
+constexpr std::size_t kMaxScoredValence = 32;
+
+struct vertex_score_table {
+    std::array<float, kCacheSize> cache{};
+    std::array<float, kMaxScoredValence> valence{};
+
+    vertex_score_table() {
+        for (std::size_t position = 0; position < kCacheSize; ++position) {
+            if (position < 3)
+                cache[position] = kLastTriangleScore;
+            else {
+                float decay = 1.F - static_cast<float>(position - 3) / static_cast<float>(kCacheSize - 3);
+                cache[position] = std::pow(decay, kCacheDecayPower);
+            }
+        }
+        for (std::size_t remaining = 1; remaining < kMaxScoredValence; ++remaining)
+            valence[remaining] = kValenceBoostScale * std::pow(static_cast<float>(remaining), -kValenceBoostPower);
+    }
+
+    [[nodiscard]] float score(int cache_position, std::size_t remaining) const {
+        if (remaining == 0)
+            return -1.F;
+        float result = cache_position >= 0 ? cache[static_cast<std::size_t>(cache_position)] : 0.F;
+        return result + valence[std::min(remaining, kMaxScoredValence - 1)];
+    }
+};
+
+// Misses of a FIFO post-transform cache over the whole list
+std::size_t count_cache_misses(const std::vector<std::size_t>& indices, std::size_t vertex_count) {
+    std::vector<std::size_t> cached_at(vertex_count, std::numeric_limits<std::size_t>::max() / 2);
+    std::size_t time = kCacheSize + 1;
+    for (std::size_t index : indices) {
+        if (time - cached_at[index] > kCacheSize)
+            cached_at[index] = time++;
+    }
+    return time - (kCacheSize + 1);
+}
+
+} // namespace
+
+void cg::world::optimize_vertex_cache(std::vector<std::size_t>& indices, std::size_t vertex_count) {
+    static const vertex_score_table kScores;
+    std::size_t triangle_count = indices.size() / 3;
+    if (triangle_count < 2)
+        return;
+
+    // Triangles around each vertex, packed; a vertex's unemitted triangles are the first `remaining` of its range
+    std::vector<std::size_t> remaining(vertex_count, 0);
+    for (std::size_t index : indices)
+        ++remaining[index];
+    std::vector<std::size_t> adjacency_offsets(vertex_count + 1, 0);
+    std::partial_sum(remaining.begin(), remaining.end(), adjacency_offsets.begin() + 1);
+    std::vector<std::size_t> adjacency(indices.size());
+    std::vector<std::size_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (std::size_t index_i = 0; index_i < indices.size(); ++index_i)
+        adjacency[fill[indices[index_i]]++] = index_i / 3;
+
+    std::vector<int> cache_positions(vertex_count, -1);
+    std::vector<float> vertex_scores(vertex_count);
+    for (std::size_t vertex_i = 0; vertex_i < vertex_count; ++vertex_i)
+        vertex_scores[vertex_i] = kScores.score(-1, remaining[vertex_i]);
+
+    auto triangle_score = [&](std::size_t triangle_i) {
+        const std::size_t* corners = &indices[3 * triangle_i];
+        return vertex_scores[corners[0]] + vertex_scores[corners[1]] + vertex_scores[corners[2]];
+    };
+
+    std::vector<bool> emitted(triangle_count, false);
+    std::size_t best = 0;
+    for (std::size_t triangle_i = 1; triangle_i < triangle_count; ++triangle_i) {
+        if (triangle_score(triangle_i) > triangle_score(best))
+            best = triangle_i;
+    }
+
+    std::vector<std::size_t> result;
+    result.reserve(indices.size());
+    std::vector<std::size_t> cache;
+    std::vector<std::size_t> next_cache;
+    cache.reserve(kCacheSize + 3);
+    next_cache.reserve(kCacheSize + 3);
+    std::size_t scan_cursor = 0;
+
+    while (result.size() < indices.size()) {
+        // Dead end: nothing in the cache has triangles left, so continue with the next one in input order
+        if (best == kNoTriangle) {
+            while (emitted[scan_cursor])
+                ++scan_cursor;
+            best = scan_cursor;
+        }
+
+        const std::size_t* corners = &indices[3 * best];
+        result.insert(result.end(), corners, corners + 3);
+        emitted[best] = true;
+        for (std::size_t corner_i = 0; corner_i < 3; ++corner_i) {
+            std::size_t vertex_i = corners[corner_i];
+            std::size_t* first = &adjacency[adjacency_offsets[vertex_i]];
+            std::size_t* last = first + remaining[vertex_i];
+            std::iter_swap(std::find(first, last, best), last - 1);
+            --remaining[vertex_i];
+        }
+
+        // The triangle's corners move to the front of the LRU cache; entries pushed past its end fall out
+        next_cache.assign(corners, corners + 3);
+        for (std::size_t vertex_i : cache) {
+            if (vertex_i != corners[0] && vertex_i != corners[1] && vertex_i != corners[2])
+                next_cache.push_back(vertex_i);
+        }
+        std::swap(cache, next_cache);
+        for (std::size_t position = 0; position < cache.size(); ++position) {
+            std::size_t vertex_i = cache[position];
+            cache_positions[vertex_i] = position < kCacheSize ? static_cast<int>(position) : -1;
+            vertex_scores[vertex_i] = kScores.score(cache_positions[vertex_i], remaining[vertex_i]);
+        }
+        if (cache.size() > kCacheSize)
+            cache.resize(kCacheSize);
+
+        best = kNoTriangle;
+        float best_score = -std::numeric_limits<float>::max();
+        for (std::size_t vertex_i : cache) {
+            for (std::size_t adjacent_i = 0; adjacent_i < remaining[vertex_i]; ++adjacent_i) {
+                std::size_t triangle_i = adjacency[adjacency_offsets[vertex_i] + adjacent_i];
+                float score = triangle_score(triangle_i);
+                if (score > best_score) {
+                    best_score = score;
+                    best = triangle_i;
+                }
+            }
+        }
+    }
+
+    // The greedy order can lose to meshes exported in strips; keep whichever reuses the cache better
+    if (count_cache_misses(result, vertex_count) < count_cache_misses(indices, vertex_count))
+        indices = std::move(result);
+}
+
+void cg::world::optimize_overdraw(std::vector<std::size_t>& indices, const std::vector<cg::vertex>& vertices) {
+    std::size_t triangle_count = indices.size() / 3;
+    if (triangle_count < 2)
+        return;
+
+    // A triangle that misses the simulated FIFO cache on all three corners starts a new cluster
+    std::vector<std::size_t> cluster_starts;
+    std::vector<std::size_t> cached_at(vertices.size(), std::numeric_limits<std::size_t>::max() / 2);
+    std::size_t time = kCacheSize + 1;
+    for (std::size_t triangle_i = 0; triangle_i < triangle_count; ++triangle_i) {
+        std::size_t misses = 0;
+        for (std::size_t corner_i = 0; corner_i < 3; ++corner_i) {
+            std::size_t vertex_i = indices[3 * triangle_i + corner_i];
+            if (time - cached_at[vertex_i] > kCacheSize) {
+                cached_at[vertex_i] = time++;
+                ++misses;
+            }
+        }
+        if (triangle_i == 0 || misses == 3)
+            cluster_starts.push_back(triangle_i);
+    }
+    if (cluster_starts.size() < 2)
+        return;
+    cluster_starts.push_back(triangle_count);
+
+    struct cluster {
+        std::size_t first_triangle;
+        std::size_t triangle_count;
+        float sort_key;
+    };
+    std::vector<cluster> clusters;
+    clusters.reserve(cluster_starts.size() - 1);
+
+    // Area-weighted centroids and normals; the key is how far a cluster lies out along the way it faces
+    std::vector<float3> cluster_centroids;
+    std::vector<float3> cluster_normals;
+    float3 mesh_centroid{0.F, 0.F, 0.F};
+    float mesh_area = 0.F;
+    for (std::size_t cluster_i = 0; cluster_i + 1 < cluster_starts.size(); ++cluster_i) {
+        float3 centroid{0.F, 0.F, 0.F};
+        float3 normal{0.F, 0.F, 0.F};
+        float area = 0.F;
+        for (std::size_t triangle_i = cluster_starts[cluster_i]; triangle_i < cluster_starts[cluster_i + 1];
+             ++triangle_i) {
+            const float3& a = vertices[indices[3 * triangle_i]].v;
+            const float3& b = vertices[indices[3 * triangle_i + 1]].v;
+            const float3& c = vertices[indices[3 * triangle_i + 2]].v;
+            float3 scaled_normal = linalg::cross(b - a, c - a);
+            float triangle_area = linalg::length(scaled_normal);
+            centroid += (a + b + c) * (triangle_area / 3.F);
+            normal += scaled_normal;
+            area += triangle_area;
+        }
+        mesh_centroid += centroid;
+        mesh_area += area;
+        cluster_centroids.push_back(area > 0.F ? centroid / area : centroid);
+        cluster_normals.push_back(normal);
+        clusters.push_back(
+            {cluster_starts[cluster_i], cluster_starts[cluster_i + 1] - cluster_starts[cluster_i], 0.F});
+    }
+    if (mesh_area > 0.F)
+        mesh_centroid /= mesh_area;
+
+    for (std::size_t cluster_i = 0; cluster_i < clusters.size(); ++cluster_i) {
+        float normal_length = linalg::length(cluster_normals[cluster_i]);
+        if (normal_length > 0.F) {
+            clusters[cluster_i].sort_key =
+                linalg::dot(cluster_centroids[cluster_i] - mesh_centroid, cluster_normals[cluster_i] / normal_length);
+        }
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const cluster& a, const cluster& b) {
+        return a.sort_key > b.sort_key;
+    });
+
+    std::vector<std::size_t> result;
+    result.reserve(indices.size());
+    for (const cluster& cluster : clusters) {
+        auto first = indices.begin() + static_cast<std::ptrdiff_t>(3 * cluster.first_triangle);
+        result.insert(result.end(), first, first + static_cast<std::ptrdiff_t>(3 * cluster.triangle_count));
+    }
+    indices = std::move(result);
+}
+
+void cg::world::optimize_vertex_fetch(std::vector<std::size_t>& indices, std::vector<cg::vertex>& vertices) {
+    static constexpr std::size_t kUnused = std::numeric_limits<std::size_t>::max();
+    std::vector<std::size_t> remap(vertices.size(), kUnused);
+    std::vector<cg::vertex> result;
+    result.reserve(vertices.size());
+    for (std::size_t& index : indices) {
+        if (remap[index] == kUnused) {
+            remap[index] = result.size();
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices = std::move(result);
+}
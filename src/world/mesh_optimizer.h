@@ -0,0 +1,24 @@
+#pragma once
+
+#include "resource.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace cg::world {
+
+// Load-time reordering of indexed triangle lists. Each pass keeps the set of triangles and their winding; indices
+// come in triples into the vertex array.
+
+// Forsyth's linear-speed ordering: greedily emits the triangle whose vertices score best in a simulated LRU
+// post-transform cache, favoring vertices with few triangles left
+void optimize_vertex_cache(std::vector<std::size_t>& indices, std::size_t vertex_count);
+
+// Tipsify-style clustering: splits the cache-ordered list where it jumps to an unrelated region and sorts those
+// clusters outward-facing first, so that from most viewpoints near surfaces are drawn before the ones they hide
+void optimize_overdraw(std::vector<std::size_t>& indices, const std::vector<cg::vertex>& vertices);
+
+// Renumbers vertices in order of first use so consecutive triangles fetch neighboring memory
+void optimize_vertex_fetch(std::vector<std::size_t>& indices, std::vector<cg::vertex>& vertices);
+
+} // namespace cg::world
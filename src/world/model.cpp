@@ -1,61 +1,410 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "model.h"
+#include "gltf_parser.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
 #include "resource.h"
+#include "vertex_index_table.h"
 
+#include "utils/binary_io.h"
 #include "utils/error_handler.h"
+#include "utils/json.h"
+#include "utils/mapped_file.h"
+#include "utils/parallel.h"
 
 #include <linalg.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
-#include <unordered_map>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 using namespace linalg::aliases;
 using namespace cg::world;
 
-void cg::world::model::load_obj(const std::filesystem::path& model_path) {
-    tinyobj::ObjReaderConfig reader_config;
-    reader_config.mtl_search_path = model_path.parent_path().string();
-    reader_config.triangulate = true;
-
-    tinyobj::ObjReader reader{};
-    if (!reader.ParseFromFile(model_path.string(), reader_config)) {
-        if (!reader.Error().empty())
-            THROW_ERROR(reader.Error());
-    }
-
-    const std::vector<tinyobj::shape_t>& shapes = reader.GetShapes();
-    const tinyobj::attrib_t& attributes = reader.GetAttrib();
-    const std::vector<tinyobj::material_t>& materials = reader.GetMaterials();
-
-    allocate_buffers(shapes);
-    fill_buffers(shapes, attributes, materials, model_path.parent_path());
-}
-
-void model::allocate_buffers(const std::vector<tinyobj::shape_t>& shapes) {
-    for (const tinyobj::shape_t& shape : shapes) {
-        std::size_t index_offset = 0;
-        std::size_t vertex_buffer_size = 0;
-        std::size_t index_buffer_size = 0;
-        std::unordered_map<int3, std::size_t> index_map;
-        const tinyobj::mesh_t& mesh = shape.mesh;
-
-        for (const unsigned char& fv : mesh.num_face_vertices) {
-            for (std::size_t v = 0; v < fv; ++v) {
-                tinyobj::index_t idx = mesh.indices[index_offset + v]; // indices is flattened
-                int3 idx_tuple = {idx.vertex_index, idx.normal_index, idx.texcoord_index};
-                if (auto it = index_map.find(idx_tuple); it == index_map.end()) {
-                    it = index_map.emplace(idx_tuple, vertex_buffer_size).first;
-                    ++vertex_buffer_size;
-                }
-                ++index_buffer_size;
+namespace {
+
+constexpr std::uint64_t kMeshCacheMagic = 0x31304853454D4743ULL; // "CGMESH01"
+constexpr std::uint32_t kMeshCacheVersion = 3;
+// Arrays are padded to this boundary so resources can point straight into the mapping
+constexpr std::size_t kMeshCacheAlignment = 8;
+
+} // namespace
+
+void cg::world::model::load_obj(const std::filesystem::path& model_path, bool use_cache, bool optimize_meshes) {
+    shape_ranges.clear();
+    std::filesystem::path cache_path = model_path;
+    cache_path += ".cgmesh";
+    if (use_cache && load_cache(cache_path, model_path, optimize_meshes)) {
+        if (shape_callback) {
+            for (std::size_t shape_i = 0; shape_i < index_buffers.size(); ++shape_i)
+                shape_callback(shape_i);
+        }
+        request_textures();
+        return;
+    }
+
+    std::filesystem::path base_folder = model_path.parent_path();
+    auto request_material_textures = [&](const obj_data& data) {
+        if (!texture_source)
+            return;
+        for (const tinyobj::material_t& material : data.materials) {
+            if (!material.diffuse_texname.empty())
+                texture_source->request(base_folder / material.diffuse_texname);
+        }
+    };
+
+    obj_data data;
+    if (shape_callback) {
+        // Shapes are converted and reported while later parts of the file are still being parsed
+        obj_stream_callbacks stream;
+        stream.on_begin = [&](const obj_data& parsed) {
+            request_material_textures(parsed);
+            begin_buffers(parsed.shapes.size(), parsed.materials);
+        };
+        stream.on_shape = [&](std::size_t shape_i, tinyobj::shape_t& shape, const obj_data& parsed) {
+            vertex_index_table index_table;
+            fill_shape_buffers(
+                shape_i, shape.mesh, parsed.attrib, parsed.materials, base_folder, optimize_meshes, index_table);
+        };
+        data = parse_obj(model_path, 0, &stream);
+    } else {
+        data = parse_obj(model_path);
+        request_material_textures(data);
+        fill_buffers(data.shapes, data.attrib, data.materials, base_folder, optimize_meshes);
+    }
+    request_textures();
+
+    if (use_cache) {
+        std::vector<std::filesystem::path> sources{model_path};
+        sources.insert(sources.end(), data.material_libraries.begin(), data.material_libraries.end());
+        try {
+            save_cache(cache_path, model_path, sources, optimize_meshes);
+        } catch (const std::exception& error) {
+            std::cout << "Can't cache " << model_path.string() << ": " << utils::get_error_line(error);
+        }
+    }
+}
+
+void cg::world::model::load(const std::filesystem::path& model_path, bool use_cache, bool optimize_meshes) {
+    std::string extension = model_path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    if (extension == ".glb")
+        load_glb(model_path, optimize_meshes);
+    else
+        load_obj(model_path, use_cache, optimize_meshes);
+}
+
+// glTF vertices are already shared by the index buffers, so each primitive converts in one sweep over its
+// accessors, read straight from the mapped file, with no lookups to find repeated vertices
+void cg::world::model::load_glb(const std::filesystem::path& model_path, bool optimize_meshes) {
+    static constexpr std::size_t kMissing = ~std::size_t{0};
+    glb_data data = parse_glb(model_path);
+    const utils::json_value& document = data.document;
+    shape_ranges.clear();
+
+    // Images stored in the file are known as `<model>#image<i>`; data URIs aren't supported and leave shapes plain
+    const utils::json_value& images = document["images"];
+    std::vector<std::filesystem::path> image_files(images.size());
+    for (std::size_t image_i = 0; image_i < images.size(); ++image_i) {
+        const utils::json_value& image = images[image_i];
+        const std::string& uri = image["uri"].as_string();
+        if (!image["bufferView"].is_null()) {
+            image_files[image_i] = model_path;
+            image_files[image_i] += "#image" + std::to_string(image_i);
+            if (texture_source) {
+                std::size_t size = 0;
+                const std::byte* bytes = data.get_buffer_view(image["bufferView"].as_index(kMissing), size);
+                texture_source->request_embedded(image_files[image_i], model_path, data.file, bytes, size);
+            }
+        } else if (!uri.empty() && uri.rfind("data:", 0) != 0) {
+            image_files[image_i] = model_path.parent_path() / uri;
+            if (texture_source)
+                texture_source->request(image_files[image_i]);
+        }
+    }
+
+    const utils::json_value& source_materials = document["materials"];
+    materials.clear();
+    std::vector<std::filesystem::path> material_textures;
+    for (std::size_t material_i = 0; material_i < source_materials.size(); ++material_i) {
+        const utils::json_value& source = source_materials[material_i];
+        const utils::json_value& pbr = source["pbrMetallicRoughness"];
+        const utils::json_value& base_color = pbr["baseColorFactor"];
+        const utils::json_value& emission = source["emissiveFactor"];
+        float emissive_strength =
+            source["extensions"]["KHR_materials_emissive_strength"]["emissiveStrength"].as_float(1.F);
+        float3 color{base_color[0].as_float(1.F), base_color[1].as_float(1.F), base_color[2].as_float(1.F)};
+        float3 emissive{emission[0].as_float(), emission[1].as_float(), emission[2].as_float()};
+        // There's no ambient term in glTF; under ambient light alone a surface shows its base color
+        materials.push_back({color, color, emissive * emissive_strength});
+        std::size_t texture_i = pbr["baseColorTexture"]["index"].as_index(kMissing);
+        std::size_t image_i = document["textures"][texture_i]["source"].as_index(kMissing);
+        material_textures.push_back(image_i < image_files.size() ? image_files[image_i] : std::filesystem::path{});
+    }
+
+    // Accessors are looked up and checked here, so the parallel sweep below can't fail halfway
+    struct primitive_source {
+        gltf_accessor positions;
+        gltf_accessor normals;
+        gltf_accessor texcoords;
+        gltf_accessor indices;
+        bool indexed = false;
+        std::uint32_t material = 0;
+        float4x4 transform;
+    };
+    std::vector<primitive_source> sources;
+    sources.reserve(data.draws.size());
+    bool needs_default = false;
+    for (const gltf_draw& draw : data.draws) {
+        const utils::json_value& primitive = document["meshes"][draw.mesh]["primitives"][draw.primitive];
+        const utils::json_value& attributes = primitive["attributes"];
+        primitive_source& source = sources.emplace_back();
+        source.transform = draw.transform;
+        source.positions = data.get_accessor(attributes["POSITION"].as_index(kMissing));
+        if (source.positions.component_count != 3)
+            THROW_ERROR("glTF mesh " + std::to_string(draw.mesh) + " has no three-component positions");
+        if (!attributes["NORMAL"].is_null()) {
+            source.normals = data.get_accessor(attributes["NORMAL"].as_index(kMissing));
+            if (source.normals.component_count != 3 || source.normals.count < source.positions.count)
+                THROW_ERROR("glTF mesh " + std::to_string(draw.mesh) + " has invalid normals");
+        }
+        if (!attributes["TEXCOORD_0"].is_null()) {
+            source.texcoords = data.get_accessor(attributes["TEXCOORD_0"].as_index(kMissing));
+            if (source.texcoords.component_count != 2 || source.texcoords.count < source.positions.count)
+                THROW_ERROR("glTF mesh " + std::to_string(draw.mesh) + " has invalid texture coordinates");
+        }
+        if (!primitive["indices"].is_null()) {
+            source.indexed = true;
+            source.indices = data.get_accessor(primitive["indices"].as_index(kMissing));
+            if (source.indices.component_count != 1 || source.indices.count % 3 != 0)
+                THROW_ERROR("glTF mesh " + std::to_string(draw.mesh) + " has invalid indices");
+        } else if (source.positions.count % 3 != 0) {
+            THROW_ERROR("glTF mesh " + std::to_string(draw.mesh) + " has an incomplete triangle");
+        }
+
+        std::size_t material = primitive["material"].as_index(kMissing);
+        if (material >= source_materials.size()) {
+            needs_default = true;
+            material = source_materials.size();
+        }
+        source.material = static_cast<std::uint32_t>(material);
+    }
+    // Primitives without a material get glTF's default, a plain white one
+    if (needs_default) {
+        materials.push_back({float3{1.F, 1.F, 1.F}, float3{1.F, 1.F, 1.F}, float3{0.F, 0.F, 0.F}});
+        material_textures.emplace_back();
+    }
+
+    vertex_buffers.assign(sources.size(), nullptr);
+    index_buffers.assign(sources.size(), nullptr);
+    textures.assign(sources.size(), {});
+    primitives.assign(sources.size(), {});
+
+    auto get_index_count = [](const primitive_source& source) {
+        return source.indexed ? source.indices.count : source.positions.count;
+    };
+    std::vector<std::size_t> shape_order = utils::get_largest_first_order(
+        sources.size(), [&](std::size_t shape_i) { return get_index_count(sources[shape_i]); });
+
+    std::atomic<std::size_t> invalid_shapes{0};
+    utils::parallel_for(sources.size(), utils::get_hardware_thread_count(), [&](std::size_t order_i, std::size_t) {
+        std::size_t shape_i = shape_order[order_i];
+        const primitive_source& source = sources[shape_i];
+        const float4x4& transform = source.transform;
+        float4x4 inverse_transform = linalg::inverse(transform);
+        // Mirroring transforms turn the triangles inside out, so their winding is reversed to compensate
+        bool mirrored = linalg::dot(linalg::cross(transform.x.xyz(), transform.y.xyz()), transform.z.xyz()) < 0.F;
+
+        std::vector<vertex> vertices(source.positions.count);
+        for (std::size_t vertex_i = 0; vertex_i < vertices.size(); ++vertex_i) {
+            vertex& vertex = vertices[vertex_i];
+            float3 position{source.positions.read_float(vertex_i, 0),
+                            source.positions.read_float(vertex_i, 1),
+                            source.positions.read_float(vertex_i, 2)};
+            vertex.v = linalg::mul(transform, float4{position, 1.F}).xyz();
+            if (source.normals.count > 0) {
+                float3 normal{source.normals.read_float(vertex_i, 0),
+                              source.normals.read_float(vertex_i, 1),
+                              source.normals.read_float(vertex_i, 2)};
+                vertex.n = linalg::normalize(float3{linalg::dot(inverse_transform.x.xyz(), normal),
+                                                    linalg::dot(inverse_transform.y.xyz(), normal),
+                                                    linalg::dot(inverse_transform.z.xyz(), normal)});
+            }
+            // glTF puts the texture origin at the top left, while sampling expects v to point up
+            if (source.texcoords.count > 0)
+                vertex.tex = {source.texcoords.read_float(vertex_i, 0), 1.F - source.texcoords.read_float(vertex_i, 1)};
+            vertex.material = source.material;
+        }
+
+        std::vector<std::size_t> indices(get_index_count(source));
+        bool valid = true;
+        for (std::size_t index_i = 0; index_i < indices.size(); ++index_i) {
+            indices[index_i] = source.indexed ? source.indices.read_index(index_i) : index_i;
+            valid = valid && indices[index_i] < vertices.size();
+        }
+        if (!valid) {
+            ++invalid_shapes;
+            indices.clear();
+        }
+        if (mirrored) {
+            for (std::size_t index_i = 0; index_i < indices.size(); index_i += 3)
+                std::swap(indices[index_i + 1], indices[index_i + 2]);
+        }
+
+        // Without normals in the file, every vertex gets the area-weighted average of its triangles' normals
+        if (source.normals.count == 0) {
+            std::vector<float3> normals(vertices.size());
+            for (std::size_t index_i = 0; index_i < indices.size(); index_i += 3) {
+                const float3& a = vertices[indices[index_i]].v;
+                float3 face_normal = linalg::cross(vertices[indices[index_i + 1]].v - a,
+                                                   vertices[indices[index_i + 2]].v - a);
+                for (std::size_t corner = 0; corner < 3; ++corner)
+                    normals[indices[index_i + corner]] += face_normal;
+            }
+            for (std::size_t vertex_i = 0; vertex_i < vertices.size(); ++vertex_i) {
+                float length = linalg::length(normals[vertex_i]);
+                vertices[vertex_i].n = length > 0.F ? normals[vertex_i] / length : float3{0.F, 0.F, 1.F};
             }
-            index_offset += fv;
         }
-        vertex_buffers.push_back(std::make_shared<resource<vertex>>(vertex_buffer_size));
-        index_buffers.push_back(std::make_shared<resource<std::size_t>>(index_buffer_size));
+
+        if (optimize_meshes) {
+            optimize_vertex_cache(indices, vertices.size());
+            optimize_overdraw(indices, vertices);
+            optimize_vertex_fetch(indices, vertices);
+        }
+
+        vertex_buffers[shape_i] = std::make_shared<resource<vertex>>(std::move(vertices));
+        index_buffers[shape_i] = std::make_shared<resource<std::size_t>>(std::move(indices));
+        textures[shape_i] = material_textures[source.material];
+        primitives[shape_i] = fit_primitive(*vertex_buffers[shape_i], *index_buffers[shape_i]);
+        if (shape_callback)
+            shape_callback(shape_i);
+    });
+    if (invalid_shapes > 0)
+        std::cout << "Dropping the triangles of " << invalid_shapes << " glTF primitives with indices out of range\n";
+    request_textures();
+}
+
+// Sources and textures are stored relative to the model folder, so the folder can move with its cache
+bool model::load_cache(const std::filesystem::path& cache_path,
+                       const std::filesystem::path& model_path,
+                       bool optimized_meshes) {
+    if (!std::filesystem::exists(cache_path))
+        return false;
+
+    std::filesystem::path base_folder = model_path.parent_path();
+    std::vector<std::shared_ptr<cg::resource<cg::vertex>>> cached_vertex_buffers;
+    std::vector<std::shared_ptr<cg::resource<std::size_t>>> cached_index_buffers;
+    std::vector<std::filesystem::path> cached_textures;
+    std::vector<shape_primitive> cached_primitives;
+    std::vector<cg::material> cached_materials;
+    try {
+        // Copy-on-write keeps the buffers writable like parsed ones without ever touching the file
+        auto file = std::make_shared<utils::mapped_file>(cache_path, true);
+        utils::binary_reader reader(file->get_data(), file->get_size());
+        if (reader.read<std::uint64_t>() != kMeshCacheMagic || reader.read<std::uint32_t>() != kMeshCacheVersion ||
+            reader.read<std::uint32_t>() != sizeof(vertex) || reader.read<std::uint32_t>() != sizeof(std::size_t) ||
+            reader.read<std::uint8_t>() != static_cast<std::uint8_t>(optimized_meshes))
+            return false;
+
+        auto source_count = static_cast<std::size_t>(reader.read<std::uint64_t>());
+        for (std::size_t source_i = 0; source_i < source_count; ++source_i) {
+            std::filesystem::path source = base_folder / reader.read_string();
+            if (!(reader.read<utils::source_stamp>() == utils::get_source_stamp(source)))
+                return false;
+        }
+
+        reader.read_array(cached_materials);
+
+        auto to_mutable = [&](const auto* items) {
+            using item_type = std::remove_const_t<std::remove_pointer_t<decltype(items)>>;
+            auto offset = reinterpret_cast<const std::byte*>(items) - file->get_data();
+            return reinterpret_cast<item_type*>(file->get_mutable_data() + offset);
+        };
+
+        auto shape_count = static_cast<std::size_t>(reader.read<std::uint64_t>());
+        for (std::size_t shape_i = 0; shape_i < shape_count; ++shape_i) {
+            std::string texture = reader.read_string();
+            cached_textures.push_back(texture.empty() ? std::filesystem::path{} : base_folder / texture);
+            cached_primitives.push_back(reader.read<shape_primitive>());
+
+            std::size_t count = 0;
+            reader.align(kMeshCacheAlignment);
+            const vertex* vertices = reader.view_array<vertex>(count);
+            for (std::size_t vertex_i = 0; vertex_i < count; ++vertex_i) {
+                if (vertices[vertex_i].material >= cached_materials.size())
+                    return false;
+            }
+            cached_vertex_buffers.push_back(std::make_shared<resource<vertex>>(to_mutable(vertices), count, file));
+
+            reader.align(kMeshCacheAlignment);
+            const std::size_t* indices = reader.view_array<std::size_t>(count);
+            for (std::size_t index_i = 0; index_i < count; ++index_i) {
+                if (indices[index_i] >= cached_vertex_buffers.back()->count())
+                    return false;
+            }
+            cached_index_buffers.push_back(std::make_shared<resource<std::size_t>>(to_mutable(indices), count, file));
+        }
+    } catch (const std::runtime_error& error) {
+        std::cout << "Ignoring " << cache_path.string() << ": " << utils::get_error_line(error);
+        return false;
     }
-    textures.resize(shapes.size());
+
+    vertex_buffers = std::move(cached_vertex_buffers);
+    index_buffers = std::move(cached_index_buffers);
+    textures = std::move(cached_textures);
+    primitives = std::move(cached_primitives);
+    materials = std::move(cached_materials);
+    return true;
+}
+
+void model::save_cache(const std::filesystem::path& cache_path,
+                       const std::filesystem::path& model_path,
+                       const std::vector<std::filesystem::path>& sources,
+                       bool optimized_meshes) const {
+    std::filesystem::path base_folder = model_path.parent_path();
+    auto relative_string = [&](const std::filesystem::path& path) {
+        return path.empty() ? std::string{} : path.lexically_relative(base_folder).generic_string();
+    };
+
+    utils::write_file_atomically(cache_path, [&](utils::binary_writer& writer) {
+        writer.write(kMeshCacheMagic);
+        writer.write(kMeshCacheVersion);
+        writer.write(static_cast<std::uint32_t>(sizeof(vertex)));
+        writer.write(static_cast<std::uint32_t>(sizeof(std::size_t)));
+        writer.write(static_cast<std::uint8_t>(optimized_meshes));
+
+        writer.write(static_cast<std::uint64_t>(sources.size()));
+        for (const std::filesystem::path& source : sources) {
+            writer.write_string(relative_string(source));
+            writer.write(utils::get_source_stamp(source));
+        }
+
+        writer.write_array(materials);
+        writer.write(static_cast<std::uint64_t>(vertex_buffers.size()));
+        for (std::size_t shape_i = 0; shape_i < vertex_buffers.size(); ++shape_i) {
+            writer.write_string(relative_string(textures[shape_i]));
+            writer.write(primitives[shape_i]);
+            writer.align(kMeshCacheAlignment);
+            writer.write_array(vertex_buffers[shape_i]->get_data(), vertex_buffers[shape_i]->count());
+            writer.align(kMeshCacheAlignment);
+            writer.write_array(index_buffers[shape_i]->get_data(), index_buffers[shape_i]->count());
+        }
+    });
 }
 
 float3
@@ -81,7 +430,7 @@ void model::fill_vertex_data(cg::vertex& vertex,              // vector object
                              const tinyobj::attrib_t& attrib, // data arrays
                              const tinyobj::index_t idx,      // where to find data about this vertex
                              const float3& computed_normal,
-                             const tinyobj::material_t& material) {
+                             std::uint32_t material) {
     vertex.v = {attrib.vertices[3L * idx.vertex_index],
                 attrib.vertices[(3L * idx.vertex_index) + 1],
                 attrib.vertices[(3L * idx.vertex_index) + 2]};
@@ -101,62 +450,120 @@ void model::fill_vertex_data(cg::vertex& vertex,              // vector object
         };
     }
 
-    vertex.ambient = {material.ambient[0], material.ambient[1], material.ambient[2]};
-    vertex.diffuse = {material.diffuse[0], material.diffuse[1], material.diffuse[2]};
-    vertex.emissive = {material.emission[0], material.emission[1], material.emission[2]};
+    vertex.material = material;
 }
 
-void model::fill_buffers(const std::vector<tinyobj::shape_t>& shapes,
-                         const tinyobj::attrib_t& attrib,
-                         const std::vector<tinyobj::material_t>& materials,
-                         const std::filesystem::path& base_folder) {
-    for (std::size_t shape_i = 0; shape_i < shapes.size(); ++shape_i) {
-        const tinyobj::shape_t& shape = shapes[shape_i];
-        std::shared_ptr<cg::resource<vertex>>& vertex_buffer = vertex_buffers[shape_i];
-        std::shared_ptr<cg::resource<std::size_t>>& index_buffer = index_buffers[shape_i];
-        const tinyobj::mesh_t& mesh = shape.mesh;
-
-        std::size_t index_offset = 0;
-        std::unordered_map<int3, std::size_t> index_map;
-        std::size_t index_buffer_id = 0;
-        std::size_t vertex_buffer_id = 0;
-
-        for (std::size_t face_i = 0; face_i < mesh.num_face_vertices.size(); ++face_i) {
-            unsigned char fv = mesh.num_face_vertices[face_i];
-
-            float3 normal;
-            if (mesh.indices[index_offset].normal_index < 0)
-                normal = compute_normal(attrib, mesh, index_offset);
-
-            for (std::size_t v = 0; v < fv; ++v) {
-                tinyobj::index_t idx = mesh.indices[index_offset + v]; // indices is flattened
-                int3 idx_tuple = {idx.vertex_index, idx.normal_index, idx.texcoord_index};
-
-                if (auto it = index_map.find(idx_tuple); it == index_map.end()) {
-                    it = index_map.emplace(idx_tuple, vertex_buffer_id).first;
-
-                    vertex& vertex = vertex_buffer->item(vertex_buffer_id);
-                    const tinyobj::material_t& material = materials[mesh.material_ids[face_i]];
-                    fill_vertex_data(vertex, attrib, idx, normal, material);
-
-                    ++vertex_buffer_id;
-                }
-                index_buffer->item(index_buffer_id) = index_map[idx_tuple];
-                ++index_buffer_id;
+void model::begin_buffers(std::size_t shape_count, const std::vector<tinyobj::material_t>& source_materials) {
+    materials.clear();
+    materials.reserve(source_materials.size());
+    for (const tinyobj::material_t& source : source_materials) {
+        materials.push_back({float3{source.ambient[0], source.ambient[1], source.ambient[2]},
+                             float3{source.diffuse[0], source.diffuse[1], source.diffuse[2]},
+                             float3{source.emission[0], source.emission[1], source.emission[2]}});
+    }
+
+    vertex_buffers.assign(shape_count, nullptr);
+    index_buffers.assign(shape_count, nullptr);
+    textures.assign(shape_count, {});
+    primitives.assign(shape_count, {});
+}
+
+// Buffers grow in a single sweep over the faces, with one lookup per face corner to share repeated vertices
+void model::fill_shape_buffers(std::size_t shape_i,
+                               const tinyobj::mesh_t& mesh,
+                               const tinyobj::attrib_t& attrib,
+                               const std::vector<tinyobj::material_t>& source_materials,
+                               const std::filesystem::path& base_folder,
+                               bool optimize_meshes,
+                               vertex_index_table& index_table) {
+    std::vector<vertex> vertices;
+    std::vector<std::size_t> indices;
+    indices.reserve(mesh.indices.size());
+    index_table.reset(mesh.indices.size());
+
+    std::size_t index_offset = 0;
+    for (std::size_t face_i = 0; face_i < mesh.num_face_vertices.size(); ++face_i) {
+        unsigned char fv = mesh.num_face_vertices[face_i];
+
+        float3 normal;
+        if (mesh.indices[index_offset].normal_index < 0)
+            normal = compute_normal(attrib, mesh, index_offset);
+
+        for (std::size_t v = 0; v < fv; ++v) {
+            tinyobj::index_t idx = mesh.indices[index_offset + v]; // indices is flattened
+            int material = mesh.material_ids[face_i];
+            int4 idx_tuple = {idx.vertex_index, idx.normal_index, idx.texcoord_index, material};
+
+            bool inserted = false;
+            std::uint32_t index =
+                index_table.find_or_insert(idx_tuple, static_cast<std::uint32_t>(vertices.size()), inserted);
+            if (inserted) {
+                auto material_index = static_cast<std::uint32_t>(material);
+                fill_vertex_data(vertices.emplace_back(), attrib, idx, normal, material_index);
             }
-            index_offset += fv;
-        }
-        if (!materials[mesh.material_ids[0]].diffuse_texname.empty()) {
-            textures[shape_i] = base_folder / materials[mesh.material_ids[0]].diffuse_texname;
+            indices.push_back(index);
         }
+        index_offset += fv;
+    }
+
+    if (optimize_meshes) {
+        optimize_vertex_cache(indices, vertices.size());
+        optimize_overdraw(indices, vertices);
+        optimize_vertex_fetch(indices, vertices);
+    }
+
+    vertex_buffers[shape_i] = std::make_shared<resource<vertex>>(std::move(vertices));
+    index_buffers[shape_i] = std::make_shared<resource<std::size_t>>(std::move(indices));
+    if (!source_materials[mesh.material_ids[0]].diffuse_texname.empty()) {
+        textures[shape_i] = base_folder / source_materials[mesh.material_ids[0]].diffuse_texname;
     }
-    textures.resize(shapes.size());
+    primitives[shape_i] = fit_primitive(*vertex_buffers[shape_i], *index_buffers[shape_i]);
+    if (shape_callback)
+        shape_callback(shape_i);
+}
+
+// Shapes are independent, so they are converted in parallel with a lookup table per thread
+void model::fill_buffers(const std::vector<tinyobj::shape_t>& shapes,
+                         const tinyobj::attrib_t& attrib,
+                         const std::vector<tinyobj::material_t>& source_materials,
+                         const std::filesystem::path& base_folder,
+                         bool optimize_meshes) {
+    begin_buffers(shapes.size(), source_materials);
+
+    std::vector<std::size_t> shape_order = utils::get_largest_first_order(
+        shapes.size(), [&](std::size_t shape_i) { return shapes[shape_i].mesh.indices.size(); });
+
+    std::size_t thread_count = utils::get_hardware_thread_count();
+    std::vector<vertex_index_table> index_tables(thread_count);
+    utils::parallel_for(shapes.size(), thread_count, [&](std::size_t order_i, std::size_t worker) {
+        std::size_t shape_i = shape_order[order_i];
+        fill_shape_buffers(shape_i,
+                           shapes[shape_i].mesh,
+                           attrib,
+                           source_materials,
+                           base_folder,
+                           optimize_meshes,
+                           index_tables[worker]);
+    });
 }
 
 const std::vector<std::shared_ptr<cg::resource<cg::vertex>>>& cg::world::model::get_vertex_buffers() const {
     return vertex_buffers;
 }
 
+const std::vector<std::shared_ptr<cg::resource<cg::packed_vertex>>>&
+cg::world::model::get_packed_vertex_buffers() const {
+    return packed_vertex_buffers;
+}
+
+const std::vector<cg::vertex_quantization>& cg::world::model::get_vertex_quantizations() const {
+    return vertex_quantizations;
+}
+
+const std::vector<cg::vertex_streams>& cg::world::model::get_vertex_streams() const {
+    return vertex_streams;
+}
+
 const std::vector<std::shared_ptr<cg::resource<std::size_t>>>& cg::world::model::get_index_buffers() const {
     return index_buffers;
 }
@@ -165,6 +572,269 @@ const std::vector<std::filesystem::path>& cg::world::model::get_per_shape_textur
     return textures;
 }
 
+const std::vector<texture_future>& cg::world::model::get_per_shape_textures() const {
+    return texture_futures;
+}
+
+void cg::world::model::set_texture_cache(std::shared_ptr<texture_cache> in_texture_cache) {
+    texture_source = std::move(in_texture_cache);
+}
+
+std::shared_ptr<texture_cache> cg::world::model::get_texture_cache() const {
+    return texture_source;
+}
+
+void cg::world::model::set_shape_callback(std::function<void(std::size_t shape_index)> in_shape_callback) {
+    shape_callback = std::move(in_shape_callback);
+}
+
+// Files already requested while parsing come back from the cache, decoded or in flight
+void model::request_textures() {
+    texture_futures.assign(textures.size(), {});
+    if (!texture_source)
+        return;
+    for (std::size_t shape_i = 0; shape_i < textures.size(); ++shape_i) {
+        if (!textures[shape_i].empty())
+            texture_futures[shape_i] = texture_source->request(textures[shape_i]);
+    }
+}
+
+void model::append(std::vector<model> parts) {
+    std::size_t first_new_shape = index_buffers.size();
+    // Once any side was merged, every shape gets a range, so they stay indexed by shape as loaded
+    bool keep_ranges = !shape_ranges.empty() || std::any_of(parts.begin(), parts.end(), [](const model& part) {
+        return !part.shape_ranges.empty();
+    });
+    auto fill_ranges = [](model& source) {
+        if (!source.shape_ranges.empty())
+            return;
+        for (std::size_t shape_i = 0; shape_i < source.index_buffers.size(); ++shape_i) {
+            source.shape_ranges.push_back(
+                {shape_i, 0, source.vertex_buffers[shape_i]->count(), 0, source.index_buffers[shape_i]->count()});
+        }
+    };
+    if (keep_ranges)
+        fill_ranges(*this);
+
+    for (model& part : parts) {
+        if (part.vertex_buffers.size() != part.index_buffers.size() ||
+            vertex_buffers.size() != index_buffers.size())
+            THROW_ERROR("Only models with full vertices can be appended");
+
+        std::size_t shape_offset = index_buffers.size();
+        if (keep_ranges)
+            fill_ranges(part);
+        // Vertices are rewritten in place, so a part mapped from its mesh cache copies only the pages it touches
+        auto material_offset = static_cast<std::uint32_t>(materials.size());
+        if (material_offset != 0) {
+            utils::parallel_for(
+                part.vertex_buffers.size(), utils::get_hardware_thread_count(), [&](std::size_t shape_i, std::size_t) {
+                    resource<vertex>& vertices = *part.vertex_buffers[shape_i];
+                    for (std::size_t vertex_i = 0; vertex_i < vertices.count(); ++vertex_i)
+                        vertices.item(vertex_i).material += material_offset;
+                });
+        }
+        materials.insert(materials.end(), part.materials.begin(), part.materials.end());
+
+        auto move_back = [](auto& target, auto& source) {
+            target.insert(target.end(), std::make_move_iterator(source.begin()), std::make_move_iterator(source.end()));
+        };
+        move_back(vertex_buffers, part.vertex_buffers);
+        move_back(index_buffers, part.index_buffers);
+        move_back(textures, part.textures);
+        move_back(texture_futures, part.texture_futures);
+        move_back(primitives, part.primitives);
+        if (keep_ranges) {
+            for (shape_range& range : part.shape_ranges)
+                range.shape += shape_offset;
+            move_back(shape_ranges, part.shape_ranges);
+        }
+    }
+    if (shape_callback) {
+        for (std::size_t shape_i = first_new_shape; shape_i < index_buffers.size(); ++shape_i)
+            shape_callback(shape_i);
+    }
+}
+
+// Groups keep the order of their first shape, and shapes keep their order within a group, so drawing order
+// changes as little as possible. A group of one keeps its buffers.
+void model::merge_shapes() {
+    static constexpr std::uint32_t kMixedMaterials = std::numeric_limits<std::uint32_t>::max();
+    std::size_t shape_count = index_buffers.size();
+    if (vertex_buffers.size() != shape_count)
+        THROW_ERROR("Only models with full vertices can merge their shapes");
+
+    std::vector<std::vector<std::size_t>> groups;
+    std::map<std::pair<std::string, std::uint32_t>, std::size_t> group_of_key;
+    for (std::size_t shape_i = 0; shape_i < shape_count; ++shape_i) {
+        const resource<vertex>& vertices = *vertex_buffers[shape_i];
+        if (primitives[shape_i].type != primitive_type::mesh || vertices.count() == 0) {
+            groups.push_back({shape_i});
+            continue;
+        }
+        // Vertices keep their own material, so shapes that mix several can share one group per texture
+        std::uint32_t material = vertices.item(0).material;
+        for (std::size_t vertex_i = 1; vertex_i < vertices.count(); ++vertex_i) {
+            if (vertices.item(vertex_i).material != material) {
+                material = kMixedMaterials;
+                break;
+            }
+        }
+        auto key = std::make_pair(textures[shape_i].lexically_normal().generic_string(), material);
+        auto [found, inserted] = group_of_key.try_emplace(key, groups.size());
+        if (inserted)
+            groups.emplace_back();
+        groups[found->second].push_back(shape_i);
+    }
+
+    std::vector<shape_range> ranges(shape_count);
+    std::vector<std::shared_ptr<resource<vertex>>> merged_vertex_buffers(groups.size());
+    std::vector<std::shared_ptr<resource<std::size_t>>> merged_index_buffers(groups.size());
+    utils::parallel_for(groups.size(), utils::get_hardware_thread_count(), [&](std::size_t group_i, std::size_t) {
+        const std::vector<std::size_t>& group = groups[group_i];
+        if (group.size() == 1) {
+            std::size_t shape_i = group.front();
+            merged_vertex_buffers[group_i] = vertex_buffers[shape_i];
+            merged_index_buffers[group_i] = index_buffers[shape_i];
+            ranges[shape_i] = {group_i, 0, vertex_buffers[shape_i]->count(), 0, index_buffers[shape_i]->count()};
+            return;
+        }
+
+        std::size_t vertex_count = 0;
+        std::size_t index_count = 0;
+        for (std::size_t shape_i : group) {
+            vertex_count += vertex_buffers[shape_i]->count();
+            index_count += index_buffers[shape_i]->count();
+        }
+        std::vector<vertex> vertices;
+        std::vector<std::size_t> indices;
+        vertices.reserve(vertex_count);
+        indices.reserve(index_count);
+        for (std::size_t shape_i : group) {
+            const resource<vertex>& source_vertices = *vertex_buffers[shape_i];
+            const resource<std::size_t>& source_indices = *index_buffers[shape_i];
+            std::size_t base_vertex = vertices.size();
+            ranges[shape_i] = {group_i, base_vertex, source_vertices.count(), indices.size(), source_indices.count()};
+            const vertex* source = source_vertices.get_data();
+            vertices.insert(vertices.end(), source, source + source_vertices.count());
+            for (std::size_t index_i = 0; index_i < source_indices.count(); ++index_i)
+                indices.push_back(base_vertex + source_indices.item(index_i));
+        }
+        merged_vertex_buffers[group_i] = std::make_shared<resource<vertex>>(std::move(vertices));
+        merged_index_buffers[group_i] = std::make_shared<resource<std::size_t>>(std::move(indices));
+    });
+
+    std::vector<std::filesystem::path> merged_textures;
+    std::vector<texture_future> merged_texture_futures;
+    std::vector<shape_primitive> merged_primitives;
+    for (const std::vector<std::size_t>& group : groups) {
+        merged_textures.push_back(textures[group.front()]);
+        merged_texture_futures.push_back(texture_futures[group.front()]);
+        merged_primitives.push_back(group.size() == 1 ? primitives[group.front()] : shape_primitive{});
+    }
+
+    // Ranges already kept from an earlier merge point at the shapes merged now
+    if (!shape_ranges.empty()) {
+        for (shape_range& range : shape_ranges) {
+            const shape_range& outer = ranges[range.shape];
+            range = {outer.shape,
+                     outer.first_vertex + range.first_vertex,
+                     range.vertex_count,
+                     outer.first_index + range.first_index,
+                     range.index_count};
+        }
+    } else
+        shape_ranges = std::move(ranges);
+
+    vertex_buffers = std::move(merged_vertex_buffers);
+    index_buffers = std::move(merged_index_buffers);
+    textures = std::move(merged_textures);
+    texture_futures = std::move(merged_texture_futures);
+    primitives = std::move(merged_primitives);
+}
+
+const std::vector<shape_range>& cg::world::model::get_shape_ranges() const {
+    return shape_ranges;
+}
+
+void model::split_vertex_streams() {
+    std::size_t shape_count = vertex_buffers.size();
+    vertex_streams.assign(shape_count, {});
+    utils::parallel_for(shape_count, utils::get_hardware_thread_count(), [&](std::size_t shape_i, std::size_t) {
+        vertex_streams[shape_i] = cg::vertex_streams::from_vertices(*vertex_buffers[shape_i]);
+    });
+    vertex_buffers.clear();
+}
+
+quantization_stats model::quantize_vertices() {
+    static constexpr float kDegreesPerRadian = 57.2957795F;
+    if (materials.size() > std::numeric_limits<std::uint16_t>::max() + 1U)
+        THROW_ERROR("Too many materials to quantize vertices: " + std::to_string(materials.size()));
+
+    std::size_t shape_count = vertex_buffers.size();
+    packed_vertex_buffers.assign(shape_count, nullptr);
+    vertex_quantizations.assign(shape_count, {});
+    std::vector<quantization_stats> shape_stats(shape_count);
+    utils::parallel_for(shape_count, utils::get_hardware_thread_count(), [&](std::size_t shape_i, std::size_t) {
+        const resource<vertex>& vertices = *vertex_buffers[shape_i];
+        float3 bounds_min{std::numeric_limits<float>::max()};
+        float3 bounds_max{-std::numeric_limits<float>::max()};
+        for (std::size_t vertex_i = 0; vertex_i < vertices.count(); ++vertex_i) {
+            bounds_min = linalg::min(bounds_min, vertices.item(vertex_i).v);
+            bounds_max = linalg::max(bounds_max, vertices.item(vertex_i).v);
+        }
+        vertex_quantization quantization = vertices.count() != 0
+                                               ? vertex_quantization::from_bounds(bounds_min, bounds_max)
+                                               : vertex_quantization{};
+        float extent = vertices.count() != 0 ? linalg::maxelem(bounds_max - bounds_min) : 0.F;
+
+        quantization_stats& stats = shape_stats[shape_i];
+        std::vector<packed_vertex> packed(vertices.count());
+        for (std::size_t vertex_i = 0; vertex_i < vertices.count(); ++vertex_i) {
+            const vertex& source = vertices.item(vertex_i);
+            packed[vertex_i] = quantization.encode(source);
+
+            vertex decoded = quantization.decode(packed[vertex_i]);
+            if (extent > 0.F) {
+                float error = linalg::maxelem(linalg::abs(decoded.v - source.v)) / extent;
+                stats.max_position_error = std::max(stats.max_position_error, error);
+            }
+            float normal_cosine = linalg::dot(decoded.n, linalg::normalize(source.n));
+            float normal_error = std::acos(std::clamp(normal_cosine, -1.F, 1.F)) * kDegreesPerRadian;
+            stats.max_normal_error = std::max(stats.max_normal_error, normal_error);
+            float texcoord_error = linalg::maxelem(linalg::abs(decoded.tex - source.tex));
+            stats.max_texcoord_error = std::max(stats.max_texcoord_error, texcoord_error);
+        }
+        stats.full_bytes = vertices.count() * sizeof(vertex);
+        stats.packed_bytes = packed.size() * sizeof(packed_vertex);
+        vertex_quantizations[shape_i] = quantization;
+        packed_vertex_buffers[shape_i] = std::make_shared<resource<packed_vertex>>(std::move(packed));
+    });
+    vertex_buffers.clear();
+
+    quantization_stats total;
+    for (const quantization_stats& stats : shape_stats) {
+        total.full_bytes += stats.full_bytes;
+        total.packed_bytes += stats.packed_bytes;
+        total.max_position_error = std::max(total.max_position_error, stats.max_position_error);
+        total.max_normal_error = std::max(total.max_normal_error, stats.max_normal_error);
+        total.max_texcoord_error = std::max(total.max_texcoord_error, stats.max_texcoord_error);
+    }
+    return total;
+}
+
+const std::vector<shape_primitive>& cg::world::model::get_per_shape_primitives() const {
+    return primitives;
+}
+
+const std::vector<cg::material>& cg::world::model::get_materials() const {
+    return materials;
+}
+
 const float4x4 cg::world::model::get_world_matrix() const {
-    return float4x4{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    return world_matrix;
+}
+
+void cg::world::model::set_world_matrix(const float4x4& in_world_matrix) {
+    world_matrix = in_world_matrix;
 }
@@ -1,46 +1,144 @@
 #pragma once
 
+#include "primitive.h"
 #include "resource.h"
+#include "texture_cache.h"
 
 #include <linalg.h>
 #include <tiny_obj_loader.h>
 
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
 
 namespace cg::world {
 
 using namespace linalg::aliases;
 
+class vertex_index_table;
+
+// Precision lost by `model::quantize_vertices`, measured against the full vertices it replaced
+struct quantization_stats {
+    std::size_t full_bytes = 0;
+    std::size_t packed_bytes = 0;
+    float max_position_error = 0.F; // relative to the largest extent of the shape's bounds
+    float max_normal_error = 0.F;   // degrees
+    float max_texcoord_error = 0.F;
+};
+
+// Where a shape as loaded ended up after `model::merge_shapes`
+struct shape_range {
+    std::size_t shape = 0; // merged shape that holds it
+    std::size_t first_vertex = 0;
+    std::size_t vertex_count = 0;
+    std::size_t first_index = 0;
+    std::size_t index_count = 0;
+};
+
 class model {
   public:
     model() = default;
 
-    void load_obj(const std::filesystem::path& model_path);
+    // Picks the loader from the extension: `.glb` files go to `load_glb`, anything else to `load_obj`
+    void load(const std::filesystem::path& model_path, bool use_cache = false, bool optimize_meshes = false);
+    // With `use_cache`, a binary copy of the buffers is kept next to the OBJ and mapped on later loads while it
+    // is newer than the OBJ and its material libraries. `optimize_meshes` reorders every shape's triangles and
+    // vertices for the post-transform cache, overdraw and vertex fetch.
+    void load_obj(const std::filesystem::path& model_path, bool use_cache = false, bool optimize_meshes = false);
+    // Binary glTF 2.0: one shape per triangle primitive the default scene places, with the node transforms baked in,
+    // and materials from the base color, emissive factor and base color texture. It is already binary and indexed,
+    // so it needs no mesh cache.
+    void load_glb(const std::filesystem::path& model_path, bool optimize_meshes = false);
+    // Later loads start decoding the textures as soon as the materials are known, alongside the geometry
+    void set_texture_cache(std::shared_ptr<texture_cache> in_texture_cache);
+    [[nodiscard]] std::shared_ptr<texture_cache> get_texture_cache() const;
+    // Later loads call it with each shape's index as soon as that shape's buffers, texture file and primitive are
+    // in place, on whichever loading thread finished it. The per-shape vectors keep their size from the first
+    // call on, so other threads may read the slots of shapes reported so far.
+    void set_shape_callback(std::function<void(std::size_t shape_index)> in_shape_callback);
 
+    // Moves the shapes, materials and textures of `parts` behind this model's, renumbering the parts' materials,
+    // then reports the new shapes to the shape callback all at once. Every model involved must hold full vertices.
+    void append(std::vector<model> parts);
+
+    // Merges the mesh shapes that share a texture and a material into one shape each, concatenating their buffers,
+    // so each group takes a single draw and bottom-level structure. Shapes recognized as analytic primitives stay
+    // apart. Needs full vertices.
+    void merge_shapes();
+    // Per shape as loaded, where `merge_shapes` put it; empty unless it ran
+    [[nodiscard]] const std::vector<shape_range>& get_shape_ranges() const;
+
+    // Swaps every vertex buffer for `packed_vertex` one with a per-shape quantization, releasing the full vertices
+    quantization_stats quantize_vertices();
+
+    // Swaps every vertex buffer for per-member streams, releasing the interleaved vertices
+    void split_vertex_streams();
+
+    // Empty once the vertices are quantized or split into streams
     [[nodiscard]] const std::vector<std::shared_ptr<cg::resource<cg::vertex>>>& get_vertex_buffers() const;
+    [[nodiscard]] const std::vector<std::shared_ptr<cg::resource<cg::packed_vertex>>>&
+    get_packed_vertex_buffers() const;
+    [[nodiscard]] const std::vector<cg::vertex_quantization>& get_vertex_quantizations() const;
+    [[nodiscard]] const std::vector<cg::vertex_streams>& get_vertex_streams() const;
     [[nodiscard]] const std::vector<std::shared_ptr<cg::resource<std::size_t>>>& get_index_buffers() const;
     [[nodiscard]] const std::vector<std::filesystem::path>& get_per_shape_texture_files() const;
+    // Filled with a texture cache only; shapes without a texture get an invalid future
+    [[nodiscard]] const std::vector<texture_future>& get_per_shape_textures() const;
+    [[nodiscard]] const std::vector<shape_primitive>& get_per_shape_primitives() const;
+    // Indexed by `vertex::material`
+    [[nodiscard]] const std::vector<cg::material>& get_materials() const;
 
     [[nodiscard]] const float4x4 get_world_matrix() const;
+    void set_world_matrix(const float4x4& in_world_matrix);
 
   protected:
     // NOLINTBEGIN(*-non-private-*)
     std::vector<std::shared_ptr<cg::resource<cg::vertex>>> vertex_buffers;
     std::vector<std::shared_ptr<cg::resource<std::size_t>>> index_buffers;
+    std::vector<std::shared_ptr<cg::resource<cg::packed_vertex>>> packed_vertex_buffers;
+    std::vector<cg::vertex_quantization> vertex_quantizations;
+    std::vector<cg::vertex_streams> vertex_streams;
     std::vector<std::filesystem::path> textures;
+    std::vector<texture_future> texture_futures;
+    std::shared_ptr<texture_cache> texture_source;
+    std::function<void(std::size_t shape_index)> shape_callback;
+    std::vector<shape_primitive> primitives;
+    std::vector<shape_range> shape_ranges;
+    std::vector<cg::material> materials;
+    float4x4 world_matrix = linalg::identity;
     // NOLINTEND(*-non-private-*)
 
-    void allocate_buffers(const std::vector<tinyobj::shape_t>& shapes);
+    void request_textures();
+    bool load_cache(const std::filesystem::path& cache_path,
+                    const std::filesystem::path& model_path,
+                    bool optimized_meshes);
+    void save_cache(const std::filesystem::path& cache_path,
+                    const std::filesystem::path& model_path,
+                    const std::vector<std::filesystem::path>& sources,
+                    bool optimized_meshes) const;
+
     static float3 compute_normal(const tinyobj::attrib_t& attrib, const tinyobj::mesh_t& mesh, size_t index_offset);
     static void fill_vertex_data(cg::vertex& vertex,
                                  const tinyobj::attrib_t& attrib,
                                  tinyobj::index_t idx,
                                  const float3& computed_normal,
-                                 const tinyobj::material_t& material);
+                                 std::uint32_t material);
+    // Converts the materials and sizes the per-shape arrays for `fill_shape_buffers`
+    void begin_buffers(std::size_t shape_count, const std::vector<tinyobj::material_t>& source_materials);
+    // Converts one shape and reports it; shapes may be filled concurrently, each with its own `index_table`
+    void fill_shape_buffers(std::size_t shape_i,
+                            const tinyobj::mesh_t& mesh,
+                            const tinyobj::attrib_t& attrib,
+                            const std::vector<tinyobj::material_t>& source_materials,
+                            const std::filesystem::path& base_folder,
+                            bool optimize_meshes,
+                            vertex_index_table& index_table);
     void fill_buffers(const std::vector<tinyobj::shape_t>& shapes,
                       const tinyobj::attrib_t& attrib,
-                      const std::vector<tinyobj::material_t>& materials,
-                      const std::filesystem::path& base_folder);
+                      const std::vector<tinyobj::material_t>& source_materials,
+                      const std::filesystem::path& base_folder,
+                      bool optimize_meshes);
 };
 } // namespace cg::world
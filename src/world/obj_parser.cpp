@@ -0,0 +1,525 @@
+#include "obj_parser.h"
+
+#include "utils/error_handler.h"
+#include "utils/mapped_file.h"
+#include "utils/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+// Several chunks per thread keep the threads busy when some chunks hold far more faces than others
+constexpr std::size_t kChunksPerThread = 4;
+constexpr std::size_t kMinChunkSize = 256 * 1024;
+
+struct obj_chunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    // Attribute counts from the first sweep, then where the chunk's attributes start in the merged arrays
+    std::size_t vertex_count = 0;
+    std::size_t normal_count = 0;
+    std::size_t texcoord_count = 0;
+    std::size_t vertex_offset = 0;
+    std::size_t normal_offset = 0;
+    std::size_t texcoord_offset = 0;
+
+    // The layout from the first sweep, so shapes and materials are known before the faces are parsed
+    std::size_t triangle_count = 0;
+    std::vector<std::pair<std::size_t, std::string>> shape_starts;    // triangle count at each `o` or `g` line
+    std::vector<std::pair<std::size_t, std::string>> material_starts; // triangle count at each `usemtl` line
+    std::vector<std::string> material_libraries;
+    // Resolved `usemtl` names, and the material in effect before the first of them
+    std::vector<int> material_ids;
+    int first_material = -1;
+
+    std::vector<tinyobj::index_t> indices; // three per triangle, from the second sweep
+    // Largest attribute index the faces reference, then the number of leading chunks that define all of them
+    int max_vertex_index = -1;
+    int max_normal_index = -1;
+    int max_texcoord_index = -1;
+    std::size_t required_chunks = 0;
+    std::size_t pending_shapes = 0; // shapes with triangles here that are still to be gathered
+};
+
+// Triangles `begin` to `end` of a chunk
+struct shape_part {
+    std::size_t chunk;
+    std::size_t begin;
+    std::size_t end;
+};
+
+bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* skip_blanks(const char* cursor, const char* end) {
+    while (cursor < end && is_blank(*cursor))
+        ++cursor;
+    return cursor;
+}
+
+const char* find_line_end(const char* cursor, const char* end) {
+    const void* newline = std::memchr(cursor, '\n', static_cast<std::size_t>(end - cursor));
+    return newline != nullptr ? static_cast<const char*>(newline) : end;
+}
+
+std::string_view read_token(const char*& cursor, const char* end) {
+    cursor = skip_blanks(cursor, end);
+    const char* begin = cursor;
+    while (cursor < end && !is_blank(*cursor))
+        ++cursor;
+    return {begin, static_cast<std::size_t>(cursor - begin)};
+}
+
+// Whole remainder of the line without surrounding blanks, for names that may contain spaces
+std::string read_name(const char* cursor, const char* end) {
+    cursor = skip_blanks(cursor, end);
+    while (end > cursor && is_blank(end[-1]))
+        --end;
+    return {cursor, static_cast<std::size_t>(end - cursor)};
+}
+
+bool is_keyword(const char* cursor, const char* end, std::string_view keyword) {
+    auto length = static_cast<std::ptrdiff_t>(keyword.size());
+    return end - cursor >= length && std::memcmp(cursor, keyword.data(), keyword.size()) == 0 &&
+           (end - cursor == length || is_blank(cursor[length]));
+}
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+int parse_int(const char*& cursor, const char* end) {
+    bool negative = cursor < end && *cursor == '-';
+    if (cursor < end && (*cursor == '-' || *cursor == '+'))
+        ++cursor;
+    int value = 0;
+    for (; cursor < end && is_digit(*cursor); ++cursor)
+        value = value * 10 + (*cursor - '0');
+    return negative ? -value : value;
+}
+
+// Decimal mantissa and exponent gathered in integers and scaled once. Digits past the 19th only shift the
+// exponent, which is far below float precision.
+float parse_float(const char*& cursor, const char* end) {
+    static constexpr int kMaxMantissaDigits = 19;
+    static constexpr double kPowers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    static constexpr int kMaxPower = 22;
+
+    cursor = skip_blanks(cursor, end);
+    bool negative = cursor < end && *cursor == '-';
+    if (cursor < end && (*cursor == '-' || *cursor == '+'))
+        ++cursor;
+
+    std::uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; cursor < end && is_digit(*cursor); ++cursor) {
+        if (digits < kMaxMantissaDigits) {
+            mantissa = mantissa * 10 + static_cast<std::uint64_t>(*cursor - '0');
+            digits += mantissa != 0 ? 1 : 0;
+        } else
+            ++exponent;
+    }
+    if (cursor < end && *cursor == '.') {
+        for (++cursor; cursor < end && is_digit(*cursor); ++cursor) {
+            if (digits < kMaxMantissaDigits) {
+                mantissa = mantissa * 10 + static_cast<std::uint64_t>(*cursor - '0');
+                digits += mantissa != 0 ? 1 : 0;
+                --exponent;
+            }
+        }
+    }
+    if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+        ++cursor;
+        exponent += parse_int(cursor, end);
+    }
+
+    auto value = static_cast<double>(mantissa);
+    if (exponent != 0 && mantissa != 0) {
+        if (exponent >= -kMaxPower && exponent <= kMaxPower)
+            value = exponent > 0 ? value * kPowers[exponent] : value / kPowers[-exponent];
+        else
+            value *= std::pow(10.0, exponent);
+    }
+    return static_cast<float>(negative ? -value : value);
+}
+
+// OBJ indices are 1-based, or relative to the `defined` attributes read so far when negative; either way they
+// have to land among the `total` attributes of the file
+int parse_index(const char*& cursor, const char* end, std::size_t defined, std::size_t total) {
+    const char* begin = cursor;
+    int value = parse_int(cursor, end);
+    if (cursor == begin || !is_digit(cursor[-1]))
+        THROW_ERROR("Invalid OBJ face index '" + std::string(begin, std::min(end, begin + 16)) + "'");
+    auto resolved = value > 0 ? static_cast<long long>(value) - 1 : static_cast<long long>(defined) + value;
+    if (value == 0 || resolved < 0 || resolved >= static_cast<long long>(total))
+        THROW_ERROR("OBJ face index " + std::to_string(value) + " is out of range");
+    return static_cast<int>(resolved);
+}
+
+tinyobj::index_t parse_corner(const char*& cursor,
+                              const char* end,
+                              const obj_chunk& chunk,
+                              const tinyobj::attrib_t& attrib) {
+    tinyobj::index_t index;
+    index.vertex_index =
+        parse_index(cursor, end, chunk.vertex_offset + chunk.vertex_count, attrib.vertices.size() / 3);
+    if (cursor < end && *cursor == '/') {
+        ++cursor;
+        if (cursor < end && *cursor != '/') {
+            index.texcoord_index =
+                parse_index(cursor, end, chunk.texcoord_offset + chunk.texcoord_count, attrib.texcoords.size() / 2);
+        }
+        if (cursor < end && *cursor == '/') {
+            ++cursor;
+            index.normal_index =
+                parse_index(cursor, end, chunk.normal_offset + chunk.normal_count, attrib.normals.size() / 3);
+        }
+    }
+    if (cursor < end && !is_blank(*cursor))
+        THROW_ERROR("Invalid OBJ face corner at '" + std::string(cursor, std::min(end, cursor + 16)) + "'");
+    return index;
+}
+
+// Corners run up to the end of the line or a trailing comment
+std::size_t count_corners(const char* cursor, const char* end) {
+    std::size_t count = 0;
+    for (cursor = skip_blanks(cursor, end); cursor < end && *cursor != '#'; cursor = skip_blanks(cursor, end)) {
+        while (cursor < end && !is_blank(*cursor))
+            ++cursor;
+        ++count;
+    }
+    return count;
+}
+
+// Counts attributes and triangles, and notes where shapes and materials start, without parsing any numbers
+void scan_chunk(obj_chunk& chunk) {
+    for (const char* line = chunk.begin; line < chunk.end;) {
+        const char* line_end = find_line_end(line, chunk.end);
+        const char* cursor = skip_blanks(line, line_end);
+        line = line_end + 1;
+
+        if (is_keyword(cursor, line_end, "v")) {
+            ++chunk.vertex_count;
+        } else if (is_keyword(cursor, line_end, "vn")) {
+            ++chunk.normal_count;
+        } else if (is_keyword(cursor, line_end, "vt")) {
+            ++chunk.texcoord_count;
+        } else if (is_keyword(cursor, line_end, "f")) {
+            std::size_t corner_count = count_corners(cursor + 1, line_end);
+            chunk.triangle_count += corner_count > 2 ? corner_count - 2 : 0;
+        } else if (is_keyword(cursor, line_end, "usemtl")) {
+            chunk.material_starts.emplace_back(chunk.triangle_count, read_name(cursor + 6, line_end));
+        } else if (is_keyword(cursor, line_end, "o") || is_keyword(cursor, line_end, "g")) {
+            chunk.shape_starts.emplace_back(chunk.triangle_count, read_name(cursor + 1, line_end));
+        } else if (is_keyword(cursor, line_end, "mtllib")) {
+            cursor += 6;
+            for (std::string_view file = read_token(cursor, line_end); !file.empty();
+                 file = read_token(cursor, line_end))
+                chunk.material_libraries.emplace_back(file);
+        }
+    }
+}
+
+// Writes the chunk's attributes straight into the merged arrays and collects its triangles
+void parse_chunk(obj_chunk& chunk, tinyobj::attrib_t& attrib) {
+    chunk.vertex_count = 0;
+    chunk.normal_count = 0;
+    chunk.texcoord_count = 0;
+    chunk.indices.reserve(3 * chunk.triangle_count);
+    std::vector<tinyobj::index_t> polygon;
+
+    for (const char* line = chunk.begin; line < chunk.end;) {
+        const char* line_end = find_line_end(line, chunk.end);
+        const char* cursor = skip_blanks(line, line_end);
+        line = line_end + 1;
+
+        if (is_keyword(cursor, line_end, "v")) {
+            float* position = &attrib.vertices[3 * (chunk.vertex_offset + chunk.vertex_count++)];
+            cursor += 1;
+            for (std::size_t i = 0; i < 3; ++i)
+                position[i] = parse_float(cursor, line_end);
+        } else if (is_keyword(cursor, line_end, "vn")) {
+            float* normal = &attrib.normals[3 * (chunk.normal_offset + chunk.normal_count++)];
+            cursor += 2;
+            for (std::size_t i = 0; i < 3; ++i)
+                normal[i] = parse_float(cursor, line_end);
+        } else if (is_keyword(cursor, line_end, "vt")) {
+            float* texcoord = &attrib.texcoords[2 * (chunk.texcoord_offset + chunk.texcoord_count++)];
+            cursor += 2;
+            for (std::size_t i = 0; i < 2; ++i)
+                texcoord[i] = parse_float(cursor, line_end);
+        } else if (is_keyword(cursor, line_end, "f")) {
+            polygon.clear();
+            for (cursor = skip_blanks(cursor + 1, line_end); cursor < line_end && *cursor != '#';
+                 cursor = skip_blanks(cursor, line_end)) {
+                const tinyobj::index_t& corner = polygon.emplace_back(parse_corner(cursor, line_end, chunk, attrib));
+                chunk.max_vertex_index = std::max(chunk.max_vertex_index, corner.vertex_index);
+                chunk.max_normal_index = std::max(chunk.max_normal_index, corner.normal_index);
+                chunk.max_texcoord_index = std::max(chunk.max_texcoord_index, corner.texcoord_index);
+            }
+            for (std::size_t i = 1; i + 1 < polygon.size(); ++i)
+                chunk.indices.insert(chunk.indices.end(), {polygon[0], polygon[i], polygon[i + 1]});
+        }
+    }
+}
+
+// Faces may reference attributes from any chunk, even later ones
+std::size_t count_required_chunks(const std::vector<obj_chunk>& chunks, const obj_chunk& chunk) {
+    auto count_up_to = [&](int index, std::size_t obj_chunk::*offset) -> std::size_t {
+        if (index < 0)
+            return 0;
+        // Chunks that start at or before `index`; the last of them defines it
+        return static_cast<std::size_t>(
+            std::upper_bound(chunks.begin(),
+                             chunks.end(),
+                             static_cast<std::size_t>(index),
+                             [&](std::size_t value, const obj_chunk& other) { return value < other.*offset; }) -
+            chunks.begin());
+    };
+    return std::max({count_up_to(chunk.max_vertex_index, &obj_chunk::vertex_offset),
+                     count_up_to(chunk.max_normal_index, &obj_chunk::normal_offset),
+                     count_up_to(chunk.max_texcoord_index, &obj_chunk::texcoord_offset)});
+}
+
+std::vector<obj_chunk> split_into_chunks(const char* data, std::size_t size, std::size_t thread_count) {
+    std::size_t chunk_count = std::max<std::size_t>(1, std::min(thread_count * kChunksPerThread, size / kMinChunkSize));
+    std::size_t chunk_size = size / chunk_count;
+
+    std::vector<obj_chunk> chunks;
+    const char* end = data + size;
+    for (const char* begin = data; begin < end;) {
+        const char* chunk_end = end;
+        if (chunks.size() + 1 < chunk_count)
+            chunk_end = std::min(end, find_line_end(std::min(end, begin + chunk_size), end) + 1);
+        chunks.emplace_back().begin = begin;
+        chunks.back().end = chunk_end;
+        begin = chunk_end;
+    }
+    return chunks;
+}
+
+void load_material_library(const std::filesystem::path& path,
+                           std::vector<tinyobj::material_t>& materials,
+                           std::map<std::string, int>& material_map) {
+    std::ifstream stream(path);
+    if (!stream) {
+        std::cout << "Ignoring missing material library " << path.string() << '\n';
+        return;
+    }
+    std::string warning;
+    std::string error;
+    tinyobj::LoadMtl(&material_map, &materials, &stream, &warning, &error);
+}
+
+// Loads the libraries the chunks name and resolves their `usemtl` names, carrying the material in effect from one
+// chunk to the next
+void resolve_materials(std::vector<obj_chunk>& chunks,
+                       const std::filesystem::path& base_folder,
+                       cg::world::obj_data& data) {
+    std::map<std::string, int> material_map;
+    for (const obj_chunk& chunk : chunks) {
+        for (const std::string& library : chunk.material_libraries) {
+            std::filesystem::path library_path = base_folder / library;
+            if (std::find(data.material_libraries.begin(), data.material_libraries.end(), library_path) !=
+                data.material_libraries.end())
+                continue;
+            data.material_libraries.push_back(library_path);
+            load_material_library(library_path, data.materials, material_map);
+        }
+    }
+
+    bool needs_default = false;
+    int material_id = -1;
+    for (obj_chunk& chunk : chunks) {
+        chunk.first_material = material_id;
+        chunk.material_ids.resize(chunk.material_starts.size());
+        std::size_t range_begin = 0;
+        for (std::size_t start_i = 0; start_i <= chunk.material_starts.size(); ++start_i) {
+            bool is_last = start_i == chunk.material_starts.size();
+            std::size_t range_end = is_last ? chunk.triangle_count : chunk.material_starts[start_i].first;
+            needs_default = needs_default || (material_id < 0 && range_end > range_begin);
+            if (is_last)
+                break;
+
+            auto found = material_map.find(chunk.material_starts[start_i].second);
+            material_id = found != material_map.end() ? found->second : -1;
+            chunk.material_ids[start_i] = material_id;
+            range_begin = range_end;
+        }
+    }
+
+    // Faces without a known material share a neutral gray one, so material ids always index `materials`
+    if (needs_default) {
+        tinyobj::material_t& material = data.materials.emplace_back();
+        material.name = "default";
+        std::fill(std::begin(material.diffuse), std::end(material.diffuse), 0.6F);
+        int default_id = static_cast<int>(data.materials.size()) - 1;
+        for (obj_chunk& chunk : chunks) {
+            chunk.first_material = chunk.first_material < 0 ? default_id : chunk.first_material;
+            std::replace(chunk.material_ids.begin(), chunk.material_ids.end(), -1, default_id);
+        }
+    }
+}
+
+// Splits the file's triangles into shapes at `o` and `g` lines, dropping the ones without faces, and names the
+// shapes in `data`
+std::vector<std::vector<shape_part>> collect_shapes(std::vector<obj_chunk>& chunks, cg::world::obj_data& data) {
+    std::vector<std::vector<shape_part>> shapes;
+    std::vector<shape_part> parts;
+    std::string name;
+    auto flush_shape = [&](std::string next_name) {
+        if (!parts.empty()) {
+            for (const shape_part& part : parts)
+                ++chunks[part.chunk].pending_shapes;
+            shapes.push_back(std::move(parts));
+            data.shapes.emplace_back().name = std::move(name);
+        }
+        parts = {};
+        name = std::move(next_name);
+    };
+
+    for (std::size_t chunk_i = 0; chunk_i < chunks.size(); ++chunk_i) {
+        obj_chunk& chunk = chunks[chunk_i];
+        std::size_t range_begin = 0;
+        for (std::size_t start_i = 0; start_i <= chunk.shape_starts.size(); ++start_i) {
+            bool is_last = start_i == chunk.shape_starts.size();
+            std::size_t range_end = is_last ? chunk.triangle_count : chunk.shape_starts[start_i].first;
+            if (range_end > range_begin)
+                parts.push_back({chunk_i, range_begin, range_end});
+            if (!is_last)
+                flush_shape(std::move(chunk.shape_starts[start_i].second));
+            range_begin = range_end;
+        }
+    }
+    flush_shape({});
+    return shapes;
+}
+
+// Concatenates a shape's triangles from the parsed chunks in file order
+void gather_shape(const std::vector<shape_part>& parts, const std::vector<obj_chunk>& chunks, tinyobj::shape_t& shape) {
+    std::size_t triangle_count = 0;
+    for (const shape_part& part : parts)
+        triangle_count += part.end - part.begin;
+    shape.mesh.indices.reserve(3 * triangle_count);
+    shape.mesh.num_face_vertices.assign(triangle_count, 3);
+    shape.mesh.material_ids.reserve(triangle_count);
+
+    for (const shape_part& part : parts) {
+        const obj_chunk& chunk = chunks[part.chunk];
+        shape.mesh.indices.insert(shape.mesh.indices.end(),
+                                  chunk.indices.begin() + static_cast<std::ptrdiff_t>(3 * part.begin),
+                                  chunk.indices.begin() + static_cast<std::ptrdiff_t>(3 * part.end));
+
+        // A `usemtl` line applies from the triangle count it was noted at
+        auto is_before = [](std::size_t triangle, const std::pair<std::size_t, std::string>& start) {
+            return triangle < start.first;
+        };
+        const auto& starts = chunk.material_starts;
+        auto start_i = static_cast<std::size_t>(
+            std::upper_bound(starts.begin(), starts.end(), part.begin, is_before) - starts.begin());
+        for (std::size_t triangle_i = part.begin; triangle_i < part.end; ++triangle_i) {
+            while (start_i < chunk.material_starts.size() && chunk.material_starts[start_i].first <= triangle_i)
+                ++start_i;
+            shape.mesh.material_ids.push_back(start_i > 0 ? chunk.material_ids[start_i - 1] : chunk.first_material);
+        }
+    }
+}
+
+} // namespace
+
+cg::world::obj_data cg::world::parse_obj(const std::filesystem::path& path,
+                                         std::size_t thread_count,
+                                         const obj_stream_callbacks* stream) {
+    if (thread_count == 0)
+        thread_count = utils::get_hardware_thread_count();
+
+    utils::mapped_file file(path);
+    const auto* text = reinterpret_cast<const char*>(file.get_data());
+    std::vector<obj_chunk> chunks = split_into_chunks(text, file.get_size(), thread_count);
+
+    utils::parallel_for(chunks.size(), thread_count, [&](std::size_t i, std::size_t) { scan_chunk(chunks[i]); });
+
+    obj_data data;
+    std::size_t vertex_count = 0;
+    std::size_t normal_count = 0;
+    std::size_t texcoord_count = 0;
+    for (obj_chunk& chunk : chunks) {
+        chunk.vertex_offset = vertex_count;
+        chunk.normal_offset = normal_count;
+        chunk.texcoord_offset = texcoord_count;
+        vertex_count += chunk.vertex_count;
+        normal_count += chunk.normal_count;
+        texcoord_count += chunk.texcoord_count;
+    }
+    data.attrib.vertices.resize(3 * vertex_count);
+    data.attrib.normals.resize(3 * normal_count);
+    data.attrib.texcoords.resize(2 * texcoord_count);
+    resolve_materials(chunks, path.parent_path(), data);
+    std::vector<std::vector<shape_part>> shapes = collect_shapes(chunks, data);
+
+    if (stream == nullptr) {
+        utils::parallel_for(
+            chunks.size(), thread_count, [&](std::size_t i, std::size_t) { parse_chunk(chunks[i], data.attrib); });
+        utils::parallel_for(shapes.size(), thread_count, [&](std::size_t i, std::size_t) {
+            gather_shape(shapes[i], chunks, data.shapes[i]);
+        });
+        return data;
+    }
+
+    // Chunks are handed out in file order, so the parsed ones mostly form a prefix, and shapes are passed on in
+    // file order by whichever thread completes the prefix they need
+    stream->on_begin(data);
+    std::mutex mutex;
+    std::vector<bool> is_parsed(chunks.size());
+    std::size_t parsed_count = 0; // leading chunks all parsed
+    std::size_t next_shape = 0;
+    auto is_ready = [&](const std::vector<shape_part>& parts) {
+        return std::all_of(parts.begin(), parts.end(), [&](const shape_part& part) {
+            return part.chunk < parsed_count && chunks[part.chunk].required_chunks <= parsed_count;
+        });
+    };
+    utils::parallel_for(chunks.size(), thread_count, [&](std::size_t chunk_i, std::size_t) {
+        parse_chunk(chunks[chunk_i], data.attrib);
+        chunks[chunk_i].required_chunks = count_required_chunks(chunks, chunks[chunk_i]);
+
+        std::vector<std::size_t> ready;
+        {
+            std::lock_guard lock(mutex);
+            is_parsed[chunk_i] = true;
+            while (parsed_count < chunks.size() && is_parsed[parsed_count])
+                ++parsed_count;
+            while (next_shape < shapes.size() && is_ready(shapes[next_shape]))
+                ready.push_back(next_shape++);
+        }
+        for (std::size_t shape_i : ready) {
+            tinyobj::shape_t shape;
+            shape.name = data.shapes[shape_i].name;
+            gather_shape(shapes[shape_i], chunks, shape);
+
+            // Chunks are released once every shape they hold part of is gathered
+            {
+                std::lock_guard lock(mutex);
+                for (const shape_part& part : shapes[shape_i]) {
+                    if (--chunks[part.chunk].pending_shapes == 0)
+                        chunks[part.chunk].indices = {};
+                }
+            }
+            stream->on_shape(shape_i, shape, data);
+        }
+    });
+    return data;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <tiny_obj_loader.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+namespace cg::world {
+
+struct obj_data {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    // Every `mtllib` the file names, resolved next to it, including missing ones
+    std::vector<std::filesystem::path> material_libraries;
+};
+
+// Hooks for taking shapes over while the file is still being parsed
+struct obj_stream_callbacks {
+    // Once the materials are final and `shapes` holds every shape, with names only
+    std::function<void(const obj_data& data)> on_begin;
+    // On a parsing thread, in file order, once the shape's faces and every attribute they reference are parsed
+    std::function<void(std::size_t shape_index, tinyobj::shape_t& shape, const obj_data& data)> on_shape;
+};
+
+// Parallel OBJ loader producing tinyobjloader's structures. The file is memory-mapped and split into line-aligned
+// chunks: a first sweep counts attributes and triangles and notes where shapes and materials start, so that a
+// second one can parse every chunk independently, and the faces are then gathered into shapes in file order.
+// Polygons are fan-triangulated; faces without a known material get a default one appended to `materials`.
+// `thread_count` 0 uses every hardware thread. With `stream`, shapes are handed to it instead of kept in `shapes`.
+obj_data parse_obj(const std::filesystem::path& path,
+                   std::size_t thread_count = 0,
+                   const obj_stream_callbacks* stream = nullptr);
+
+} // namespace cg::world
@@ -0,0 +1,64 @@
+#include "primitive.h"
+
+#include <cmath>
+
+cg::world::shape_primitive cg::world::fit_primitive(const cg::resource<cg::vertex>& vertex_buffer,
+                                                    const cg::resource<std::size_t>& index_buffer) {
+    static constexpr std::size_t kMinSphereVertices = 32;
+    static constexpr float kSphereTolerance = 1e-3F;
+    static constexpr float kSphereCoverage = 0.05F;
+    static constexpr float kQuadTolerance = 1e-4F;
+
+    shape_primitive primitive{};
+    std::size_t vertex_count = vertex_buffer.count();
+    if (vertex_count == 0)
+        return primitive;
+
+    float3 bounds_min = vertex_buffer.item(0).v;
+    float3 bounds_max = bounds_min;
+    for (std::size_t i = 1; i < vertex_count; ++i) {
+        bounds_min = linalg::min(bounds_min, vertex_buffer.item(i).v);
+        bounds_max = linalg::max(bounds_max, vertex_buffer.item(i).v);
+    }
+
+    // Two triangles over four corners that form a parallelogram: the diagonals share their midpoint
+    if (index_buffer.count() == 6 && vertex_count == 4) {
+        float tolerance = kQuadTolerance * linalg::length(bounds_max - bounds_min);
+        static constexpr std::size_t kPairings[3][4] = {{0, 1, 2, 3}, {0, 2, 1, 3}, {0, 3, 1, 2}};
+        for (const auto& pairing : kPairings) {
+            const float3& a = vertex_buffer.item(pairing[0]).v;
+            const float3& b = vertex_buffer.item(pairing[1]).v;
+            const float3& c = vertex_buffer.item(pairing[2]).v;
+            const float3& d = vertex_buffer.item(pairing[3]).v;
+            if (linalg::length((a + b) - (c + d)) / 2.F <= tolerance) {
+                primitive.type = primitive_type::quad;
+                primitive.origin = a;
+                primitive.edge_u = c - a;
+                primitive.edge_v = d - a;
+                return primitive;
+            }
+        }
+        return primitive;
+    }
+
+    // Closed tessellated sphere: every vertex at the same distance from the bounding box center, and the box
+    // spanning the full diameter on all axes so domes and other caps are rejected
+    if (vertex_count >= kMinSphereVertices) {
+        float3 center = (bounds_min + bounds_max) / 2.F;
+        float radius = 0.F;
+        for (std::size_t i = 0; i < vertex_count; ++i)
+            radius += linalg::length(vertex_buffer.item(i).v - center);
+        radius /= static_cast<float>(vertex_count);
+
+        if (linalg::minelem(bounds_max - bounds_min) < 2.F * radius * (1.F - kSphereCoverage))
+            return primitive;
+        for (std::size_t i = 0; i < vertex_count; ++i) {
+            if (std::abs(linalg::length(vertex_buffer.item(i).v - center) - radius) > kSphereTolerance * radius)
+                return primitive;
+        }
+        primitive.type = primitive_type::sphere;
+        primitive.origin = center;
+        primitive.radius = radius;
+    }
+    return primitive;
+}
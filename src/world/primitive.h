@@ -0,0 +1,33 @@
+#pragma once
+
+#include "resource.h"
+
+#include <linalg.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cg::world {
+
+using namespace linalg::aliases;
+
+enum class primitive_type : std::uint8_t {
+    mesh,
+    sphere,
+    quad,
+};
+
+// Analytic surface a shape's triangles were recognized as; the triangles stay available for rasterization
+struct shape_primitive {
+    primitive_type type = primitive_type::mesh;
+    float3 origin; // sphere center or quad corner
+    float radius = 0.F;
+    float3 edge_u; // quad sides starting at `origin`
+    float3 edge_v;
+};
+
+// Recognizes a shape tessellating a sphere or made of two triangles over a parallelogram; anything else is a mesh
+shape_primitive fit_primitive(const cg::resource<cg::vertex>& vertex_buffer,
+                              const cg::resource<std::size_t>& index_buffer);
+
+} // namespace cg::world
@@ -0,0 +1,143 @@
+#include "scene.h"
+
+#include "utils/error_handler.h"
+#include "utils/json.h"
+#include "utils/mapped_file.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+using namespace linalg::aliases;
+
+namespace {
+
+float3 read_float3(const cg::utils::json_value& value, float fallback) {
+    return {value[0].as_float(fallback), value[1].as_float(fallback), value[2].as_float(fallback)};
+}
+
+float4x4 get_instance_transform(const cg::utils::json_value& instance) {
+    static constexpr float kRadiansPerDegree = 0.0174532925F;
+    const cg::utils::json_value& matrix = instance["matrix"];
+    if (!matrix.is_null()) {
+        if (matrix.size() != 16)
+            THROW_ERROR("Scene instance matrices need 16 numbers");
+        auto column = [&](std::size_t column_i) {
+            return float4{matrix[column_i * 4].as_float(),
+                          matrix[(column_i * 4) + 1].as_float(),
+                          matrix[(column_i * 4) + 2].as_float(),
+                          matrix[(column_i * 4) + 3].as_float()};
+        };
+        return {column(0), column(1), column(2), column(3)};
+    }
+
+    float3 angles = read_float3(instance["rotation"], 0.F) * kRadiansPerDegree;
+    float4 rotation = linalg::qmul(linalg::rotation_quat(float3{0.F, 0.F, 1.F}, angles.z),
+                                   linalg::qmul(linalg::rotation_quat(float3{0.F, 1.F, 0.F}, angles.y),
+                                                linalg::rotation_quat(float3{1.F, 0.F, 0.F}, angles.x)));
+    return linalg::mul(linalg::mul(linalg::translation_matrix(read_float3(instance["translation"], 0.F)),
+                                   linalg::rotation_matrix(rotation)),
+                       linalg::scaling_matrix(read_float3(instance["scale"], 1.F)));
+}
+
+} // namespace
+
+bool cg::world::scene::is_scene_file(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return extension == ".json";
+}
+
+void cg::world::scene::load(const std::filesystem::path& path,
+                            model& target,
+                            bool use_cache,
+                            bool optimize_meshes,
+                            bool merge_shapes) {
+    instances.clear();
+    lights.clear();
+    if (!is_scene_file(path)) {
+        target.load(path, use_cache, optimize_meshes);
+        if (merge_shapes)
+            target.merge_shapes();
+        return;
+    }
+
+    utils::json_value document;
+    {
+        utils::mapped_file file(path);
+        document = utils::json_value::parse({reinterpret_cast<const char*>(file.get_data()), file.get_size()});
+    }
+    const utils::json_value& models = document["models"];
+    const utils::json_value& source_instances = document["instances"];
+
+    // Names map to model files, and files to the parts they load into, so aliases share one load
+    std::vector<model> parts;
+    std::unordered_map<std::string, std::size_t> part_of_file;
+    std::vector<std::size_t> instance_parts;
+    for (std::size_t instance_i = 0; instance_i < source_instances.size(); ++instance_i) {
+        const std::string& name = source_instances[instance_i]["model"].as_string();
+        const std::string& model_file = models[name].as_string();
+        if (model_file.empty())
+            THROW_ERROR("Scene instance " + std::to_string(instance_i) + " names an unknown model '" + name + "'");
+
+        std::filesystem::path model_path = path.parent_path() / model_file;
+        auto [found, inserted] = part_of_file.try_emplace(model_path.lexically_normal().generic_string(), parts.size());
+        if (inserted) {
+            model& part = parts.emplace_back();
+            part.set_texture_cache(target.get_texture_cache());
+            part.load(model_path, use_cache, optimize_meshes);
+            if (merge_shapes)
+                part.merge_shapes();
+        }
+        instance_parts.push_back(found->second);
+    }
+
+    std::vector<std::size_t> first_shapes;
+    std::size_t shape_count = target.get_index_buffers().size();
+    for (const model& part : parts) {
+        first_shapes.push_back(shape_count);
+        shape_count += part.get_index_buffers().size();
+    }
+    for (std::size_t instance_i = 0; instance_i < source_instances.size(); ++instance_i) {
+        std::size_t part_i = instance_parts[instance_i];
+        instances.push_back({first_shapes[part_i],
+                             parts[part_i].get_index_buffers().size(),
+                             get_instance_transform(source_instances[instance_i])});
+    }
+
+    const utils::json_value& source_lights = document["lights"];
+    for (std::size_t light_i = 0; light_i < source_lights.size(); ++light_i) {
+        const utils::json_value& light = source_lights[light_i];
+        lights.push_back({read_float3(light["position"], 0.F), read_float3(light["color"], 1.F)});
+    }
+
+    // Last, so that whoever the shape callback notifies already finds the instances and lights
+    target.append(std::move(parts));
+}
+
+const std::vector<cg::world::scene_instance>& cg::world::scene::get_instances() const {
+    return instances;
+}
+
+const std::vector<cg::world::scene_light>& cg::world::scene::get_lights() const {
+    return lights;
+}
+
+std::vector<cg::world::shape_instance> cg::world::scene::get_shape_instances(const model& model) const {
+    std::vector<shape_instance> result;
+    if (instances.empty()) {
+        for (std::size_t shape_i = 0; shape_i < model.get_index_buffers().size(); ++shape_i)
+            result.push_back({shape_i, model.get_world_matrix()});
+        return result;
+    }
+    for (const scene_instance& instance : instances) {
+        for (std::size_t shape_i = 0; shape_i < instance.shape_count; ++shape_i)
+            result.push_back({instance.first_shape + shape_i, instance.transform});
+    }
+    return result;
+}
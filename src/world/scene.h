@@ -0,0 +1,72 @@
+#pragma once
+
+#include "model.h"
+
+#include <linalg.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+namespace cg::world {
+
+using namespace linalg::aliases;
+
+struct scene_light {
+    float3 position;
+    float3 color;
+};
+
+// Shapes of one model placed in the world; every instance of a model refers to the same shapes
+struct scene_instance {
+    std::size_t first_shape = 0;
+    std::size_t shape_count = 0;
+    float4x4 transform = linalg::identity;
+};
+
+// A shape with the transform of one instance that contains it
+struct shape_instance {
+    std::size_t shape_index;
+    float4x4 transform;
+};
+
+// Models, their instances and point lights, described in a JSON file:
+//
+//     {
+//         "models": {"box": "CornellBox-Original.obj", "tree": "assets/tree.glb"},
+//         "instances": [
+//             {"model": "box"},
+//             {"model": "tree", "translation": [2, 0, 0], "rotation": [0, 90, 0], "scale": [0.5, 0.5, 0.5]},
+//             {"model": "tree", "matrix": [1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, -2, 0, 0, 1]}
+//         ],
+//         "lights": [{"position": [0, 1.58, -0.03], "color": [0.78, 0.78, 0.78]}]
+//     }
+//
+// Model paths are relative to the scene file. Rotations are in degrees about x, then y, then z; a `matrix` is
+// column-major and replaces the other three. Each model file is loaded once however many instances and names
+// refer to it, and only if an instance does.
+class scene {
+  public:
+    // Scene files have the `.json` extension
+    [[nodiscard]] static bool is_scene_file(const std::filesystem::path& path);
+
+    // A scene file appends the models it instances to `target` once all of them are loaded, so a shape callback
+    // on `target` sees every shape at once. Any other file is loaded into `target` as a plain model, with no
+    // instances or lights. `merge_shapes` merges each model's shapes before they reach `target`.
+    void load(const std::filesystem::path& path,
+              model& target,
+              bool use_cache = false,
+              bool optimize_meshes = false,
+              bool merge_shapes = false);
+
+    [[nodiscard]] const std::vector<scene_instance>& get_instances() const;
+    [[nodiscard]] const std::vector<scene_light>& get_lights() const;
+    // Every shape of every instance, or each shape of a plain model once at its world matrix
+    [[nodiscard]] std::vector<shape_instance> get_shape_instances(const model& model) const;
+
+  private:
+    std::vector<scene_instance> instances;
+    std::vector<scene_light> lights;
+};
+
+} // namespace cg::world
@@ -0,0 +1,297 @@
+#include "texture.h"
+
+#include "tile_cache.h"
+
+#include "utils/error_handler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace linalg::aliases;
+
+namespace {
+
+constexpr std::size_t kTileTexels = cg::world::texture::kTileSize * cg::world::texture::kTileSize;
+
+float3 to_float3(const cg::unsigned_color& texel) {
+    static constexpr float kMax = 255.F;
+    return float3{static_cast<float>(texel.r), static_cast<float>(texel.g), static_cast<float>(texel.b)} / kMax;
+}
+
+// Wraps texel coordinates that may lie outside [0, size)
+std::size_t wrap(std::ptrdiff_t coordinate, std::size_t size) {
+    auto signed_size = static_cast<std::ptrdiff_t>(size);
+    return static_cast<std::size_t>(((coordinate % signed_size) + signed_size) % signed_size);
+}
+
+// Half-width of the mip filter, in target texels, and the Kaiser window's shape parameter
+constexpr float kFilterRadius = 3.F;
+constexpr float kKaiserAlpha = 4.F;
+
+// Modified Bessel function of the first kind and order zero, from its power series
+float bessel_i0(float x) {
+    float sum = 1.F;
+    float term = 1.F;
+    float half_x = 0.5F * x;
+    for (int k = 1; term > 1e-7F * sum; ++k) {
+        term *= (half_x / static_cast<float>(k)) * (half_x / static_cast<float>(k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Kaiser-windowed sinc at `distance` target texels from the center
+float kaiser_sinc(float distance) {
+    static constexpr float kPi = 3.14159265358979F;
+    float ratio = distance / kFilterRadius;
+    if (ratio * ratio >= 1.F)
+        return 0.F;
+    float window = bessel_i0(kKaiserAlpha * std::sqrt(1.F - (ratio * ratio))) / bessel_i0(kKaiserAlpha);
+    float x = kPi * distance;
+    return std::abs(x) < 1e-6F ? window : window * std::sin(x) / x;
+}
+
+// Source texels one target texel blends, starting at `first`, which may lie outside the level and wraps
+struct filter_taps {
+    std::ptrdiff_t first;
+    std::vector<float> weights;
+};
+
+// Taps for every target texel along one axis. A size that stays the same keeps its texels, as the sinc vanishes
+// at every other texel center.
+std::vector<filter_taps> get_filter_taps(std::size_t source_size, std::size_t target_size) {
+    float scale = static_cast<float>(source_size) / static_cast<float>(target_size);
+    std::vector<filter_taps> taps(target_size);
+    for (std::size_t target_i = 0; target_i < target_size; ++target_i) {
+        float center = (static_cast<float>(target_i) + 0.5F) * scale;
+        auto first = static_cast<std::ptrdiff_t>(std::ceil(center - (kFilterRadius * scale) - 0.5F));
+        auto last = static_cast<std::ptrdiff_t>(std::floor(center + (kFilterRadius * scale) - 0.5F));
+        filter_taps& target = taps[target_i];
+        target.first = first;
+        float sum = 0.F;
+        for (std::ptrdiff_t source_i = first; source_i <= last; ++source_i) {
+            float weight = kaiser_sinc((static_cast<float>(source_i) + 0.5F - center) / scale);
+            target.weights.push_back(weight);
+            sum += weight;
+        }
+        for (float& weight : target.weights)
+            weight /= sum;
+    }
+    return taps;
+}
+
+} // namespace
+
+cg::world::texture::texture(const std::uint8_t* pixels, std::size_t width, std::size_t height) {
+    owned_texels.resize(build_levels(width, height));
+
+    const mip_level& base = levels.front();
+    for (std::size_t y = 0; y < height; ++y) {
+        for (std::size_t x = 0; x < width; ++x) {
+            const std::uint8_t* pixel = pixels + (3 * ((y * width) + x));
+            owned_texels[get_texel_index(base, x, y)] = {pixel[0], pixel[1], pixel[2]};
+        }
+    }
+
+    for (std::size_t level_i = 1; level_i < levels.size(); ++level_i)
+        downsample(levels[level_i - 1], levels[level_i]);
+    texels = owned_texels.data();
+    texel_count = owned_texels.size();
+}
+
+cg::world::texture::texture(const cg::unsigned_color* texels,
+                            std::size_t texel_count,
+                            std::size_t width,
+                            std::size_t height,
+                            std::shared_ptr<const void> owner)
+    : texels(texels), texel_count(texel_count), texel_owner(std::move(owner)) {
+    if (width == 0 || height == 0 || build_levels(width, height) != texel_count)
+        THROW_ERROR("Texel count doesn't match a " + std::to_string(width) + "x" + std::to_string(height) + " texture");
+}
+
+std::size_t cg::world::texture::build_levels(std::size_t width, std::size_t height) {
+    std::size_t count = 0;
+    std::size_t level_width = width;
+    std::size_t level_height = height;
+    while (true) {
+        std::size_t tiles_x = (level_width + kTileSize - 1) / kTileSize;
+        std::size_t tiles_y = (level_height + kTileSize - 1) / kTileSize;
+        levels.push_back({level_width, level_height, tiles_x, count});
+        count += tiles_x * tiles_y * kTileTexels;
+        if (level_width == 1 && level_height == 1)
+            return count;
+        level_width = std::max<std::size_t>(level_width / 2, 1);
+        level_height = std::max<std::size_t>(level_height / 2, 1);
+    }
+}
+
+void cg::world::texture::downsample(const mip_level& source, const mip_level& target) {
+    static constexpr std::size_t kChannels = 3;
+    std::vector<filter_taps> columns = get_filter_taps(source.width, target.width);
+    std::vector<filter_taps> rows = get_filter_taps(source.height, target.height);
+
+    // Source rows filtered horizontally, in a ring indexed by the unwrapped row, so the rows a target row shares
+    // with the next one are filtered once and the ring stays a few rows high at any size. Rows hold each texel's
+    // channels side by side, which the tap loops vectorize over better than `float3`.
+    std::size_t ring_size = 0;
+    for (const filter_taps& row : rows)
+        ring_size = std::max(ring_size, row.weights.size());
+    std::vector<std::vector<float>> ring(ring_size, std::vector<float>(kChannels * target.width));
+    std::vector<std::ptrdiff_t> ring_rows(ring_size, std::numeric_limits<std::ptrdiff_t>::min());
+    // A source row with the texels its taps wrap to copied past either end, so taps index it directly
+    std::ptrdiff_t padding = std::max<std::ptrdiff_t>(-columns.front().first, 0);
+    std::size_t padded_width =
+        std::max(source.width + padding, columns.back().first + padding + columns.back().weights.size());
+    std::vector<float> padded(kChannels * padded_width);
+    auto get_filtered_row = [&](std::ptrdiff_t y) -> const std::vector<float>& {
+        std::size_t slot = wrap(y, ring_size);
+        if (ring_rows[slot] != y) {
+            std::size_t source_y = wrap(y, source.height);
+            for (std::size_t x = 0; x < padded_width; ++x) {
+                std::size_t source_x = wrap(static_cast<std::ptrdiff_t>(x) - padding, source.width);
+                const cg::unsigned_color& texel = owned_texels[get_texel_index(source, source_x, source_y)];
+                padded[(kChannels * x) + 0] = static_cast<float>(texel.r);
+                padded[(kChannels * x) + 1] = static_cast<float>(texel.g);
+                padded[(kChannels * x) + 2] = static_cast<float>(texel.b);
+            }
+            for (std::size_t x = 0; x < target.width; ++x) {
+                const filter_taps& column = columns[x];
+                const float* taps = padded.data() + (kChannels * (column.first + padding));
+                float sums[kChannels] = {};
+                for (std::size_t tap_i = 0; tap_i < column.weights.size(); ++tap_i) {
+                    for (std::size_t channel = 0; channel < kChannels; ++channel)
+                        sums[channel] += column.weights[tap_i] * taps[(kChannels * tap_i) + channel];
+                }
+                std::copy(sums, sums + kChannels, ring[slot].begin() + (kChannels * x));
+            }
+            ring_rows[slot] = y;
+        }
+        return ring[slot];
+    };
+
+    // The sinc's negative lobes can overshoot, so results are clamped
+    std::vector<float> sums(kChannels * target.width);
+    for (std::size_t y = 0; y < target.height; ++y) {
+        std::fill(sums.begin(), sums.end(), 0.F);
+        for (std::size_t tap_i = 0; tap_i < rows[y].weights.size(); ++tap_i) {
+            float weight = rows[y].weights[tap_i];
+            const std::vector<float>& filtered = get_filtered_row(rows[y].first + static_cast<std::ptrdiff_t>(tap_i));
+            for (std::size_t i = 0; i < sums.size(); ++i)
+                sums[i] += weight * filtered[i];
+        }
+        auto to_byte = [](float value) {
+            static constexpr float kMax = 255.F;
+            return static_cast<std::uint8_t>(std::lround(std::clamp(value, 0.F, kMax)));
+        };
+        for (std::size_t x = 0; x < target.width; ++x) {
+            const float* sum = sums.data() + (kChannels * x);
+            owned_texels[get_texel_index(target, x, y)] = {to_byte(sum[0]), to_byte(sum[1]), to_byte(sum[2])};
+        }
+    }
+}
+
+std::size_t cg::world::texture::get_width(std::size_t level) const {
+    return levels[level].width;
+}
+
+std::size_t cg::world::texture::get_height(std::size_t level) const {
+    return levels[level].height;
+}
+
+std::size_t cg::world::texture::get_level_count() const {
+    return levels.size();
+}
+
+std::size_t cg::world::texture::get_memory_bytes() const {
+    return texel_count * sizeof(cg::unsigned_color);
+}
+
+const cg::unsigned_color* cg::world::texture::get_texels() const {
+    return texels;
+}
+
+std::size_t cg::world::texture::get_texel_count() const {
+    return texel_count;
+}
+
+void cg::world::texture::page_out(std::shared_ptr<tile_cache> pages, const std::string& name) {
+    page_source = &pages->add(name, texels, texel_count, texel_owner);
+    this->pages = std::move(pages);
+    texels = nullptr;
+    texel_count = 0;
+    owned_texels = {};
+    texel_owner = nullptr;
+}
+
+float cg::world::texture::get_lod(const float2& uv_dx, const float2& uv_dy) const {
+    float2 size{static_cast<float>(get_width()), static_cast<float>(get_height())};
+    float footprint = std::max(linalg::length2(uv_dx * size), linalg::length2(uv_dy * size));
+    // Half of log2 of the squared length; a zero footprint gives -inf, which `sample` clamps to the base level
+    return 0.5F * std::log2(footprint);
+}
+
+float3 cg::world::texture::sample(const float2& uv, float lod) const {
+    float clamped = std::clamp(lod, 0.F, static_cast<float>(levels.size() - 1));
+    auto lower = static_cast<std::size_t>(clamped);
+    float blend = clamped - static_cast<float>(lower);
+    float3 result = sample_bilinear(lower, uv);
+    if (blend > 0.F)
+        result = linalg::lerp(result, sample_bilinear(lower + 1, uv), blend);
+    return result;
+}
+
+float3 cg::world::texture::fetch(std::size_t level, std::size_t x, std::size_t y) const {
+    tile_view view;
+    return to_float3(get_texel(levels[level], x, y, view));
+}
+
+std::size_t cg::world::texture::get_texel_index(const mip_level& level, std::size_t x, std::size_t y) const {
+    std::size_t tile = ((y / kTileSize) * level.tiles_x) + (x / kTileSize);
+    return level.offset + (tile * kTileTexels) + ((y % kTileSize) * kTileSize) + (x % kTileSize);
+}
+
+const cg::unsigned_color& cg::world::texture::get_texel(const mip_level& level,
+                                                       std::size_t x,
+                                                       std::size_t y,
+                                                       tile_view& view) const {
+    if (!pages)
+        return texels[get_texel_index(level, x, y)];
+    std::size_t tile = (level.offset / kTileTexels) + ((y / kTileSize) * level.tiles_x) + (x / kTileSize);
+    if (tile != view.tile) {
+        std::shared_ptr<const tile_cache::tile> paged = pages->get(*page_source, tile);
+        view.tile = tile;
+        view.texels = paged->data();
+        view.owner = std::move(paged);
+    }
+    return view.texels[((y % kTileSize) * kTileSize) + (x % kTileSize)];
+}
+
+float3 cg::world::texture::sample_bilinear(std::size_t level, const float2& uv) const {
+    const mip_level& mip = levels[level];
+    // Texel centers sit at half-integer positions
+    float x = (uv.x - std::floor(uv.x)) * static_cast<float>(mip.width) - 0.5F;
+    float y = (1.F - (uv.y - std::floor(uv.y))) * static_cast<float>(mip.height) - 0.5F;
+    float x_floor = std::floor(x);
+    float y_floor = std::floor(y);
+    float fx = x - x_floor;
+    float fy = y - y_floor;
+
+    auto x0 = static_cast<std::ptrdiff_t>(x_floor);
+    auto y0 = static_cast<std::ptrdiff_t>(y_floor);
+    std::size_t left = wrap(x0, mip.width);
+    std::size_t right = wrap(x0 + 1, mip.width);
+    std::size_t top = wrap(y0, mip.height);
+    std::size_t bottom = wrap(y0 + 1, mip.height);
+
+    // The four texels usually share a tile, so a paged texture looks it up once
+    tile_view view;
+    float3 upper = linalg::lerp(
+        to_float3(get_texel(mip, left, top, view)), to_float3(get_texel(mip, right, top, view)), fx);
+    float3 lower = linalg::lerp(
+        to_float3(get_texel(mip, left, bottom, view)), to_float3(get_texel(mip, right, bottom, view)), fx);
+    return linalg::lerp(upper, lower, fy);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "resource.h"
+
+#include <linalg.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cg::world {
+
+using namespace linalg::aliases;
+
+class tile_cache;
+struct tile_source;
+
+// RGB image with its full mip chain. Every level is stored in square tiles, so a bilinear footprint usually lies
+// within one tile instead of spanning rows that are a whole image width apart. Texture coordinates wrap, and
+// v = 0 is the bottom row, as in OBJ files.
+class texture {
+  public:
+    static constexpr std::size_t kTileSize = 8;
+
+    // `pixels` holds packed RGB rows from the top; each smaller level is filtered down from the one above with a
+    // separable Kaiser-windowed sinc
+    texture(const std::uint8_t* pixels, std::size_t width, std::size_t height);
+    // Views a chain already built, as `get_texels` returns it, from storage such as a mapped file that `owner`
+    // keeps alive. Throws if `texel_count` doesn't fit the size.
+    texture(const cg::unsigned_color* texels,
+            std::size_t texel_count,
+            std::size_t width,
+            std::size_t height,
+            std::shared_ptr<const void> owner);
+
+    [[nodiscard]] std::size_t get_width(std::size_t level = 0) const;
+    [[nodiscard]] std::size_t get_height(std::size_t level = 0) const;
+    [[nodiscard]] std::size_t get_level_count() const;
+    // Texels the texture holds itself; none once paged out
+    [[nodiscard]] std::size_t get_memory_bytes() const;
+    // Every level's tiles back to back; empty once paged out
+    [[nodiscard]] const cg::unsigned_color* get_texels() const;
+    [[nodiscard]] std::size_t get_texel_count() const;
+
+    // Moves the texels into `pages`, or with external storage only hands it over; sampling then reads them back a
+    // tile at a time
+    void page_out(std::shared_ptr<tile_cache> pages, const std::string& name);
+
+    // Level at which one texel covers the larger of the two steps the coordinates take between adjacent pixels
+    [[nodiscard]] float get_lod(const float2& uv_dx, const float2& uv_dy) const;
+    // Trilinear: bilinear lookups in the two levels around `lod`, blended. Reads at most eight texels at any
+    // resolution.
+    [[nodiscard]] float3 sample(const float2& uv, float lod) const;
+    [[nodiscard]] float3 fetch(std::size_t level, std::size_t x, std::size_t y) const;
+
+  private:
+    struct mip_level {
+        std::size_t width;
+        std::size_t height;
+        std::size_t tiles_x;
+        std::size_t offset; // first texel in `texels`
+    };
+
+    // The paged tile a lookup last landed in, so neighbouring texels skip finding it again
+    struct tile_view {
+        std::size_t tile = std::numeric_limits<std::size_t>::max(); // counted across all levels
+        const cg::unsigned_color* texels = nullptr;
+        std::shared_ptr<const void> owner; // keeps the tile alive if it is evicted
+    };
+
+    std::vector<mip_level> levels;
+    // Either `owned_texels` or external storage
+    const cg::unsigned_color* texels = nullptr;
+    std::size_t texel_count = 0;
+    std::vector<cg::unsigned_color> owned_texels;
+    std::shared_ptr<const void> texel_owner;
+    std::shared_ptr<tile_cache> pages;
+    const tile_source* page_source = nullptr; // owned by `pages`
+
+    // Fills `levels` and returns the number of texels they take
+    std::size_t build_levels(std::size_t width, std::size_t height);
+    // Fills `target` in `owned_texels` from `source`, the level above it
+    void downsample(const mip_level& source, const mip_level& target);
+    [[nodiscard]] std::size_t get_texel_index(const mip_level& level, std::size_t x, std::size_t y) const;
+    [[nodiscard]] const cg::unsigned_color& get_texel(const mip_level& level,
+                                                      std::size_t x,
+                                                      std::size_t y,
+                                                      tile_view& view) const;
+    [[nodiscard]] float3 sample_bilinear(std::size_t level, const float2& uv) const;
+};
+
+} // namespace cg::world
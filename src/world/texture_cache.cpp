@@ -0,0 +1,164 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "texture_cache.h"
+
+#include "utils/error_handler.h"
+#include "utils/mapped_file.h"
+
+#include <stb_image.h>
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+constexpr std::uint64_t kContainerMagic = 0x3130305845544743ULL; // "CGTEX001"
+constexpr std::uint32_t kContainerVersion = 2;
+
+} // namespace
+
+cg::world::texture_cache::texture_cache(bool use_containers,
+                                        std::shared_ptr<tile_cache> tiles,
+                                        std::size_t thread_count)
+    : use_containers(use_containers), tiles(std::move(tiles)), decoders(thread_count) {}
+
+cg::world::texture_future cg::world::texture_cache::request(const std::filesystem::path& path) {
+    return find_or_submit(path, [this, path](const std::string& key) {
+        return load(path, path, key, [&path] { return decode(path); });
+    });
+}
+
+cg::world::texture_future cg::world::texture_cache::request_embedded(const std::filesystem::path& key,
+                                                                     const std::filesystem::path& source,
+                                                                     std::shared_ptr<const utils::mapped_file> file,
+                                                                     const std::byte* data,
+                                                                     std::size_t size) {
+    // The job holds on to the mapping until the bytes are decoded
+    return find_or_submit(key, [this, key, source, file = std::move(file), data, size](const std::string& entry_key) {
+        return load(key, source, entry_key, [&] { return decode_embedded(key, data, size); });
+    });
+}
+
+cg::world::texture_future
+cg::world::texture_cache::find_or_submit(const std::filesystem::path& path,
+                                         std::function<std::shared_ptr<const texture>(const std::string& key)> job) {
+    // Spellings like `textures/../textures/a.png` still find the same entry
+    std::string key = path.lexically_normal().generic_string();
+    std::lock_guard lock(mutex);
+    auto found = textures.find(key);
+    if (found != textures.end())
+        return found->second;
+
+    texture_future result = decoders.submit([job = std::move(job), key] { return job(key); }).share();
+    textures.emplace(std::move(key), result);
+    return result;
+}
+
+std::size_t cg::world::texture_cache::size() const {
+    std::lock_guard lock(mutex);
+    return textures.size();
+}
+
+// Containers sit next to `path` and are stamped with `source`, the file the image bytes come from
+std::shared_ptr<const cg::world::texture>
+cg::world::texture_cache::load(const std::filesystem::path& path,
+                               const std::filesystem::path& source,
+                               const std::string& key,
+                               const std::function<std::shared_ptr<texture>()>& decoder) const {
+    std::filesystem::path container_path = path;
+    container_path += ".cgtex";
+    std::shared_ptr<texture> result = use_containers ? load_container(container_path, source) : nullptr;
+    if (!result) {
+        // Stamped before decoding, so an image changed meanwhile makes the container stale rather than wrong
+        utils::source_stamp stamp = utils::get_source_stamp(source);
+        result = decoder();
+        if (use_containers) {
+            try {
+                save_container(container_path, stamp, *result);
+                // Paged tiles are then read from the container in place instead of being copied to scratch
+                if (tiles) {
+                    if (std::shared_ptr<texture> mapped = load_container(container_path, source))
+                        result = std::move(mapped);
+                }
+            } catch (const std::exception& error) {
+                std::cout << "Can't cache " << path.string() << ": " << utils::get_error_line(error);
+            }
+        }
+    }
+    if (tiles)
+        result->page_out(tiles, key);
+    return result;
+}
+
+std::shared_ptr<cg::world::texture> cg::world::texture_cache::decode(const std::filesystem::path& path) {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    stbi_uc* pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 3);
+    if (pixels == nullptr)
+        THROW_ERROR("Can't decode " + path.string() + ": " + stbi_failure_reason());
+
+    auto result = std::make_shared<texture>(pixels, static_cast<std::size_t>(width), static_cast<std::size_t>(height));
+    stbi_image_free(pixels);
+    return result;
+}
+
+std::shared_ptr<cg::world::texture>
+cg::world::texture_cache::decode_embedded(const std::filesystem::path& key, const std::byte* data, std::size_t size) {
+    if (size > static_cast<std::size_t>(std::numeric_limits<int>::max()))
+        THROW_ERROR("Can't decode " + key.string() + ": too large");
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    stbi_uc* pixels = stbi_load_from_memory(
+        reinterpret_cast<const stbi_uc*>(data), static_cast<int>(size), &width, &height, &channels, 3);
+    if (pixels == nullptr)
+        THROW_ERROR("Can't decode " + key.string() + ": " + stbi_failure_reason());
+
+    auto result = std::make_shared<texture>(pixels, static_cast<std::size_t>(width), static_cast<std::size_t>(height));
+    stbi_image_free(pixels);
+    return result;
+}
+
+std::shared_ptr<cg::world::texture>
+cg::world::texture_cache::load_container(const std::filesystem::path& container_path,
+                                         const std::filesystem::path& source) {
+    if (!std::filesystem::exists(container_path))
+        return nullptr;
+    try {
+        auto file = std::make_shared<utils::mapped_file>(container_path);
+        utils::binary_reader reader(file->get_data(), file->get_size());
+        if (reader.read<std::uint64_t>() != kContainerMagic || reader.read<std::uint32_t>() != kContainerVersion ||
+            reader.read<std::uint32_t>() != sizeof(cg::unsigned_color) ||
+            reader.read<std::uint32_t>() != texture::kTileSize ||
+            !(reader.read<utils::source_stamp>() == utils::get_source_stamp(source)))
+            return nullptr;
+
+        auto width = static_cast<std::size_t>(reader.read<std::uint64_t>());
+        auto height = static_cast<std::size_t>(reader.read<std::uint64_t>());
+        std::size_t texel_count = 0;
+        const cg::unsigned_color* texels = reader.view_array<cg::unsigned_color>(texel_count);
+        // The texels stay in the mapping; the texture keeps it open
+        return std::make_shared<texture>(texels, texel_count, width, height, file);
+    } catch (const std::runtime_error& error) {
+        std::cout << "Ignoring " << container_path.string() << ": " << utils::get_error_line(error);
+        return nullptr;
+    }
+}
+
+void cg::world::texture_cache::save_container(const std::filesystem::path& container_path,
+                                              const utils::source_stamp& stamp,
+                                              const texture& texture) {
+    utils::write_file_atomically(container_path, [&](utils::binary_writer& writer) {
+        writer.write(kContainerMagic);
+        writer.write(kContainerVersion);
+        writer.write(static_cast<std::uint32_t>(sizeof(cg::unsigned_color)));
+        writer.write(static_cast<std::uint32_t>(texture::kTileSize));
+        writer.write(stamp);
+        writer.write(static_cast<std::uint64_t>(texture.get_width()));
+        writer.write(static_cast<std::uint64_t>(texture.get_height()));
+        writer.write_array(texture.get_texels(), texture.get_texel_count());
+    });
+}
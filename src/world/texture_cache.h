@@ -0,0 +1,71 @@
+#pragma once
+
+#include "texture.h"
+#include "tile_cache.h"
+#include "utils/binary_io.h"
+#include "utils/mapped_file.h"
+#include "utils/parallel.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cg::world {
+
+using texture_future = std::shared_future<std::shared_ptr<const texture>>;
+
+// Decodes image files and builds their mip chains on its own threads, keeping every texture, so shapes and
+// models that name the same file share one copy. Requests return at once; the future yields the texture, or
+// throws if the file can't be decoded. With containers on, each decoded chain is also written next to its image
+// as `<image>.cgtex`, and later runs map that instead of decoding again. Given a tile cache, textures are paged out
+// to it instead of staying in memory whole, straight from their container when there is one.
+class texture_cache {
+  public:
+    explicit texture_cache(bool use_containers = false,
+                           std::shared_ptr<tile_cache> tiles = nullptr,
+                           std::size_t thread_count = utils::get_hardware_thread_count());
+
+    texture_future request(const std::filesystem::path& path);
+    // Encoded image bytes stored inside `source`, such as a binary glTF, which `file` maps. `key` names the image
+    // for later requests and for its container; the container goes stale with `source`.
+    texture_future request_embedded(const std::filesystem::path& key,
+                                    const std::filesystem::path& source,
+                                    std::shared_ptr<const utils::mapped_file> file,
+                                    const std::byte* data,
+                                    std::size_t size);
+    // Files requested so far
+    [[nodiscard]] std::size_t size() const;
+
+  private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, texture_future> textures;
+    bool use_containers;
+    std::shared_ptr<tile_cache> tiles;
+    // Last, so that in-flight decodes finish before the rest is destroyed
+    utils::thread_pool decoders;
+
+    // The entry for `path`, submitting `job` with the entry's key when there is none yet
+    texture_future find_or_submit(const std::filesystem::path& path,
+                                  std::function<std::shared_ptr<const texture>(const std::string& key)> job);
+    // Runs on the decoder threads
+    [[nodiscard]] std::shared_ptr<const texture> load(const std::filesystem::path& path,
+                                                      const std::filesystem::path& source,
+                                                      const std::string& key,
+                                                      const std::function<std::shared_ptr<texture>()>& decoder) const;
+    static std::shared_ptr<texture> decode(const std::filesystem::path& path);
+    static std::shared_ptr<texture>
+    decode_embedded(const std::filesystem::path& key, const std::byte* data, std::size_t size);
+    // Null when the container is missing, stale or broken
+    static std::shared_ptr<texture> load_container(const std::filesystem::path& container_path,
+                                                   const std::filesystem::path& source);
+    static void save_container(const std::filesystem::path& container_path,
+                               const utils::source_stamp& stamp,
+                               const texture& texture);
+};
+
+} // namespace cg::world
@@ -0,0 +1,201 @@
+#include "tile_cache.h"
+
+#include "utils/error_handler.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+cg::world::tile_cache::tile_cache(std::size_t budget_bytes) : capacity(budget_bytes / sizeof(tile)) {
+    // The remainder goes to the first shards, so together they hold no more than the budget. Below one tile per
+    // shard, some shards keep nothing resident.
+    for (std::size_t shard_i = 0; shard_i < kShardCount; ++shard_i)
+        shards[shard_i].capacity = (capacity / kShardCount) + (shard_i < capacity % kShardCount ? 1 : 0);
+
+    std::random_device random;
+    std::uniform_int_distribution<std::uint64_t> distribution;
+    path = std::filesystem::temp_directory_path() / ("cg_tiles_" + std::to_string(distribution(random)) + ".bin");
+#ifdef _WIN32
+    file_handle = CreateFileW(path.c_str(),
+                              GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ,
+                              nullptr,
+                              CREATE_NEW,
+                              FILE_ATTRIBUTE_TEMPORARY,
+                              nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = nullptr;
+        THROW_ERROR("Can't create " + path.string());
+    }
+#else
+    file_descriptor = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (file_descriptor < 0)
+        THROW_ERROR("Can't create " + path.string());
+#endif
+}
+
+cg::world::tile_cache::~tile_cache() {
+#ifdef _WIN32
+    if (file_handle != nullptr)
+        CloseHandle(file_handle);
+#else
+    if (file_descriptor >= 0)
+        close(file_descriptor);
+#endif
+    std::error_code error;
+    std::filesystem::remove(path, error);
+}
+
+const cg::world::tile_source& cg::world::tile_cache::add(const std::string& name,
+                                                         const cg::unsigned_color* texels,
+                                                         std::size_t texel_count,
+                                                         std::shared_ptr<const void> owner) {
+    std::size_t tile_count = texel_count / kTileTexels;
+    std::uint64_t first_tile = 0;
+    tile_source* source = nullptr;
+    {
+        std::lock_guard lock(sources_mutex);
+        if (!owner) {
+            first_tile = file_tiles;
+            file_tiles += tile_count;
+        }
+        source = &sources.emplace_back();
+        source->name = name;
+        source->index = sources.size() - 1;
+        source->tile_count = tile_count;
+        source->first_tile = first_tile;
+        if (owner) {
+            source->texels = texels;
+            source->owner = std::move(owner);
+            return *source;
+        }
+    }
+
+    // The range is reserved, so other textures can be written meanwhile
+    write(first_tile, texels, tile_count * sizeof(tile));
+    return *source;
+}
+
+std::shared_ptr<const cg::world::tile_cache::tile> cg::world::tile_cache::get(const tile_source& source,
+                                                                              std::size_t tile_index) {
+    if (source.owner)
+        return {source.owner, reinterpret_cast<const tile*>(source.texels + (tile_index * kTileTexels))};
+
+    // Tiles are keyed by their place in the file, which no two textures share
+    std::uint64_t file_tile = source.first_tile + tile_index;
+    shard& shard = shards[file_tile % kShardCount];
+    {
+        std::lock_guard lock(shard.mutex);
+        if (shard.hits.size() <= source.index) {
+            shard.hits.resize(source.index + 1);
+            shard.misses.resize(source.index + 1);
+        }
+        auto found = shard.entries.find(file_tile);
+        if (found != shard.entries.end()) {
+            ++shard.hits[source.index];
+            shard.recency.splice(shard.recency.begin(), shard.recency, found->second.position);
+            return found->second.data;
+        }
+        ++shard.misses[source.index];
+    }
+
+    // Read without holding the shard, so hits on other threads don't wait for the disk
+    std::shared_ptr<const tile> result = read(file_tile);
+    std::lock_guard lock(shard.mutex);
+    auto [found, inserted] = shard.entries.try_emplace(file_tile);
+    if (!inserted)
+        return found->second.data; // another thread missed on the same tile meanwhile
+    shard.recency.push_front(file_tile);
+    found->second = {shard.recency.begin(), result};
+    while (shard.entries.size() > shard.capacity) {
+        shard.entries.erase(shard.recency.back());
+        shard.recency.pop_back();
+    }
+    return result;
+}
+
+std::vector<cg::world::tile_cache::texture_stats> cg::world::tile_cache::get_stats() const {
+    std::vector<texture_stats> result;
+    {
+        std::lock_guard lock(sources_mutex);
+        for (const tile_source& source : sources)
+            result.push_back({source.name, source.tile_count, source.owner != nullptr, 0, 0});
+    }
+    for (const shard& shard : shards) {
+        std::lock_guard lock(shard.mutex);
+        for (std::size_t i = 0; i < shard.hits.size() && i < result.size(); ++i) {
+            result[i].hits += shard.hits[i];
+            result[i].misses += shard.misses[i];
+        }
+    }
+    return result;
+}
+
+std::size_t cg::world::tile_cache::get_resident_bytes() const {
+    std::size_t tiles = 0;
+    for (const shard& shard : shards) {
+        std::lock_guard lock(shard.mutex);
+        tiles += shard.entries.size();
+    }
+    return tiles * sizeof(tile);
+}
+
+std::size_t cg::world::tile_cache::get_budget_bytes() const {
+    return capacity * sizeof(tile);
+}
+
+void cg::world::tile_cache::write(std::uint64_t file_tile, const void* data, std::size_t size) {
+    const auto* bytes = static_cast<const char*>(data);
+    std::uint64_t offset = file_tile * sizeof(tile);
+    while (size > 0) {
+#ifdef _WIN32
+        OVERLAPPED position{};
+        position.Offset = static_cast<DWORD>(offset);
+        position.OffsetHigh = static_cast<DWORD>(offset >> 32U);
+        DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max()));
+        DWORD written = 0;
+        if (!WriteFile(file_handle, bytes, chunk, &written, &position) || written == 0)
+            THROW_ERROR("Can't write texture tiles to " + path.string());
+#else
+        ssize_t written = pwrite(file_descriptor, bytes, size, static_cast<off_t>(offset));
+        if (written <= 0)
+            THROW_ERROR("Can't write texture tiles to " + path.string());
+#endif
+        bytes += written;
+        offset += static_cast<std::uint64_t>(written);
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+std::shared_ptr<cg::world::tile_cache::tile> cg::world::tile_cache::read(std::uint64_t file_tile) {
+    auto result = std::make_shared<tile>();
+    std::uint64_t offset = file_tile * sizeof(tile);
+#ifdef _WIN32
+    OVERLAPPED position{};
+    position.Offset = static_cast<DWORD>(offset);
+    position.OffsetHigh = static_cast<DWORD>(offset >> 32U);
+    DWORD read_bytes = 0;
+    if (!ReadFile(file_handle, result->data(), sizeof(tile), &read_bytes, &position) || read_bytes != sizeof(tile))
+        THROW_ERROR("Can't read texture tiles from " + path.string());
+#else
+    if (pread(file_descriptor, result->data(), sizeof(tile), static_cast<off_t>(offset)) !=
+        static_cast<ssize_t>(sizeof(tile)))
+        THROW_ERROR("Can't read texture tiles from " + path.string());
+#endif
+    return result;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "resource.h"
+#include "texture.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cg::world {
+
+// One texture's tiles, either in the scratch file or in storage that `owner` keeps alive, such as a mapped
+// container
+struct tile_source {
+    std::string name;
+    std::size_t index = 0; // in the order sources were added
+    std::size_t tile_count = 0;
+    std::uint64_t first_tile = 0; // in the scratch file
+    const cg::unsigned_color* texels = nullptr;
+    std::shared_ptr<const void> owner;
+};
+
+// Texture tiles kept on disk, with the most recently used ones held in memory up to a byte budget. Textures hand
+// their tiled mip chains over once decoded and read single tiles back while sampling, so only the tiles shading
+// actually touches take up memory. Chains already in a mapped file are read from it in place, leaving residency to
+// the OS; others are copied to a scratch file. Resident tiles are split into shards by their place in the file, so
+// lookups on different tiles rarely wait for each other.
+class tile_cache {
+  public:
+    static constexpr std::size_t kTileTexels = texture::kTileSize * texture::kTileSize;
+    static constexpr std::size_t kShardCount = 16;
+    using tile = std::array<cg::unsigned_color, kTileTexels>;
+
+    struct texture_stats {
+        std::string name;
+        std::size_t tile_count = 0;
+        bool mapped = false; // read in place, so hits and misses aren't counted
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+    };
+
+    explicit tile_cache(std::size_t budget_bytes);
+    ~tile_cache();
+
+    tile_cache(const tile_cache&) = delete;
+    tile_cache(tile_cache&&) = delete;
+    tile_cache& operator=(const tile_cache&) = delete;
+    tile_cache& operator=(tile_cache&&) = delete;
+
+    // Writes whole tiles to the scratch file, or with an `owner` keeps them where they are. The source stays valid
+    // as long as the cache.
+    const tile_source& add(const std::string& name,
+                           const cg::unsigned_color* texels,
+                           std::size_t texel_count,
+                           std::shared_ptr<const void> owner = nullptr);
+    // Tile `tile_index` of `source`, counted from the start of its texels. The result stays valid after the tile is
+    // evicted, so holding it across a few lookups is safe.
+    std::shared_ptr<const tile> get(const tile_source& source, std::size_t tile_index);
+
+    [[nodiscard]] std::vector<texture_stats> get_stats() const;
+    [[nodiscard]] std::size_t get_resident_bytes() const;
+    [[nodiscard]] std::size_t get_budget_bytes() const;
+
+  private:
+    struct entry {
+        std::list<std::uint64_t>::iterator position; // in `recency`
+        std::shared_ptr<const tile> data;
+    };
+
+    struct shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::uint64_t, entry> entries;
+        std::list<std::uint64_t> recency; // most recently used first
+        std::size_t capacity = 0;         // in tiles
+        // Indexed by source
+        std::vector<std::size_t> hits;
+        std::vector<std::size_t> misses;
+    };
+
+    std::size_t capacity; // in tiles, split over the shards
+    std::array<shard, kShardCount> shards;
+
+    mutable std::mutex sources_mutex;
+    std::deque<tile_source> sources; // a deque keeps references stable while textures are added
+    std::uint64_t file_tiles = 0;
+
+    std::filesystem::path path;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+#else
+    int file_descriptor = -1;
+#endif
+
+    // Positional, so threads reading different tiles never share a file offset
+    void write(std::uint64_t file_tile, const void* data, std::size_t size);
+    [[nodiscard]] std::shared_ptr<tile> read(std::uint64_t file_tile);
+};
+
+} // namespace cg::world
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <linalg.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace cg::world {
+
+using namespace linalg::aliases;
+
+// Flat open-addressing map from OBJ corner indices (position, normal, texcoord) and material to a vertex buffer
+// index. Slots live in one array probed linearly, and the storage is kept between shapes.
+class vertex_index_table {
+  public:
+    // Empties the table for at most `key_count` distinct keys, so it never needs to grow while filling
+    void reset(std::size_t key_count);
+
+    // Returns the index stored for `key`, inserting `value` first when the key is new
+    std::uint32_t find_or_insert(const int4& key, std::uint32_t value, bool& inserted);
+
+  private:
+    static constexpr int kEmpty = std::numeric_limits<int>::min();
+
+    struct slot {
+        int4 key;
+        std::uint32_t value;
+    };
+
+    std::vector<slot> slots;
+    std::size_t mask = 0;
+
+    static std::size_t hash(const int4& key);
+};
+
+inline void vertex_index_table::reset(std::size_t key_count) {
+    // Keeps the load factor at or below 3/4 even if every key is distinct
+    std::size_t capacity = 16;
+    while (capacity * 3 < key_count * 4)
+        capacity *= 2;
+
+    if (slots.size() < capacity)
+        slots.resize(capacity);
+    std::fill(slots.begin(), slots.begin() + static_cast<std::ptrdiff_t>(capacity), slot{{kEmpty, 0, 0, 0}, 0});
+    mask = capacity - 1;
+}
+
+inline std::uint32_t vertex_index_table::find_or_insert(const int4& key, std::uint32_t value, bool& inserted) {
+    for (std::size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+        slot& slot = slots[i];
+        if (slot.key.x == kEmpty) {
+            slot = {key, value};
+            inserted = true;
+            return value;
+        }
+        if (slot.key.x == key.x && slot.key.y == key.y && slot.key.z == key.z && slot.key.w == key.w) {
+            inserted = false;
+            return slot.value;
+        }
+    }
+}
+
+inline std::size_t vertex_index_table::hash(const int4& key) {
+    std::uint64_t packed = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.x)) * 0x9E3779B97F4A7C15ULL) ^
+                           (static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.y)) * 0xC2B2AE3D27D4EB4FULL) ^
+                           (static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.z)) * 0x165667B19E3779F9ULL) ^
+                           (static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.w)) * 0x27D4EB2F165667C5ULL);
+    return static_cast<std::size_t>(packed ^ (packed >> 32));
+}
+
+} // namespace cg::world